@@ -202,6 +202,88 @@ public:
     }
 };
 
+// Fixed-capacity write stream, data stays in the inline buffer and spills to
+// the heap only when it outgrows N bytes
+template <std::size_t N>
+class CBlockheadInlineStream : public std::streambuf, public CBlockheadStream
+{
+public:
+    CBlockheadInlineStream() : CBlockheadStream(this),pHeapBuf(NULL)
+    {
+        setp(chInlineBuf,chInlineBuf + N);
+    }
+    ~CBlockheadInlineStream()
+    {
+        delete[] pHeapBuf;
+    }
+
+    void Clear()
+    {
+        ios.clear();
+        setp(pbase(),epptr());
+    }
+
+    char *GetData() const
+    {
+        return pbase();
+    }
+
+    std::size_t GetSize()
+    {
+        return (pptr() - pbase());
+    }
+
+    bool IsInline() const
+    {
+        return (pHeapBuf == NULL);
+    }
+
+protected:
+    void Reserve(std::size_t nNeed)
+    {
+        std::size_t nSize = pptr() - pbase();
+        std::size_t nCapacity = epptr() - pbase();
+        if (nSize + nNeed <= nCapacity)
+        {
+            return;
+        }
+        while (nCapacity < nSize + nNeed)
+        {
+            nCapacity *= 2;
+        }
+        char *pNewBuf = new char[nCapacity];
+        std::memcpy(pNewBuf,pbase(),nSize);
+        delete[] pHeapBuf;
+        pHeapBuf = pNewBuf;
+        setp(pHeapBuf,pHeapBuf + nCapacity);
+        pbump((int)nSize);
+    }
+
+    std::streamsize xsputn(const char *s,std::streamsize n)
+    {
+        Reserve(n);
+        std::memcpy(pptr(),s,n);
+        pbump((int)n);
+        return n;
+    }
+
+    int_type overflow(int_type c)
+    {
+        if (traits_type::eq_int_type(c,traits_type::eof()))
+        {
+            return traits_type::not_eof(c);
+        }
+        Reserve(1);
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+        return c;
+    }
+
+protected:
+    char chInlineBuf[N];
+    char *pHeapBuf;
+};
+
 // Circular buffer stream
 class CBlockheadCircularStream : public circularbuf, public CBlockheadStream
 {
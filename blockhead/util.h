@@ -51,6 +51,13 @@ inline int64 GetTimeMillis()
     return int64((microsec_clock::universal_time() - epoch).total_milliseconds());
 }
 
+inline int64 GetTimeMicros()
+{
+    using namespace boost::posix_time;
+    static ptime epoch(boost::gregorian::date(1970, 1, 1));
+    return int64((microsec_clock::universal_time() - epoch).total_microseconds());
+}
+
 inline std::string GetLocalTime()
 {
     using namespace boost::posix_time;
@@ -4,6 +4,7 @@
 
 #include "dbcacc.h"
 
+#include "dbclog.h"
 #include "dbcmysql.h"
 
 using namespace std;
@@ -18,6 +19,8 @@ CDbcDbConnect* CDbcDbConnect::DbcCreateDbConnObj(CDbcConfig& tDbcCfg)
     {
     case DBC_DBTYPE_MYSQL:
         return (CDbcDbConnect*)new CDbcMysqlDbConnect(tDbcCfg);
+    case DBC_DBTYPE_LOG:
+        return (CDbcDbConnect*)new CDbcLogDbConnect(tDbcCfg);
     default:
         break;
     }
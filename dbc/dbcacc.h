@@ -19,18 +19,32 @@ enum
 {
     DBC_DBTYPE_MYSQL = 1,
     DBC_DBTYPE_ORACLE = 2,
-    DBC_DBTYPE_SQLSERVER = 3
+    DBC_DBTYPE_SQLSERVER = 3,
+    DBC_DBTYPE_LOG = 4
 };
 
 class CDbcConfig
 {
 public:
-    CDbcConfig() {}
-    CDbcConfig(CDbcConfig& tCfg)
+    CDbcConfig()
+      : iDbType(0), usDbPort(0) {}
+    CDbcConfig(const CDbcConfig& tCfg)
       : iDbType(tCfg.iDbType), sDbIp(tCfg.sDbIp),
-        usDbPort(tCfg.usDbPort), sDbName(tCfg.sDbName), sDbUser(tCfg.sDbUser), sDbPwd(tCfg.sDbPwd) {}
+        usDbPort(tCfg.usDbPort), sDbName(tCfg.sDbName), sDbUser(tCfg.sDbUser), sDbPwd(tCfg.sDbPwd), sDbFile(tCfg.sDbFile) {}
     ~CDbcConfig() {}
 
+    CDbcConfig& operator=(const CDbcConfig& tCfg)
+    {
+        iDbType = tCfg.iDbType;
+        sDbIp = tCfg.sDbIp;
+        usDbPort = tCfg.usDbPort;
+        sDbName = tCfg.sDbName;
+        sDbUser = tCfg.sDbUser;
+        sDbPwd = tCfg.sDbPwd;
+        sDbFile = tCfg.sDbFile;
+        return *this;
+    }
+
 public:
     int iDbType;
     string sDbIp;
@@ -38,6 +52,7 @@ public:
     string sDbName;
     string sDbUser;
     string sDbPwd;
+    string sDbFile; /*DBC_DBTYPE_LOG*/
 };
 
 //-----------------------------------------------------------------------------
@@ -71,6 +86,26 @@ public:
     virtual bool GetField(unsigned int uiFieldIndex, vector<unsigned char>& vFieldValue) = 0;
 };
 
+//-----------------------------------------------------------------------------
+// Prepared statement, parameters are bound by zero-based index in the order of
+// the '?' placeholders and keep their value until bound again.
+class CDbcStatement
+{
+public:
+    virtual ~CDbcStatement() {}
+
+    virtual void Release() = 0;
+    virtual unsigned int GetParamCount() = 0;
+    virtual bool Bind(unsigned int uiParamIndex, int iValue) = 0;
+    virtual bool Bind(unsigned int uiParamIndex, unsigned int uiValue) = 0;
+    virtual bool Bind(unsigned int uiParamIndex, long long llValue) = 0;
+    virtual bool Bind(unsigned int uiParamIndex, unsigned long long ullValue) = 0;
+    virtual bool Bind(unsigned int uiParamIndex, const string& strValue) = 0;
+    virtual bool Execute() = 0;
+    virtual bool Reset() = 0;
+    virtual unsigned long long GetAffectedRows() = 0;
+};
+
 //-----------------------------------------------------------------------------
 class CDbcDbConnect
 {
@@ -84,6 +119,16 @@ public:
     virtual int GetCommitCount() = 0;
     virtual bool ExecuteStaticSql(const string& strSql) = 0;
     virtual CDbcSelect* Query(const string& strSql) = 0;
+    /* Rows are read from the server while moving through the result, the
+       connection runs nothing else until the select is released */
+    virtual CDbcSelect* QueryStream(const string& strSql) = 0;
+    virtual CDbcStatement* Prepare(const string& strSql) = 0;
+    virtual bool BeginTransaction() = 0;
+    virtual bool CommitTransaction() = 0;
+    virtual bool RollbackTransaction() = 0;
+    /* True when the last call that failed lost the connection or hit another
+       error that may pass when the call is tried again */
+    virtual bool IsTransientError() = 0;
     virtual void Release() = 0;
 
     virtual string ToEscString(const string& str) = 0;
@@ -0,0 +1,860 @@
+// Copyright (c) 2019 The BigDNSeed developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "dbclog.h"
+
+#include <boost/crc.hpp>
+#include <errno.h>
+#include <iostream>
+#include <unistd.h>
+
+#include "string.h"
+
+
+using namespace std;
+
+namespace dbc
+{
+
+/*crc32 and body length, the body is type, port, service, score and address*/
+#define DBC_LOG_RECORD_HEAD_SIZE 6
+#define DBC_LOG_RECORD_FIXED_SIZE 15
+
+boost::mutex CDbcLogStore::lockOpen;
+map<string, CDbcLogStore*> CDbcLogStore::mapStore;
+
+//-----------------------------------------------------------------------------
+CDbcLogStore::CDbcLogStore(const string& strFileIn)
+  : strFile(strFileIn), pFile(NULL), iRefCount(0), fDirty(false), tmPrevSyncTime(0), uiNextId(1), nRecordCount(0)
+{
+}
+
+CDbcLogStore::~CDbcLogStore()
+{
+    if (pFile)
+    {
+        PrSync();
+        fclose(pFile);
+        pFile = NULL;
+    }
+}
+
+CDbcLogStore* CDbcLogStore::Open(const string& strFileIn)
+{
+    boost::unique_lock<boost::mutex> lock(lockOpen);
+    map<string, CDbcLogStore*>::iterator it = mapStore.find(strFileIn);
+    if (it != mapStore.end())
+    {
+        it->second->iRefCount++;
+        return it->second;
+    }
+
+    CDbcLogStore* pStore = new CDbcLogStore(strFileIn);
+    if (!pStore->Load())
+    {
+        delete pStore;
+        return NULL;
+    }
+    pStore->iRefCount = 1;
+    mapStore[strFileIn] = pStore;
+    return pStore;
+}
+
+void CDbcLogStore::Close()
+{
+    boost::unique_lock<boost::mutex> lock(lockOpen);
+    if (--iRefCount > 0)
+    {
+        return;
+    }
+    mapStore.erase(strFile);
+    delete this;
+}
+
+bool CDbcLogStore::Put(const string& strAddress, unsigned short usPort, unsigned long long ullService, int iScore, bool fCreate)
+{
+    boost::unique_lock<boost::mutex> lock(lockStore);
+    CDbcLogKey tKey(strAddress, usPort);
+    map<CDbcLogKey, CDbcLogRow>::iterator it = mapRow.find(tKey);
+    if (it == mapRow.end())
+    {
+        if (!fCreate)
+        {
+            return true;
+        }
+        it = mapRow.insert(make_pair(tKey, CDbcLogRow())).first;
+        it->second.uiId = uiNextId++;
+        mapIdKey[it->second.uiId] = tKey;
+    }
+    it->second.ullService = ullService;
+    it->second.iScore = iScore;
+    return PrAppend(DBC_E_LOG_RECORD_PUT, tKey, it->second);
+}
+
+bool CDbcLogStore::Delete(const string& strAddress, unsigned short usPort)
+{
+    boost::unique_lock<boost::mutex> lock(lockStore);
+    CDbcLogKey tKey(strAddress, usPort);
+    map<CDbcLogKey, CDbcLogRow>::iterator it = mapRow.find(tKey);
+    if (it == mapRow.end())
+    {
+        return true;
+    }
+    CDbcLogRow tRow = it->second;
+    mapIdKey.erase(tRow.uiId);
+    mapRow.erase(it);
+    return PrAppend(DBC_E_LOG_RECORD_DELETE, tKey, tRow);
+}
+
+bool CDbcLogStore::Clear()
+{
+    boost::unique_lock<boost::mutex> lock(lockStore);
+    if (pFile)
+    {
+        fclose(pFile);
+    }
+    mapRow.clear();
+    mapIdKey.clear();
+    nRecordCount = 0;
+
+    pFile = fopen(strFile.c_str(), "wb");
+    if (pFile == NULL || fwrite(DBC_LOG_FILE_MAGIC, 1, 8, pFile) != 8)
+    {
+        fprintf(stderr, "Failed to clear log store %s: Error: %s.\n", strFile.c_str(), strerror(errno));
+        return false;
+    }
+    return PrSync();
+}
+
+void CDbcLogStore::Select(unsigned int uiAfterId, unsigned int uiLimit, vector<vector<string>>& vRow)
+{
+    boost::unique_lock<boost::mutex> lock(lockStore);
+    map<unsigned int, CDbcLogKey>::iterator it = mapIdKey.upper_bound(uiAfterId);
+    for (; it != mapIdKey.end() && (uiLimit == 0 || vRow.size() < uiLimit); ++it)
+    {
+        const CDbcLogRow& tRow = mapRow[it->second];
+        vRow.push_back(vector<string>());
+        vector<string>& vField = vRow.back();
+        vField.reserve(5);
+        vField.push_back(to_string(tRow.uiId));
+        vField.push_back(it->second.first);
+        vField.push_back(to_string(it->second.second));
+        vField.push_back(to_string(tRow.ullService));
+        vField.push_back(to_string(tRow.iScore));
+    }
+}
+
+bool CDbcLogStore::Flush()
+{
+    boost::unique_lock<boost::mutex> lock(lockStore);
+    if (pFile == NULL || fflush(pFile) != 0)
+    {
+        return false;
+    }
+    fDirty = true;
+    return true;
+}
+
+bool CDbcLogStore::Sync()
+{
+    boost::unique_lock<boost::mutex> lock(lockStore);
+    return PrSync();
+}
+
+// Changes written outside a transaction are synced once per DBC_LOG_SYNC_TIME
+void CDbcLogStore::Timer()
+{
+    boost::unique_lock<boost::mutex> lock(lockStore);
+    time_t tmCurTime = time(NULL);
+    if (fDirty && (tmCurTime - tmPrevSyncTime >= DBC_LOG_SYNC_TIME || tmCurTime < tmPrevSyncTime))
+    {
+        PrSync();
+    }
+    if (nRecordCount >= DBC_LOG_COMPACT_MIN && nRecordCount >= mapRow.size() * DBC_LOG_COMPACT_RATIO)
+    {
+        PrCompact();
+    }
+}
+
+bool CDbcLogStore::Compact()
+{
+    boost::unique_lock<boost::mutex> lock(lockStore);
+    return PrCompact();
+}
+
+size_t CDbcLogStore::GetRowCount()
+{
+    boost::unique_lock<boost::mutex> lock(lockStore);
+    return mapRow.size();
+}
+
+size_t CDbcLogStore::GetRecordCount()
+{
+    boost::unique_lock<boost::mutex> lock(lockStore);
+    return nRecordCount;
+}
+
+// Replays the file, a torn record at the end is cut off
+bool CDbcLogStore::Load()
+{
+    vector<unsigned char> vData;
+    FILE* pReadFile = fopen(strFile.c_str(), "rb");
+    if (pReadFile)
+    {
+        unsigned char sBuf[65536];
+        size_t nRead;
+        while ((nRead = fread(sBuf, 1, sizeof(sBuf), pReadFile)) > 0)
+        {
+            vData.insert(vData.end(), sBuf, sBuf + nRead);
+        }
+        fclose(pReadFile);
+    }
+
+    if (vData.empty())
+    {
+        return Clear();
+    }
+    if (vData.size() < 8 || memcmp(&vData[0], DBC_LOG_FILE_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "Failed to load log store %s: Error: bad file header.\n", strFile.c_str());
+        return false;
+    }
+
+    size_t nPos = 8;
+    while (nPos + DBC_LOG_RECORD_HEAD_SIZE <= vData.size())
+    {
+        unsigned int uiCrc;
+        unsigned short usLen;
+        memcpy(&uiCrc, &vData[nPos], 4);
+        memcpy(&usLen, &vData[nPos + 4], 2);
+        if (usLen < DBC_LOG_RECORD_FIXED_SIZE || nPos + DBC_LOG_RECORD_HEAD_SIZE + usLen > vData.size())
+        {
+            break;
+        }
+        const unsigned char* pBody = &vData[nPos + DBC_LOG_RECORD_HEAD_SIZE];
+        boost::crc_32_type tCrc;
+        tCrc.process_bytes(pBody, usLen);
+        if (tCrc.checksum() != uiCrc)
+        {
+            break;
+        }
+
+        CDbcLogRow tRow;
+        unsigned short usPort;
+        memcpy(&usPort, pBody + 1, 2);
+        memcpy(&tRow.ullService, pBody + 3, 8);
+        memcpy(&tRow.iScore, pBody + 11, 4);
+        CDbcLogKey tKey(string((const char*)pBody + DBC_LOG_RECORD_FIXED_SIZE, usLen - DBC_LOG_RECORD_FIXED_SIZE), usPort);
+
+        map<CDbcLogKey, CDbcLogRow>::iterator it = mapRow.find(tKey);
+        if (pBody[0] == DBC_E_LOG_RECORD_PUT)
+        {
+            if (it == mapRow.end())
+            {
+                tRow.uiId = uiNextId++;
+                mapRow[tKey] = tRow;
+                mapIdKey[tRow.uiId] = tKey;
+            }
+            else
+            {
+                it->second.ullService = tRow.ullService;
+                it->second.iScore = tRow.iScore;
+            }
+        }
+        else if (it != mapRow.end())
+        {
+            mapIdKey.erase(it->second.uiId);
+            mapRow.erase(it);
+        }
+        nRecordCount++;
+        nPos += DBC_LOG_RECORD_HEAD_SIZE + usLen;
+    }
+
+    if (nPos < vData.size())
+    {
+        fprintf(stderr, "Log store %s: %lu bytes of incomplete records dropped.\n",
+                strFile.c_str(), (unsigned long)(vData.size() - nPos));
+        if (truncate(strFile.c_str(), nPos) != 0)
+        {
+            fprintf(stderr, "Failed to truncate log store %s: Error: %s.\n", strFile.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    pFile = fopen(strFile.c_str(), "ab");
+    if (pFile == NULL)
+    {
+        fprintf(stderr, "Failed to open log store %s: Error: %s.\n", strFile.c_str(), strerror(errno));
+        return false;
+    }
+    tmPrevSyncTime = time(NULL);
+    return true;
+}
+
+bool CDbcLogStore::PrAppend(unsigned char ucType, const CDbcLogKey& tKey, const CDbcLogRow& tRow)
+{
+    if (pFile == NULL)
+    {
+        return false;
+    }
+    vector<unsigned char> vBuf;
+    EncodeRecord(vBuf, ucType, tKey, tRow);
+    if (fwrite(&vBuf[0], 1, vBuf.size(), pFile) != vBuf.size())
+    {
+        fprintf(stderr, "Failed to write log store %s: Error: %s.\n", strFile.c_str(), strerror(errno));
+        return false;
+    }
+    nRecordCount++;
+    return true;
+}
+
+bool CDbcLogStore::PrSync()
+{
+    if (pFile == NULL)
+    {
+        return false;
+    }
+    tmPrevSyncTime = time(NULL);
+    fDirty = false;
+    if (fflush(pFile) != 0 || fsync(fileno(pFile)) != 0)
+    {
+        fprintf(stderr, "Failed to sync log store %s: Error: %s.\n", strFile.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// The live rows are written to a new file in id order, which then replaces the log
+bool CDbcLogStore::PrCompact()
+{
+    string strCompactFile = strFile + ".compact";
+    FILE* pCompactFile = fopen(strCompactFile.c_str(), "wb");
+    if (pCompactFile == NULL)
+    {
+        fprintf(stderr, "Failed to compact log store %s: Error: %s.\n", strFile.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool fOk = (fwrite(DBC_LOG_FILE_MAGIC, 1, 8, pCompactFile) == 8);
+    vector<unsigned char> vBuf;
+    map<unsigned int, CDbcLogKey>::iterator it;
+    for (it = mapIdKey.begin(); fOk && it != mapIdKey.end(); ++it)
+    {
+        vBuf.clear();
+        EncodeRecord(vBuf, DBC_E_LOG_RECORD_PUT, it->second, mapRow[it->second]);
+        fOk = (fwrite(&vBuf[0], 1, vBuf.size(), pCompactFile) == vBuf.size());
+    }
+    fOk = (fOk && fflush(pCompactFile) == 0 && fsync(fileno(pCompactFile)) == 0);
+    fclose(pCompactFile);
+    if (!fOk)
+    {
+        fprintf(stderr, "Failed to compact log store %s: Error: %s.\n", strFile.c_str(), strerror(errno));
+        remove(strCompactFile.c_str());
+        return false;
+    }
+
+    if (pFile)
+    {
+        fclose(pFile);
+    }
+    if (rename(strCompactFile.c_str(), strFile.c_str()) != 0)
+    {
+        fprintf(stderr, "Failed to replace log store %s: Error: %s.\n", strFile.c_str(), strerror(errno));
+        remove(strCompactFile.c_str());
+        fOk = false;
+    }
+    else
+    {
+        nRecordCount = mapRow.size();
+    }
+    pFile = fopen(strFile.c_str(), "ab");
+    fDirty = false;
+    return (fOk && pFile != NULL);
+}
+
+void CDbcLogStore::EncodeRecord(vector<unsigned char>& vBuf, unsigned char ucType, const CDbcLogKey& tKey, const CDbcLogRow& tRow)
+{
+    unsigned short usLen = (unsigned short)(DBC_LOG_RECORD_FIXED_SIZE + tKey.first.size());
+    size_t nBegin = vBuf.size();
+    vBuf.resize(nBegin + DBC_LOG_RECORD_HEAD_SIZE + usLen);
+
+    unsigned char* pBody = &vBuf[nBegin + DBC_LOG_RECORD_HEAD_SIZE];
+    pBody[0] = ucType;
+    memcpy(pBody + 1, &tKey.second, 2);
+    memcpy(pBody + 3, &tRow.ullService, 8);
+    memcpy(pBody + 11, &tRow.iScore, 4);
+    memcpy(pBody + DBC_LOG_RECORD_FIXED_SIZE, tKey.first.data(), tKey.first.size());
+
+    boost::crc_32_type tCrc;
+    tCrc.process_bytes(pBody, usLen);
+    unsigned int uiCrc = tCrc.checksum();
+    memcpy(&vBuf[nBegin], &uiCrc, 4);
+    memcpy(&vBuf[nBegin + 4], &usLen, 2);
+}
+
+//-----------------------------------------------------------------------------
+CDbcLogSelect::CDbcLogSelect(const vector<string>& vFieldNameIn)
+  : vFieldName(vFieldNameIn), nCurRow(0)
+{
+}
+
+CDbcLogSelect::~CDbcLogSelect()
+{
+}
+
+void CDbcLogSelect::Release()
+{
+    delete this;
+}
+
+unsigned int CDbcLogSelect::GetFieldCount()
+{
+    return vFieldName.size();
+}
+
+bool CDbcLogSelect::GetFieldInfo(unsigned int uiFieldIndex, string& sFieldName, unsigned int& uiFieldType, unsigned int& uiFieldLen)
+{
+    return (GetFieldName(uiFieldIndex, sFieldName) && GetFieldType(uiFieldIndex, uiFieldType) && GetFieldLen(uiFieldIndex, uiFieldLen));
+}
+
+bool CDbcLogSelect::GetFieldName(unsigned int uiFieldIndex, string& sFieldName)
+{
+    if (uiFieldIndex >= vFieldName.size())
+    {
+        return false;
+    }
+    sFieldName = vFieldName[uiFieldIndex];
+    return true;
+}
+
+bool CDbcLogSelect::GetFieldType(unsigned int uiFieldIndex, unsigned int& uiFieldType)
+{
+    if (uiFieldIndex >= vFieldName.size())
+    {
+        return false;
+    }
+    uiFieldType = 0;
+    return true;
+}
+
+bool CDbcLogSelect::GetFieldLen(unsigned int uiFieldIndex, unsigned int& uiFieldLen)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    uiFieldLen = pValue->size();
+    return true;
+}
+
+bool CDbcLogSelect::MoveNext()
+{
+    if (nCurRow >= vRow.size())
+    {
+        return false;
+    }
+    nCurRow++;
+    return true;
+}
+
+unsigned char* CDbcLogSelect::GetFieldBuf(unsigned int uiFieldIndex, unsigned int& uiValueLen)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return NULL;
+    }
+    uiValueLen = pValue->size();
+    return (unsigned char*)pValue->data();
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, char& cValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    cValue = (char)atoi(pValue->c_str());
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, unsigned char& ucValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    ucValue = (unsigned char)atoi(pValue->c_str());
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, short& sValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    sValue = (short)atoi(pValue->c_str());
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, unsigned short& usValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    usValue = (unsigned short)atoi(pValue->c_str());
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, int& iValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    iValue = atoi(pValue->c_str());
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, unsigned int& uiValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    uiValue = (unsigned int)strtoul(pValue->c_str(), NULL, 10);
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, long& lValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    lValue = strtol(pValue->c_str(), NULL, 10);
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, unsigned long& ulValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    ulValue = strtoul(pValue->c_str(), NULL, 10);
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, long long& llValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    llValue = strtoll(pValue->c_str(), NULL, 10);
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, unsigned long long& ullValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    ullValue = strtoull(pValue->c_str(), NULL, 10);
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, float& fValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    fValue = strtof(pValue->c_str(), NULL);
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, double& dValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    dValue = strtod(pValue->c_str(), NULL);
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, string& strOut)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    strOut = *pValue;
+    return true;
+}
+
+bool CDbcLogSelect::GetField(unsigned int uiFieldIndex, vector<unsigned char>& vFieldValue)
+{
+    const string* pValue = GetValue(uiFieldIndex);
+    if (pValue == NULL)
+    {
+        return false;
+    }
+    vFieldValue.assign(pValue->begin(), pValue->end());
+    return true;
+}
+
+const string* CDbcLogSelect::GetValue(unsigned int uiFieldIndex)
+{
+    if (nCurRow == 0 || nCurRow > vRow.size() || uiFieldIndex >= vRow[nCurRow - 1].size())
+    {
+        return NULL;
+    }
+    return &vRow[nCurRow - 1][uiFieldIndex];
+}
+
+//-----------------------------------------------------------------------------
+CDbcLogDbConnect::CDbcLogDbConnect(CDbcConfig& tDbcCfgIn)
+  : tDbcCfg(tDbcCfgIn), iCommitCount(0), fInTransaction(false), fTransientError(false), pStore(NULL)
+{
+}
+
+CDbcLogDbConnect::~CDbcLogDbConnect()
+{
+    DisconnectDb();
+}
+
+bool CDbcLogDbConnect::ConnectDb()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    return PrConnectDb();
+}
+
+void CDbcLogDbConnect::DisconnectDb()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    if (pStore)
+    {
+        pStore->Sync();
+        pStore->Close();
+        pStore = NULL;
+    }
+}
+
+void CDbcLogDbConnect::Timer()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    if (pStore)
+    {
+        pStore->Timer();
+    }
+}
+
+void CDbcLogDbConnect::SetCommitCount(int iCount)
+{
+    iCommitCount = iCount;
+}
+
+int CDbcLogDbConnect::GetCommitCount()
+{
+    return iCommitCount;
+}
+
+bool CDbcLogDbConnect::ExecuteStaticSql(const string& strSql)
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    fprintf(stderr, "Failed to execute log store sql: Error: no sql support, statement %s.\n", strSql.c_str());
+    fTransientError = false;
+    return false;
+}
+
+CDbcSelect* CDbcLogDbConnect::Query(const string& strSql)
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    fprintf(stderr, "Failed to query log store: Error: no sql support, statement %s.\n", strSql.c_str());
+    fTransientError = false;
+    return NULL;
+}
+
+CDbcSelect* CDbcLogDbConnect::QueryStream(const string& strSql)
+{
+    return Query(strSql);
+}
+
+CDbcStatement* CDbcLogDbConnect::Prepare(const string& strSql)
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    fprintf(stderr, "Failed to prepare log store statement: Error: no sql support, statement %s.\n", strSql.c_str());
+    fTransientError = false;
+    return NULL;
+}
+
+bool CDbcLogDbConnect::BeginTransaction()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    if (!PrConnectDb())
+    {
+        return false;
+    }
+    fInTransaction = true;
+    return true;
+}
+
+bool CDbcLogDbConnect::CommitTransaction()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    fInTransaction = false;
+    if (pStore == NULL || !pStore->Sync())
+    {
+        fTransientError = true;
+        return false;
+    }
+    return true;
+}
+
+bool CDbcLogDbConnect::RollbackTransaction()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    fInTransaction = false;
+    fprintf(stderr, "Failed to rollback log store transaction: Error: changes are already applied.\n");
+    return false;
+}
+
+// Failures of the file may pass, SQL never does
+bool CDbcLogDbConnect::IsTransientError()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    return fTransientError;
+}
+
+void CDbcLogDbConnect::Release()
+{
+    delete this;
+}
+
+string CDbcLogDbConnect::ToEscString(const string& str)
+{
+    return str;
+}
+
+string CDbcLogDbConnect::ToEscString(const void* pBinary, size_t nBytes)
+{
+    return string((const char*)pBinary, nBytes);
+}
+
+bool CDbcLogDbConnect::PutRow(const string& strAddress, unsigned short usPort, unsigned long long ullService, int iScore, bool fCreate)
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    if (!PrConnectDb())
+    {
+        return false;
+    }
+    if (!pStore->Put(strAddress, usPort, ullService, iScore, fCreate))
+    {
+        fTransientError = true;
+        return false;
+    }
+    return PrFlush();
+}
+
+bool CDbcLogDbConnect::DeleteRow(const string& strAddress, unsigned short usPort)
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    if (!PrConnectDb())
+    {
+        return false;
+    }
+    if (!pStore->Delete(strAddress, usPort))
+    {
+        fTransientError = true;
+        return false;
+    }
+    return PrFlush();
+}
+
+bool CDbcLogDbConnect::ClearRows()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    if (!PrConnectDb())
+    {
+        return false;
+    }
+    if (!pStore->Clear())
+    {
+        fTransientError = true;
+        return false;
+    }
+    return true;
+}
+
+// A page is copied out of memory, there is nothing to stream
+CDbcSelect* CDbcLogDbConnect::SelectRows(unsigned int uiAfterId, unsigned int uiLimit)
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    if (!PrConnectDb())
+    {
+        return NULL;
+    }
+    static const char* vName[] = { "id", "address", "port", "service", "score" };
+    CDbcLogSelect* pSelect = new CDbcLogSelect(vector<string>(vName, vName + 5));
+    pStore->Select(uiAfterId, uiLimit, pSelect->GetRows());
+    return (CDbcSelect*)pSelect;
+}
+
+bool CDbcLogDbConnect::Compact()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    return (PrConnectDb() && pStore->Compact());
+}
+
+bool CDbcLogDbConnect::PrFlush()
+{
+    if (!fInTransaction && !pStore->Flush())
+    {
+        fTransientError = true;
+        return false;
+    }
+    return true;
+}
+
+bool CDbcLogDbConnect::PrConnectDb()
+{
+    if (pStore == NULL)
+    {
+        if (tDbcCfg.sDbFile.empty())
+        {
+            fprintf(stderr, "Failed to open log store: Error: no file.\n");
+            fTransientError = true;
+            return false;
+        }
+        pStore = CDbcLogStore::Open(tDbcCfg.sDbFile);
+    }
+    if (pStore == NULL)
+    {
+        fTransientError = true;
+        return false;
+    }
+    return true;
+}
+
+} // namespace dbc
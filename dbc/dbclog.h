@@ -0,0 +1,200 @@
+// Copyright (c) 2019 The BigDNSeed developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef __DBC_DBCLOG_H
+#define __DBC_DBCLOG_H
+
+#include <boost/thread/thread.hpp>
+#include <iostream>
+#include <map>
+#include <stdio.h>
+#include <vector>
+
+#include "dbcacc.h"
+
+
+namespace dbc
+{
+
+using namespace std;
+
+#define DBC_LOG_FILE_MAGIC "BBDNSLG1"
+#define DBC_LOG_COMPACT_MIN 100000 /*records in the file before it is compacted*/
+#define DBC_LOG_COMPACT_RATIO 2    /*records per live row that start a compaction*/
+#define DBC_LOG_SYNC_TIME 1
+
+// Embedded backend: rows keyed by address and port are kept in memory and every
+// change is appended to one log file, which is replayed on open and rewritten
+// with only the live rows once most of its records are stale. There is no SQL,
+// the rows are read and written with the row functions of CDbcLogDbConnect.
+typedef enum _DBC_E_LOG_RECORD
+{
+    DBC_E_LOG_RECORD_PUT = 1,
+    DBC_E_LOG_RECORD_DELETE = 2
+
+} DBC_E_LOG_RECORD,
+    *P_DBC_E_LOG_RECORD;
+
+class CDbcLogRow
+{
+public:
+    CDbcLogRow()
+      : uiId(0), ullService(0), iScore(0) {}
+
+    unsigned int uiId;
+    unsigned long long ullService;
+    int iScore;
+};
+
+typedef pair<string, unsigned short> CDbcLogKey;
+
+//--------------------------------------------------------------------------------
+// One store per file, shared by all connections of the process.
+class CDbcLogStore
+{
+public:
+    static CDbcLogStore* Open(const string& strFileIn);
+    void Close();
+
+    bool Put(const string& strAddress, unsigned short usPort, unsigned long long ullService, int iScore, bool fCreate);
+    bool Delete(const string& strAddress, unsigned short usPort);
+    bool Clear();
+    void Select(unsigned int uiAfterId, unsigned int uiLimit, vector<vector<string>>& vRow);
+
+    bool Flush();
+    bool Sync();
+    void Timer();
+    bool Compact();
+    size_t GetRowCount();
+    size_t GetRecordCount();
+
+private:
+    CDbcLogStore(const string& strFileIn);
+    ~CDbcLogStore();
+
+    bool Load();
+    bool PrAppend(unsigned char ucType, const CDbcLogKey& tKey, const CDbcLogRow& tRow);
+    bool PrSync();
+    bool PrCompact();
+    static void EncodeRecord(vector<unsigned char>& vBuf, unsigned char ucType, const CDbcLogKey& tKey, const CDbcLogRow& tRow);
+
+    string strFile;
+    FILE* pFile;
+    int iRefCount;
+    bool fDirty;
+    time_t tmPrevSyncTime;
+
+    map<CDbcLogKey, CDbcLogRow> mapRow;
+    map<unsigned int, CDbcLogKey> mapIdKey;
+    unsigned int uiNextId;
+    size_t nRecordCount;
+
+    boost::mutex lockStore;
+
+    static boost::mutex lockOpen;
+    static map<string, CDbcLogStore*> mapStore;
+};
+
+//--------------------------------------------------------------------------------
+class CDbcLogSelect : virtual public CDbcSelect
+{
+public:
+    CDbcLogSelect(const vector<string>& vFieldNameIn);
+    ~CDbcLogSelect();
+
+    vector<vector<string>>& GetRows()
+    {
+        return vRow;
+    }
+
+    void Release() override;
+    unsigned int GetFieldCount() override;
+    bool GetFieldInfo(unsigned int uiFieldIndex, string& sFieldName, unsigned int& uiFieldType, unsigned int& uiFieldLen) override;
+    bool GetFieldName(unsigned int uiFieldIndex, string& sFieldName) override;
+    bool GetFieldType(unsigned int uiFieldIndex, unsigned int& uiFieldType) override;
+    bool GetFieldLen(unsigned int uiFieldIndex, unsigned int& uiFieldLen) override;
+    bool MoveNext() override;
+
+    unsigned char* GetFieldBuf(unsigned int uiFieldIndex, unsigned int& uiValueLen) override;
+    bool GetField(unsigned int uiFieldIndex, char& cValue) override;
+    bool GetField(unsigned int uiFieldIndex, unsigned char& ucValue) override;
+    bool GetField(unsigned int uiFieldIndex, short& sValue) override;
+    bool GetField(unsigned int uiFieldIndex, unsigned short& usValue) override;
+    bool GetField(unsigned int uiFieldIndex, int& iValue) override;
+    bool GetField(unsigned int uiFieldIndex, unsigned int& uiValue) override;
+    bool GetField(unsigned int uiFieldIndex, long& lValue) override;
+    bool GetField(unsigned int uiFieldIndex, unsigned long& ulValue) override;
+    bool GetField(unsigned int uiFieldIndex, long long& llValue) override;
+    bool GetField(unsigned int uiFieldIndex, unsigned long long& ullValue) override;
+    bool GetField(unsigned int uiFieldIndex, float& fValue) override;
+    bool GetField(unsigned int uiFieldIndex, double& dValue) override;
+    bool GetField(unsigned int uiFieldIndex, string& strOut) override;
+    bool GetField(unsigned int uiFieldIndex, vector<unsigned char>& vFieldValue) override;
+
+private:
+    const string* GetValue(unsigned int uiFieldIndex);
+
+    vector<string> vFieldName;
+    vector<vector<string>> vRow;
+    size_t nCurRow;
+};
+
+//--------------------------------------------------------------------------------
+// The SQL functions of CDbcDbConnect fail, the store has no SQL.
+class CDbcLogDbConnect : virtual public CDbcDbConnect
+{
+public:
+    CDbcLogDbConnect(CDbcConfig& tDbcCfgIn);
+    ~CDbcLogDbConnect();
+
+    bool ConnectDb() override;
+    void DisconnectDb() override;
+    void Timer() override;
+    void SetCommitCount(int iCount) override;
+    int GetCommitCount() override;
+    bool ExecuteStaticSql(const string& strSql) override;
+    CDbcSelect* Query(const string& strSql) override;
+    CDbcSelect* QueryStream(const string& strSql) override;
+    CDbcStatement* Prepare(const string& strSql) override;
+    /* Changes are applied when executed, a transaction only groups the
+       file sync at commit and cannot be rolled back */
+    bool BeginTransaction() override;
+    bool CommitTransaction() override;
+    bool RollbackTransaction() override;
+    bool IsTransientError() override;
+    void Release() override;
+
+    string ToEscString(const string& str) override;
+    string ToEscString(const void* pBinary, size_t nBytes) override;
+    string ToEscString(const std::vector<unsigned char>& vch) override
+    {
+        return ToEscString(&vch[0], vch.size());
+    }
+
+    /* Changes are flushed to the file before they return unless a
+       transaction is open. Put without fCreate and Delete pass over a
+       missing row. The selected fields are id, address, port, service and
+       score, in id order, uiLimit 0 selects every row after uiAfterId */
+    virtual bool PutRow(const string& strAddress, unsigned short usPort, unsigned long long ullService, int iScore, bool fCreate);
+    virtual bool DeleteRow(const string& strAddress, unsigned short usPort);
+    virtual bool ClearRows();
+    virtual CDbcSelect* SelectRows(unsigned int uiAfterId, unsigned int uiLimit);
+    bool Compact();
+
+private:
+    bool PrFlush();
+    bool PrConnectDb();
+
+    CDbcConfig tDbcCfg;
+    int iCommitCount;
+    bool fInTransaction;
+    bool fTransientError;
+
+    CDbcLogStore* pStore;
+    boost::mutex lockConn;
+};
+
+} // namespace dbc
+
+#endif //__DBC_DBCLOG_H
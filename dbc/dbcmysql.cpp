@@ -4,7 +4,9 @@
 
 #include "dbcmysql.h"
 
+#include <errmsg.h>
 #include <iostream>
+#include <mysqld_error.h>
 
 #include "string.h"
 
@@ -30,9 +32,27 @@ public:
 
 static CMysqlLib __mysqlLib;
 
+// Errors of the connection and lock conflicts, the statement itself is fine
+static bool IsTransientErrno(unsigned int uiErrno)
+{
+    switch (uiErrno)
+    {
+    case CR_CONNECTION_ERROR:
+    case CR_CONN_HOST_ERROR:
+    case CR_SERVER_GONE_ERROR:
+    case CR_SERVER_LOST:
+    case ER_LOCK_WAIT_TIMEOUT:
+    case ER_LOCK_DEADLOCK:
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
 //-----------------------------------------------------------------------------
-CDbcMysqlSelect::CDbcMysqlSelect(CDbcMysqlDbConnect* pDbConnIn, const string& strSqlIn)
-  : pDbConn(pDbConnIn), strSql(strSqlIn), pMysqlRes(NULL), pMysqlRow(NULL), uiFieldCount(0), pFieldLenTable(NULL)
+CDbcMysqlSelect::CDbcMysqlSelect(CDbcMysqlDbConnect* pDbConnIn, const string& strSqlIn, bool fStreamIn)
+  : pDbConn(pDbConnIn), strSql(strSqlIn), fStream(fStreamIn), pMysqlRes(NULL), pMysqlRow(NULL), uiFieldCount(0), pFieldLenTable(NULL)
 {
 }
 
@@ -61,6 +81,7 @@ bool CDbcMysqlSelect::Query()
     {
         fprintf(stderr, "Failed to execute mysql_real_query: Error: %s.\n",
                 mysql_error(&pDbConn->tMysqlConn));
+        pDbConn->PrSetError(mysql_errno(&pDbConn->tMysqlConn));
         return false;
     }
 
@@ -72,11 +93,12 @@ bool CDbcMysqlSelect::Query()
     pMysqlRow = NULL;
     pFieldLenTable = NULL;
 
-    pMysqlRes = mysql_store_result(&pDbConn->tMysqlConn);
+    pMysqlRes = (fStream ? mysql_use_result(&pDbConn->tMysqlConn) : mysql_store_result(&pDbConn->tMysqlConn));
     if (pMysqlRes == NULL)
     {
-        fprintf(stderr, "Failed to execute mysql_store_result: Error: %s.\n",
-                mysql_error(&pDbConn->tMysqlConn));
+        fprintf(stderr, "Failed to execute %s: Error: %s.\n",
+                (fStream ? "mysql_use_result" : "mysql_store_result"), mysql_error(&pDbConn->tMysqlConn));
+        pDbConn->PrSetError(mysql_errno(&pDbConn->tMysqlConn));
         return false;
     }
 
@@ -169,6 +191,11 @@ bool CDbcMysqlSelect::MoveNext()
         return false;
     }
     pMysqlRow = mysql_fetch_row(pMysqlRes);
+    if (pMysqlRow == NULL)
+    {
+        pFieldLenTable = NULL;
+        return false;
+    }
     pFieldLenTable = mysql_fetch_lengths(pMysqlRes);
     return true;
 }
@@ -332,9 +359,213 @@ bool CDbcMysqlSelect::GetField(unsigned int uiFieldIndex, vector<unsigned char>&
     return true;
 }
 
+//---------------------------------------------------------------------------------------
+CDbcMysqlStatement::CDbcMysqlStatement(CDbcMysqlDbConnect* pDbConnIn, const string& strSqlIn)
+  : pDbConn(pDbConnIn), strSql(strSqlIn), pMysqlStmt(NULL), ulStmtThreadId(0), ullAffectedRows(0)
+{
+}
+
+CDbcMysqlStatement::~CDbcMysqlStatement()
+{
+    if (pMysqlStmt)
+    {
+        mysql_stmt_close(pMysqlStmt);
+        pMysqlStmt = NULL;
+    }
+}
+
+bool CDbcMysqlStatement::Prepare()
+{
+    if (pDbConn == NULL || strSql.empty())
+    {
+        return false;
+    }
+    if (!pDbConn->PrConnectDb())
+    {
+        return false;
+    }
+
+    if (pMysqlStmt)
+    {
+        mysql_stmt_close(pMysqlStmt);
+    }
+    pMysqlStmt = mysql_stmt_init(&pDbConn->tMysqlConn);
+    if (pMysqlStmt == NULL)
+    {
+        fprintf(stderr, "Failed to execute mysql_stmt_init: Error: %s.\n",
+                mysql_error(&pDbConn->tMysqlConn));
+        pDbConn->PrSetError(mysql_errno(&pDbConn->tMysqlConn));
+        return false;
+    }
+    if (mysql_stmt_prepare(pMysqlStmt, strSql.c_str(), strSql.size()))
+    {
+        fprintf(stderr, "Failed to execute mysql_stmt_prepare: Error: %s, Sql: %s.\n",
+                mysql_stmt_error(pMysqlStmt), strSql.c_str());
+        pDbConn->PrSetError(mysql_stmt_errno(pMysqlStmt));
+        mysql_stmt_close(pMysqlStmt);
+        pMysqlStmt = NULL;
+        return false;
+    }
+
+    ulStmtThreadId = mysql_thread_id(&pDbConn->tMysqlConn);
+
+    /*Bound values are kept when the statement is prepared again after a reconnect*/
+    unsigned long ulParamCount = mysql_stmt_param_count(pMysqlStmt);
+    if (vParam.size() != ulParamCount)
+    {
+        vParam.assign(ulParamCount, CDbcMysqlParam());
+        vParamBind.assign(ulParamCount, MYSQL_BIND());
+        for (size_t i = 0; i < vParamBind.size(); i++)
+        {
+            memset(&vParamBind[i], 0, sizeof(MYSQL_BIND));
+            vParamBind[i].buffer_type = MYSQL_TYPE_NULL;
+        }
+    }
+    return true;
+}
+
+bool CDbcMysqlStatement::PrExecute()
+{
+    if (!vParamBind.empty() && mysql_stmt_bind_param(pMysqlStmt, &vParamBind[0]))
+    {
+        return false;
+    }
+    if (mysql_stmt_execute(pMysqlStmt))
+    {
+        return false;
+    }
+    ullAffectedRows = mysql_stmt_affected_rows(pMysqlStmt);
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+void CDbcMysqlStatement::Release()
+{
+    boost::unique_lock<boost::mutex> lock(pDbConn->lockConn);
+    delete this;
+}
+
+unsigned int CDbcMysqlStatement::GetParamCount()
+{
+    return vParam.size();
+}
+
+bool CDbcMysqlStatement::BindInteger(unsigned int uiParamIndex, long long llValue, bool fUnsigned)
+{
+    if (uiParamIndex >= vParam.size())
+    {
+        return false;
+    }
+    vParam[uiParamIndex].llValue = llValue;
+
+    MYSQL_BIND& tBind = vParamBind[uiParamIndex];
+    memset(&tBind, 0, sizeof(MYSQL_BIND));
+    tBind.buffer_type = MYSQL_TYPE_LONGLONG;
+    tBind.buffer = &vParam[uiParamIndex].llValue;
+    tBind.is_unsigned = fUnsigned;
+    return true;
+}
+
+bool CDbcMysqlStatement::Bind(unsigned int uiParamIndex, int iValue)
+{
+    return BindInteger(uiParamIndex, iValue, false);
+}
+
+bool CDbcMysqlStatement::Bind(unsigned int uiParamIndex, unsigned int uiValue)
+{
+    return BindInteger(uiParamIndex, uiValue, true);
+}
+
+bool CDbcMysqlStatement::Bind(unsigned int uiParamIndex, long long llValue)
+{
+    return BindInteger(uiParamIndex, llValue, false);
+}
+
+bool CDbcMysqlStatement::Bind(unsigned int uiParamIndex, unsigned long long ullValue)
+{
+    return BindInteger(uiParamIndex, (long long)ullValue, true);
+}
+
+bool CDbcMysqlStatement::Bind(unsigned int uiParamIndex, const string& strValue)
+{
+    if (uiParamIndex >= vParam.size())
+    {
+        return false;
+    }
+    CDbcMysqlParam& tParam = vParam[uiParamIndex];
+    tParam.strValue = strValue;
+    tParam.ulLength = tParam.strValue.size();
+
+    MYSQL_BIND& tBind = vParamBind[uiParamIndex];
+    memset(&tBind, 0, sizeof(MYSQL_BIND));
+    tBind.buffer_type = MYSQL_TYPE_STRING;
+    tBind.buffer = (void*)tParam.strValue.data();
+    tBind.buffer_length = tParam.ulLength;
+    tBind.length = &tParam.ulLength;
+    return true;
+}
+
+bool CDbcMysqlStatement::Execute()
+{
+    boost::unique_lock<boost::mutex> lock(pDbConn->lockConn);
+    /*A reconnect from any call on the connection, ping included, drops the statement on the server*/
+    if ((pMysqlStmt == NULL || ulStmtThreadId != mysql_thread_id(&pDbConn->tMysqlConn)) && !Prepare())
+    {
+        return false;
+    }
+    if (!pDbConn->PrCheckTransaction())
+    {
+        return false;
+    }
+    if (!PrExecute())
+    {
+        unsigned int uiErrno = mysql_stmt_errno(pMysqlStmt);
+        if (uiErrno != CR_SERVER_GONE_ERROR && uiErrno != CR_SERVER_LOST
+            && uiErrno != CR_STMT_CLOSED && uiErrno != ER_UNKNOWN_STMT_HANDLER)
+        {
+            fprintf(stderr, "Failed to execute mysql_stmt_execute: Error: %s, Sql: %s.\n",
+                    mysql_stmt_error(pMysqlStmt), strSql.c_str());
+            pDbConn->PrSetError(uiErrno);
+            return false;
+        }
+        /*The statement handle is no longer valid on the server, prepare again and retry once
+          unless a transaction was open, the server has already rolled it back*/
+        if (!Prepare() || !pDbConn->PrCheckTransaction())
+        {
+            return false;
+        }
+        if (!PrExecute())
+        {
+            fprintf(stderr, "Failed to execute mysql_stmt_execute: Error: %s, Sql: %s.\n",
+                    mysql_stmt_error(pMysqlStmt), strSql.c_str());
+            pDbConn->PrSetError(mysql_stmt_errno(pMysqlStmt));
+            return false;
+        }
+    }
+    pDbConn->iStaticExeCount++;
+    pDbConn->PrCommit();
+    return true;
+}
+
+bool CDbcMysqlStatement::Reset()
+{
+    boost::unique_lock<boost::mutex> lock(pDbConn->lockConn);
+    if (pMysqlStmt == NULL)
+    {
+        return false;
+    }
+    return (mysql_stmt_reset(pMysqlStmt) == 0);
+}
+
+unsigned long long CDbcMysqlStatement::GetAffectedRows()
+{
+    return ullAffectedRows;
+}
+
 //---------------------------------------------------------------------------------------
 CDbcMysqlDbConnect::CDbcMysqlDbConnect(CDbcConfig& tDbcCfgIn)
-  : tDbcCfg(tDbcCfgIn), fIsConnect(false), fIsAutoCommit(true), iStaticExeCount(0), iCommitCount(0)
+  : tDbcCfg(tDbcCfgIn), fIsConnect(false), fIsAutoCommit(true), fInTransaction(false), fTransactionLost(false),
+    ulTransactionThreadId(0), fTransientError(false), iStaticExeCount(0), iCommitCount(0)
 {
     mysql_init(&tMysqlConn);
 }
@@ -378,6 +609,8 @@ bool CDbcMysqlDbConnect::PrConnectDb()
     {
         fprintf(stderr, "Failed to connect to database: Error: %s.\n",
                 mysql_error(&tMysqlConn));
+        /*Whatever keeps the server away, nothing can be written until it is back*/
+        fTransientError = true;
     }
 
     return fRet;
@@ -404,6 +637,10 @@ void CDbcMysqlDbConnect::PrDisconnectDb()
 
 void CDbcMysqlDbConnect::PrCommit()
 {
+    if (fInTransaction)
+    {
+        return;
+    }
     time_t tmCurTime = time(NULL);
     if (iStaticExeCount >= iCommitCount || tmCurTime - tmPrevCommitTime >= 1 || tmCurTime < tmPrevCommitTime)
     {
@@ -419,6 +656,27 @@ void CDbcMysqlDbConnect::PrCommit()
     }
 }
 
+// A reconnect gets a new thread id and the server has rolled back the open
+// transaction, it stays failed until it is committed or rolled back
+bool CDbcMysqlDbConnect::PrCheckTransaction()
+{
+    if (fInTransaction && !fTransactionLost && mysql_thread_id(&tMysqlConn) != ulTransactionThreadId)
+    {
+        fprintf(stderr, "Failed in transaction: Error: the connection was re-established.\n");
+        fTransactionLost = true;
+    }
+    if (fTransactionLost)
+    {
+        fTransientError = true;
+    }
+    return !fTransactionLost;
+}
+
+void CDbcMysqlDbConnect::PrSetError(unsigned int uiErrno)
+{
+    fTransientError = IsTransientErrno(uiErrno);
+}
+
 //------------------------------------------------------------------------------
 bool CDbcMysqlDbConnect::ConnectDb()
 {
@@ -487,7 +745,7 @@ bool CDbcMysqlDbConnect::ExecuteStaticSql(const string& strSql)
     {
         return false;
     }
-    if (!PrConnectDb())
+    if (!PrConnectDb() || !PrCheckTransaction())
     {
         return false;
     }
@@ -495,6 +753,7 @@ bool CDbcMysqlDbConnect::ExecuteStaticSql(const string& strSql)
     {
         fprintf(stderr, "Failed to execute mysql_real_query: Error: %s, Sql: %s.\n",
                 mysql_error(&tMysqlConn), strSql.c_str());
+        PrSetError(mysql_errno(&tMysqlConn));
         return false;
     }
     iStaticExeCount++;
@@ -522,6 +781,128 @@ CDbcSelect* CDbcMysqlDbConnect::Query(const string& strSql)
     return (CDbcSelect*)pSelect;
 }
 
+CDbcSelect* CDbcMysqlDbConnect::QueryStream(const string& strSql)
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    if (strSql.empty())
+    {
+        return NULL;
+    }
+    if (!PrConnectDb())
+    {
+        return NULL;
+    }
+    CDbcMysqlSelect* pSelect = new CDbcMysqlSelect(this, strSql, true);
+    if (!pSelect->Query())
+    {
+        delete pSelect;
+        return NULL;
+    }
+    return (CDbcSelect*)pSelect;
+}
+
+CDbcStatement* CDbcMysqlDbConnect::Prepare(const string& strSql)
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    if (strSql.empty())
+    {
+        return NULL;
+    }
+    CDbcMysqlStatement* pStmt = new CDbcMysqlStatement(this, strSql);
+    if (!pStmt->Prepare())
+    {
+        delete pStmt;
+        return NULL;
+    }
+    return pStmt;
+}
+
+bool CDbcMysqlDbConnect::BeginTransaction()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    if (fInTransaction)
+    {
+        return false;
+    }
+    if (!PrConnectDb())
+    {
+        return false;
+    }
+    if (!fIsAutoCommit && iStaticExeCount > 0)
+    {
+        mysql_commit(&tMysqlConn);
+        iStaticExeCount = 0;
+    }
+    if (mysql_real_query(&tMysqlConn, "START TRANSACTION", 17))
+    {
+        fprintf(stderr, "Failed to start transaction: Error: %s.\n",
+                mysql_error(&tMysqlConn));
+        PrSetError(mysql_errno(&tMysqlConn));
+        return false;
+    }
+    fInTransaction = true;
+    fTransactionLost = false;
+    ulTransactionThreadId = mysql_thread_id(&tMysqlConn);
+    return true;
+}
+
+bool CDbcMysqlDbConnect::CommitTransaction()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    if (!fInTransaction)
+    {
+        return false;
+    }
+    bool fLost = !PrCheckTransaction();
+    fInTransaction = false;
+    fTransactionLost = false;
+    iStaticExeCount = 0;
+    tmPrevCommitTime = time(NULL);
+    if (fLost)
+    {
+        return false;
+    }
+    if (mysql_commit(&tMysqlConn))
+    {
+        fprintf(stderr, "Failed to commit transaction: Error: %s.\n",
+                mysql_error(&tMysqlConn));
+        PrSetError(mysql_errno(&tMysqlConn));
+        return false;
+    }
+    return true;
+}
+
+bool CDbcMysqlDbConnect::RollbackTransaction()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    if (!fInTransaction)
+    {
+        return false;
+    }
+    bool fLost = !PrCheckTransaction();
+    fInTransaction = false;
+    fTransactionLost = false;
+    iStaticExeCount = 0;
+    if (fLost)
+    {
+        return true;
+    }
+    if (mysql_rollback(&tMysqlConn))
+    {
+        fprintf(stderr, "Failed to rollback transaction: Error: %s.\n",
+                mysql_error(&tMysqlConn));
+        PrSetError(mysql_errno(&tMysqlConn));
+        return false;
+    }
+    return true;
+}
+
+bool CDbcMysqlDbConnect::IsTransientError()
+{
+    boost::unique_lock<boost::mutex> lock(lockConn);
+    return fTransientError;
+}
+
 void CDbcMysqlDbConnect::Release()
 {
     delete this;
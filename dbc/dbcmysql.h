@@ -24,7 +24,7 @@ class CDbcMysqlDbConnect;
 class CDbcMysqlSelect : virtual public CDbcSelect
 {
 public:
-    CDbcMysqlSelect(CDbcMysqlDbConnect* pDbConnIn, const string& strSqlIn);
+    CDbcMysqlSelect(CDbcMysqlDbConnect* pDbConnIn, const string& strSqlIn, bool fStreamIn = false);
     ~CDbcMysqlSelect();
 
     bool Query();
@@ -56,6 +56,7 @@ public:
 private:
     CDbcMysqlDbConnect* pDbConn;
     string strSql;
+    bool fStream;
 
     MYSQL_RES* pMysqlRes;
     MYSQL_ROW pMysqlRow;
@@ -63,9 +64,56 @@ private:
     unsigned long* pFieldLenTable;
 };
 
+//--------------------------------------------------------------------------------
+class CDbcMysqlParam
+{
+public:
+    CDbcMysqlParam()
+      : llValue(0), ulLength(0) {}
+
+    long long llValue;
+    string strValue;
+    unsigned long ulLength;
+};
+
+class CDbcMysqlStatement : virtual public CDbcStatement
+{
+public:
+    CDbcMysqlStatement(CDbcMysqlDbConnect* pDbConnIn, const string& strSqlIn);
+    ~CDbcMysqlStatement();
+
+    bool Prepare();
+
+    void Release() override;
+    unsigned int GetParamCount() override;
+    bool Bind(unsigned int uiParamIndex, int iValue) override;
+    bool Bind(unsigned int uiParamIndex, unsigned int uiValue) override;
+    bool Bind(unsigned int uiParamIndex, long long llValue) override;
+    bool Bind(unsigned int uiParamIndex, unsigned long long ullValue) override;
+    bool Bind(unsigned int uiParamIndex, const string& strValue) override;
+    bool Execute() override;
+    bool Reset() override;
+    unsigned long long GetAffectedRows() override;
+
+private:
+    bool BindInteger(unsigned int uiParamIndex, long long llValue, bool fUnsigned);
+    bool PrExecute();
+
+    CDbcMysqlDbConnect* pDbConn;
+    string strSql;
+
+    MYSQL_STMT* pMysqlStmt;
+    unsigned long ulStmtThreadId;
+    vector<MYSQL_BIND> vParamBind;
+    vector<CDbcMysqlParam> vParam;
+    unsigned long long ullAffectedRows;
+};
+
+//--------------------------------------------------------------------------------
 class CDbcMysqlDbConnect : virtual public CDbcDbConnect
 {
     friend class CDbcMysqlSelect;
+    friend class CDbcMysqlStatement;
 
 public:
     CDbcMysqlDbConnect(CDbcConfig& tDbcCfgIn);
@@ -78,6 +126,12 @@ public:
     int GetCommitCount() override;
     bool ExecuteStaticSql(const string& strSql) override;
     CDbcSelect* Query(const string& strSql) override;
+    CDbcSelect* QueryStream(const string& strSql) override;
+    CDbcStatement* Prepare(const string& strSql) override;
+    bool BeginTransaction() override;
+    bool CommitTransaction() override;
+    bool RollbackTransaction() override;
+    bool IsTransientError() override;
     void Release() override;
 
     string ToEscString(const string& str) override;
@@ -91,6 +145,8 @@ private:
     bool PrConnectDb();
     void PrDisconnectDb();
     void PrCommit();
+    bool PrCheckTransaction();
+    void PrSetError(unsigned int uiErrno);
 
     CDbcConfig tDbcCfg;
     int iCommitCount;
@@ -98,6 +154,10 @@ private:
     MYSQL tMysqlConn;
     bool fIsConnect;
     bool fIsAutoCommit;
+    bool fInTransaction;
+    bool fTransactionLost;
+    unsigned long ulTransactionThreadId;
+    bool fTransientError;
     int iStaticExeCount;
     time_t tmPrevCommitTime;
 
@@ -19,6 +19,11 @@ CBbAddr::CBbAddr()
     iScore = 0;
     fConfidentAddr = false;
     nStartingHeight = 0;
+    nRtt = 0;
+    fScoreDirty = false;
+    iFlushScore = 0;
+    nTestSeq = 0;
+    fSession = false;
 }
 
 bool CBbAddr::SetBbAddr(string& strIp, uint16 nPort, uint64 nServiceIn, int iScoreIn)
@@ -113,9 +118,22 @@ void CBbAddr::DoScoreByHeight(int nRefHeight)
     }
 }
 
+void CBbAddr::AddRtt(uint32 nRttMs)
+{
+    nRttMs = min(max(nRttMs, (uint32)1), (uint32)0xFFFF);
+    if (nRtt == 0)
+    {
+        nRtt = nRttMs;
+    }
+    else
+    {
+        nRtt = (uint16)(((int64)nRtt * (NMS_ATP_RTT_WEIGHT - 1) + nRttMs) / NMS_ATP_RTT_WEIGHT);
+    }
+}
+
 //-------------------------------------------------------------------------
 CBbAddrPool::CBbAddrPool(CDnseedConfig* pCfg)
-  : pDnseedCfg(pCfg), pDbStorage(NULL)
+  : pDnseedCfg(pCfg), nGoodAddrCount(0), nTestSeqGen(0), pDbStorage(NULL)
 {
 }
 
@@ -166,6 +184,8 @@ bool CBbAddrPool::AddConfidentAddr(string& sAddr)
             delete pBbAddr;
             return false;
         }
+        AddGoodCountNoLock(pBbAddr->iScore, 1);
+        ScheduleTestNoLock(strAddr, pBbAddr);
         if (setConfidentAddrPool.count(strAddr) == 0)
         {
             setConfidentAddrPool.insert(strAddr);
@@ -194,11 +214,14 @@ bool CBbAddrPool::AddAddrFromDb(CMthNetEndpoint& ep, uint64 nService, int iScore
         pBbAddr->tNetEp = ep;
         pBbAddr->nService = nService;
         pBbAddr->iScore = iScore;
+        pBbAddr->iFlushScore = iScore;
         if (!mapAddrPool.insert(make_pair(strAddr, pBbAddr)).second)
         {
             delete pBbAddr;
             return false;
         }
+        AddGoodCountNoLock(pBbAddr->iScore, 1);
+        ScheduleTestNoLock(strAddr, pBbAddr);
     }
     return true;
 }
@@ -210,49 +233,70 @@ bool CBbAddrPool::AddRecvAddr(tcp::endpoint& ep, uint64 nServiceIn)
     {
         return false;
     }
-    string strAddr = tEp.ToString();
 
-    boost::unique_lock<boost::shared_mutex> lock(lockAddrPool);
-    CBbAddr* pBbAddr = GetAddrNoLock(strAddr);
-    if (pBbAddr == NULL)
+    CDNSeedNode* pNode = NULL;
+    bool fRet;
     {
-        CBbAddr* pBbAddr = new CBbAddr();
-        pBbAddr->tNetEp = tEp;
-        pBbAddr->nService = nServiceIn;
-        if (!mapAddrPool.insert(make_pair(strAddr, pBbAddr)).second)
-        {
-            delete pBbAddr;
-            return false;
-        }
-        if (pDbStorage)
+        boost::unique_lock<boost::shared_mutex> lock(lockAddrPool);
+        fRet = AddRecvAddrNoLock(tEp, nServiceIn, pNode);
+    }
+    if (pNode && (pDbStorage == NULL || !pDbStorage->PostDbMessage(pNode)))
+    {
+        delete pNode;
+    }
+    return fRet;
+}
+
+uint32 CBbAddrPool::AddRecvAddrBatch(CMsgAddressView& tAddrView)
+{
+    uint32 nCount = tAddrView.GetCount();
+    if (nCount > pDnseedCfg->nMaxAddrPerMsg)
+    {
+        nCount = pDnseedCfg->nMaxAddrPerMsg;
+    }
+
+    vector<CDNSeedNode*> vDbNode;
+    uint32 nAcceptCount = 0;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(lockAddrPool);
+        CAddress tAddr;
+        for (uint32 i = 0; i < nCount; i++)
         {
-            CDNSeedNode* pNode = new CDNSeedNode(DDN_E_MSG_TYPE_INSERT, pBbAddr->GetEp().GetIp(), pBbAddr->GetEp().GetPort(),
-                                                 pBbAddr->GetService(), pBbAddr->GetScore());
-            lock.unlock();
+            tAddrView.GetAddress(i, tAddr);
+            if ((tAddr.nService & NODE_NETWORK) != NODE_NETWORK
+                || (!pDnseedCfg->fAllowAllAddr && !tAddr.ssEndpoint.IsRoutable()))
+            {
+                continue;
+            }
+
+            tcp::endpoint ep;
+            CMthNetEndpoint tEp;
+            tAddr.ssEndpoint.GetEndpoint(ep);
+            if (!tEp.SetAddrPort(ep))
+            {
+                continue;
+            }
+
+            CDNSeedNode* pNode = NULL;
+            if (AddRecvAddrNoLock(tEp, tAddr.nService, pNode))
+            {
+                nAcceptCount++;
+            }
             if (pNode)
             {
-                pDbStorage->PostDbMessage(pNode);
+                vDbNode.push_back(pNode);
             }
         }
     }
-    else
+
+    for (size_t i = 0; i < vDbNode.size(); i++)
     {
-        if (pBbAddr->nService != nServiceIn)
+        if (pDbStorage == NULL || !pDbStorage->PostDbMessage(vDbNode[i]))
         {
-            pBbAddr->nService = nServiceIn;
-            if (pDbStorage)
-            {
-                CDNSeedNode* pNode = new CDNSeedNode(DDN_E_MSG_TYPE_UPDATE, pBbAddr->GetEp().GetIp(), pBbAddr->GetEp().GetPort(),
-                                                     pBbAddr->GetService(), pBbAddr->GetScore());
-                lock.unlock();
-                if (pNode)
-                {
-                    pDbStorage->PostDbMessage(pNode);
-                }
-            }
+            delete vDbNode[i];
         }
     }
-    return true;
+    return nAcceptCount;
 }
 
 void CBbAddrPool::DelAddr(CMthNetEndpoint& ep)
@@ -267,14 +311,19 @@ void CBbAddrPool::DelAddr(CMthNetEndpoint& ep)
         {
             setConfidentAddrPool.erase(it->first);
         }
+        if (pNode->fScoreDirty)
+        {
+            setScoreDirtyAddr.erase(it->first);
+        }
+        AddGoodCountNoLock(pNode->iScore, -1);
         mapAddrPool.erase(it);
         if (pDbStorage)
         {
             CDNSeedNode* pDbMsg = new CDNSeedNode(DDN_E_MSG_TYPE_DELETE, ep.GetIp(), ep.GetPort(), pNode->GetService(), pNode->GetScore());
             lock.unlock();
-            if (pDbMsg)
+            if (pDbMsg && !pDbStorage->PostDbMessage(pDbMsg))
             {
-                pDbStorage->PostDbMessage(pDbMsg);
+                delete pDbMsg;
             }
         }
         if (pNode)
@@ -304,20 +353,15 @@ bool CBbAddrPool::QueryAddr(CMthNetEndpoint& ep, CBbAddr& addr)
 bool CBbAddrPool::DoScore(CMthNetEndpoint& ep, int iDoValue)
 {
     boost::unique_lock<boost::shared_mutex> lock(lockAddrPool);
-    CBbAddr* pBbAddr = GetAddrNoLock(ep.ToString());
+    string strAddr = ep.ToString();
+    CBbAddr* pBbAddr = GetAddrNoLock(strAddr);
     if (pBbAddr)
     {
+        AddGoodCountNoLock(pBbAddr->iScore, -1);
         pBbAddr->DoScore(iDoValue);
-        if (pDbStorage)
-        {
-            CDNSeedNode* pNode = new CDNSeedNode(DDN_E_MSG_TYPE_DELETE, ep.GetIp(), ep.GetPort(), pBbAddr->GetService(), pBbAddr->GetScore());
-            lock.unlock();
-            if (pNode)
-            {
-                pDbStorage->PostDbMessage(pNode);
-            }
-            return true;
-        }
+        AddGoodCountNoLock(pBbAddr->iScore, 1);
+        SetScoreDirtyNoLock(strAddr, pBbAddr);
+        return true;
     }
     return false;
 }
@@ -330,12 +374,14 @@ bool CBbAddrPool::DoScore(CBbAddr& addr, int iDoValue)
 bool CBbAddrPool::UpdateHeight(CMthNetEndpoint& ep, int iHeight)
 {
     boost::unique_lock<boost::shared_mutex> lock(lockAddrPool);
-    CBbAddr* pBbAddr = GetAddrNoLock(ep.ToString());
+    string strAddr = ep.ToString();
+    CBbAddr* pBbAddr = GetAddrNoLock(strAddr);
     if (pBbAddr)
     {
-        int iOldScore = pBbAddr->GetScore();
+        AddGoodCountNoLock(pBbAddr->iScore, -1);
         pBbAddr->nStartingHeight = iHeight;
         pBbAddr->DoScoreByHeight(GetConfidentHeight());
+        AddGoodCountNoLock(pBbAddr->iScore, 1);
         if (pBbAddr->fConfidentAddr)
         {
             uint64 nTotalHeight = 0;
@@ -358,20 +404,128 @@ bool CBbAddrPool::UpdateHeight(CMthNetEndpoint& ep, int iHeight)
         }
         else
         {
-            if (iOldScore != pBbAddr->GetScore() && pDbStorage)
+            SetScoreDirtyNoLock(strAddr, pBbAddr);
+        }
+        return true;
+    }
+    return false;
+}
+
+// While a session is open the address is verified by its pings and has no
+// queued test. When the session ends the next test is due one interval after
+// the last answered ping.
+bool CBbAddrPool::SetSession(CMthNetEndpoint& ep, bool fSessionIn)
+{
+    boost::unique_lock<boost::shared_mutex> lock(lockAddrPool);
+    string strAddr = ep.ToString();
+    CBbAddr* pBbAddr = GetAddrNoLock(strAddr);
+    if (pBbAddr == NULL)
+    {
+        return false;
+    }
+    pBbAddr->fSession = fSessionIn;
+    if (fSessionIn)
+    {
+        pBbAddr->nTestSeq = ++nTestSeqGen;
+    }
+    else
+    {
+        ScheduleTestNoLock(strAddr, pBbAddr);
+    }
+    return true;
+}
+
+bool CBbAddrPool::TouchSession(CMthNetEndpoint& ep)
+{
+    boost::unique_lock<boost::shared_mutex> lock(lockAddrPool);
+    CBbAddr* pBbAddr = GetAddrNoLock(ep.ToString());
+    if (pBbAddr == NULL || !pBbAddr->fSession)
+    {
+        return false;
+    }
+    pBbAddr->tTestParam.nPrevConnectTime = GetTime();
+    pBbAddr->tTestParam.nConnectCount++;
+    return true;
+}
+
+bool CBbAddrPool::UpdateRtt(CMthNetEndpoint& ep, uint32 nRttMs)
+{
+    boost::unique_lock<boost::shared_mutex> lock(lockAddrPool);
+    CBbAddr* pBbAddr = GetAddrNoLock(ep.ToString());
+    if (pBbAddr == NULL)
+    {
+        return false;
+    }
+    pBbAddr->AddRtt(nRttMs);
+    return true;
+}
+
+// Writes the scores that moved at least nScoreFlushDelta from the stored one,
+// or crossed the good address score, fAll writes every changed score.
+uint32 CBbAddrPool::FlushScore(bool fAll, uint32& nDirtyCount)
+{
+    vector<CDNSeedNode*> vDbNode;
+    vector<string> vFlushAddr;
+    vector<int> vPrevScore;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(lockAddrPool);
+        if (pDbStorage == NULL)
+        {
+            nDirtyCount = setScoreDirtyAddr.size();
+            return 0;
+        }
+        int iGoodScore = pDnseedCfg->nGoodAddrScore;
+        set<string>::iterator it;
+        for (it = setScoreDirtyAddr.begin(); it != setScoreDirtyAddr.end();)
+        {
+            CBbAddr* pBbAddr = GetAddrNoLock(*it);
+            if (pBbAddr == NULL || pBbAddr->iScore == pBbAddr->iFlushScore)
             {
-                CDNSeedNode* pNode = new CDNSeedNode(DDN_E_MSG_TYPE_UPDATE, pBbAddr->GetEp().GetIp(), pBbAddr->GetEp().GetPort(),
-                                                     pBbAddr->GetService(), pBbAddr->GetScore());
-                lock.unlock();
-                if (pNode)
+                if (pBbAddr)
                 {
-                    pDbStorage->PostDbMessage(pNode);
+                    pBbAddr->fScoreDirty = false;
                 }
+                setScoreDirtyAddr.erase(it++);
+                continue;
             }
+            if (!fAll && abs(pBbAddr->iScore - pBbAddr->iFlushScore) < (int)pDnseedCfg->nScoreFlushDelta
+                && (pBbAddr->iScore >= iGoodScore) == (pBbAddr->iFlushScore >= iGoodScore))
+            {
+                ++it;
+                continue;
+            }
+            vDbNode.push_back(new CDNSeedNode(DDN_E_MSG_TYPE_UPDATE, pBbAddr->GetEp().GetIp(), pBbAddr->GetEp().GetPort(),
+                                              pBbAddr->GetService(), pBbAddr->GetScore()));
+            vFlushAddr.push_back(*it);
+            vPrevScore.push_back(pBbAddr->iFlushScore);
+            pBbAddr->iFlushScore = pBbAddr->iScore;
+            pBbAddr->fScoreDirty = false;
+            setScoreDirtyAddr.erase(it++);
         }
-        return true;
     }
-    return false;
+
+    uint32 nFlushCount = 0;
+    for (size_t i = 0; i < vDbNode.size(); i++)
+    {
+        if (pDbStorage->PostDbMessage(vDbNode[i]))
+        {
+            nFlushCount++;
+            continue;
+        }
+        // Not queued, keep the stored score so it is written next time
+        delete vDbNode[i];
+        boost::unique_lock<boost::shared_mutex> lock(lockAddrPool);
+        CBbAddr* pBbAddr = GetAddrNoLock(vFlushAddr[i]);
+        if (pBbAddr)
+        {
+            pBbAddr->iFlushScore = vPrevScore[i];
+            SetScoreDirtyNoLock(vFlushAddr[i], pBbAddr);
+        }
+    }
+
+    boost::shared_lock<boost::shared_mutex> lock(lockAddrPool);
+    nDirtyCount = setScoreDirtyAddr.size();
+    return nFlushCount;
 }
 
 void CBbAddrPool::ReleaseAddrPool()
@@ -388,6 +542,51 @@ void CBbAddrPool::ReleaseAddrPool()
             delete pNode;
         }
     }
+    setScoreDirtyAddr.clear();
+    nGoodAddrCount = 0;
+    mapTestCalendar.clear();
+    for (int i = 0; i < NMS_E_TEST_PRIORITY_MAX; i++)
+    {
+        qTestBucket[i].clear();
+    }
+}
+
+bool CBbAddrPool::AddRecvAddrNoLock(CMthNetEndpoint& tEp, uint64 nServiceIn, CDNSeedNode*& pNode)
+{
+    string strAddr = tEp.ToString();
+    CBbAddr* pBbAddr = GetAddrNoLock(strAddr);
+    if (pBbAddr == NULL)
+    {
+        pBbAddr = new CBbAddr();
+        pBbAddr->tNetEp = tEp;
+        pBbAddr->nService = nServiceIn;
+        pBbAddr->iFlushScore = pBbAddr->iScore;
+        if (!mapAddrPool.insert(make_pair(strAddr, pBbAddr)).second)
+        {
+            delete pBbAddr;
+            return false;
+        }
+        AddGoodCountNoLock(pBbAddr->iScore, 1);
+        ScheduleTestNoLock(strAddr, pBbAddr);
+        if (pDbStorage)
+        {
+            pNode = new CDNSeedNode(DDN_E_MSG_TYPE_INSERT, pBbAddr->GetEp().GetIp(), pBbAddr->GetEp().GetPort(),
+                                    pBbAddr->GetService(), pBbAddr->GetScore());
+        }
+    }
+    else
+    {
+        if (pBbAddr->nService != nServiceIn)
+        {
+            pBbAddr->nService = nServiceIn;
+            if (pDbStorage)
+            {
+                pNode = new CDNSeedNode(DDN_E_MSG_TYPE_UPDATE, pBbAddr->GetEp().GetIp(), pBbAddr->GetEp().GetPort(),
+                                        pBbAddr->GetService(), pBbAddr->GetScore());
+            }
+        }
+    }
+    return true;
 }
 
 CBbAddr* CBbAddrPool::GetAddrNoLock(const string& sAddrPort)
@@ -400,6 +599,77 @@ CBbAddr* CBbAddrPool::GetAddrNoLock(const string& sAddrPort)
     return NULL;
 }
 
+void CBbAddrPool::SetScoreDirtyNoLock(const string& sAddrPort, CBbAddr* pBbAddr)
+{
+    if (!pBbAddr->fScoreDirty && pBbAddr->iScore != pBbAddr->iFlushScore)
+    {
+        pBbAddr->fScoreDirty = true;
+        setScoreDirtyAddr.insert(sAddrPort);
+    }
+}
+
+void CBbAddrPool::AddGoodCountNoLock(int iScore, int iCount)
+{
+    if (iScore >= pDnseedCfg->nGoodAddrScore)
+    {
+        nGoodAddrCount += iCount;
+    }
+}
+
+// Queues the next test of the address, an entry left from an earlier
+// schedule no longer matches nTestSeq and is dropped when it comes up
+void CBbAddrPool::ScheduleTestNoLock(const string& sAddrPort, CBbAddr* pBbAddr)
+{
+    pBbAddr->nTestSeq = ++nTestSeqGen;
+    int64 nDueTime = pBbAddr->tTestParam.nPrevConnectTime + pBbAddr->tTestParam.nNextConnIntervalTime;
+    mapTestCalendar[nDueTime].push_back(CAddrTestEntry(sAddrPort, pBbAddr->nTestSeq));
+}
+
+void CBbAddrPool::MoveDueTestNoLock(int64 nCurTime)
+{
+    while (!mapTestCalendar.empty() && mapTestCalendar.begin()->first <= nCurTime)
+    {
+        vector<CAddrTestEntry>& vEntry = mapTestCalendar.begin()->second;
+        for (size_t i = 0; i < vEntry.size(); i++)
+        {
+            CBbAddr* pBbAddr = GetAddrNoLock(vEntry[i].strAddr);
+            if (pBbAddr && pBbAddr->nTestSeq == vEntry[i].nSeq)
+            {
+                qTestBucket[GetTestPriority(pBbAddr)].push_back(vEntry[i]);
+            }
+        }
+        mapTestCalendar.erase(mapTestCalendar.begin());
+    }
+}
+
+NMS_E_TEST_PRIORITY CBbAddrPool::GetTestPriority(CBbAddr* pBbAddr)
+{
+    if (pBbAddr->iScore >= pDnseedCfg->nGoodAddrScore)
+    {
+        return NMS_E_TEST_PRIORITY_GOOD;
+    }
+    if (pBbAddr->tTestParam.nConnectCount == 0 && pBbAddr->iScore >= 0)
+    {
+        return NMS_E_TEST_PRIORITY_NEW;
+    }
+    if (pBbAddr->iScore > 0)
+    {
+        return NMS_E_TEST_PRIORITY_RECOVER;
+    }
+    return NMS_E_TEST_PRIORITY_OTHER;
+}
+
+// Addresses without a measured round trip rank after all measured ones,
+// taken entries last
+static uint32 GetRttRank(CBbAddr* pBbAddr)
+{
+    if (pBbAddr == NULL)
+    {
+        return 0x20000;
+    }
+    return (pBbAddr->nRtt > 0 ? pBbAddr->nRtt : 0x10000);
+}
+
 void CBbAddrPool::GetGoodAddressList(vector<CAddress>& vAddrList)
 {
     boost::shared_lock<boost::shared_mutex> lock(lockAddrPool);
@@ -451,6 +721,15 @@ void CBbAddrPool::GetGoodAddressList(vector<CAddress>& vAddrList)
         else
         {
             nGetPos = rand() % nGoodCount;
+            if (pDnseedCfg->fPreferLowRtt)
+            {
+                /*the faster of two random picks*/
+                uint32 nOtherPos = rand() % nGoodCount;
+                if (GetRttRank(ppGoodBbAddrTable[nOtherPos]) < GetRttRank(ppGoodBbAddrTable[nGetPos]))
+                {
+                    nGetPos = nOtherPos;
+                }
+            }
         }
         pBbAddr = ppGoodBbAddrTable[nGetPos];
         if (pBbAddr)
@@ -485,45 +764,33 @@ void CBbAddrPool::GetGoodAddressList(vector<CAddress>& vAddrList)
     free(ppGoodBbAddrTable);
 }
 
+// Due addresses are taken from the highest priority bucket first, each
+// taken address is scheduled again after its next interval.
 bool CBbAddrPool::GetCallConnectAddrList(vector<CBbAddr>& vBbAddr, uint32 nGetAddrCount, bool fStressTest)
 {
     boost::unique_lock<boost::shared_mutex> lock(lockAddrPool);
 
-    int64 nCurTime;
-    map<string, CBbAddr*>::iterator it;
-    uint32 nCheckCount;
-    CBbAddr* pBbAddr = NULL;
-
-    //<Need improvement>
-    nCurTime = GetTime();
-    nCheckCount = mapAddrPool.size();
-    if (nCheckCount == 0)
+    if (mapAddrPool.empty())
     {
-        sPrevTestAddr.clear();
         return false;
     }
 
-    if (sPrevTestAddr.empty())
-    {
-        it = mapAddrPool.begin();
-    }
-    else
-    {
-        it = mapAddrPool.find(sPrevTestAddr);
-    }
-    for (; nCheckCount > 0; it++, nCheckCount--)
+    int64 nCurTime = GetTime();
+    MoveDueTestNoLock(nCurTime);
+
+    for (int i = 0; i < NMS_E_TEST_PRIORITY_MAX && vBbAddr.size() < nGetAddrCount; i++)
     {
-        if (it == mapAddrPool.end())
+        deque<CAddrTestEntry>& qBucket = qTestBucket[i];
+        while (!qBucket.empty() && vBbAddr.size() < nGetAddrCount)
         {
-            it = mapAddrPool.begin();
-            if (it == mapAddrPool.end())
+            CAddrTestEntry tEntry = qBucket.front();
+            qBucket.pop_front();
+            CBbAddr* pBbAddr = GetAddrNoLock(tEntry.strAddr);
+            if (pBbAddr == NULL || pBbAddr->nTestSeq != tEntry.nSeq)
             {
-                break;
+                continue;
             }
-        }
-        pBbAddr = it->second;
-        if (pBbAddr && nCurTime - pBbAddr->tTestParam.nPrevConnectTime >= pBbAddr->tTestParam.nNextConnIntervalTime)
-        {
+
             pBbAddr->tTestParam.nPrevConnectTime = nCurTime;
             pBbAddr->tTestParam.nConnectCount++;
 
@@ -558,33 +825,19 @@ bool CBbAddrPool::GetCallConnectAddrList(vector<CBbAddr>& vBbAddr, uint32 nGetAd
             }
 
             vBbAddr.push_back(CBbAddr(*pBbAddr));
-            if (vBbAddr.size() >= nGetAddrCount)
-            {
-                break;
-            }
-        }
-    }
-
-    if (pBbAddr)
-    {
-        sPrevTestAddr = pBbAddr->tNetEp.ToString();
-    }
-    else
-    {
-        it = mapAddrPool.begin();
-        if (it != mapAddrPool.end() && it->second)
-        {
-            sPrevTestAddr = it->second->tNetEp.ToString();
-        }
-        else
-        {
-            sPrevTestAddr.clear();
+            ScheduleTestNoLock(tEntry.strAddr, pBbAddr);
         }
     }
 
     return true;
 }
 
+uint32 CBbAddrPool::GetGoodAddrCount()
+{
+    boost::shared_lock<boost::shared_mutex> lock(lockAddrPool);
+    return nGoodAddrCount;
+}
+
 int64 CBbAddrPool::GetNetTime()
 {
     boost::shared_lock<boost::shared_mutex> lock(lockNetTime);
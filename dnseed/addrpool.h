@@ -5,9 +5,12 @@
 #ifndef __DNSEED_ADDRPOOL_H
 #define __DNSEED_ADDRPOOL_H
 
+#include <deque>
+
 #include "blockhead/nettime.h"
 #include "config.h"
 #include "nbase/mthbase.h"
+#include "netmsgcodec.h"
 #include "netproto.h"
 #include "network/networkbase.h"
 
@@ -19,6 +22,18 @@ using namespace nbase;
 using namespace network;
 using namespace blockhead;
 
+// Due addresses are tested in this order
+typedef enum _NMS_E_TEST_PRIORITY
+{
+    NMS_E_TEST_PRIORITY_GOOD,    /*good address, keeps the good list fresh*/
+    NMS_E_TEST_PRIORITY_NEW,     /*not tested since start and no bad score*/
+    NMS_E_TEST_PRIORITY_RECOVER, /*positive score below the good score*/
+    NMS_E_TEST_PRIORITY_OTHER,
+    NMS_E_TEST_PRIORITY_MAX
+
+} NMS_E_TEST_PRIORITY,
+    *P_NMS_E_TEST_PRIORITY;
+
 class CAddrTestParam
 {
 public:
@@ -77,6 +92,11 @@ public:
 
     void DoScore(int iDoValue);
     void DoScoreByHeight(int nRefHeight);
+    void AddRtt(uint32 nRttMs);
+    uint32 GetRtt() const
+    {
+        return nRtt;
+    }
 
     CBbAddr& operator=(CBbAddr& ad)
     {
@@ -84,6 +104,7 @@ public:
         iScore = ad.iScore;
         fConfidentAddr = ad.fConfidentAddr;
         nStartingHeight = ad.nStartingHeight;
+        nRtt = ad.nRtt;
         tTestParam = ad.tTestParam;
         return *this;
     }
@@ -94,11 +115,31 @@ public:
     int iScore;
     bool fConfidentAddr;
     int nStartingHeight;
+    uint16 nRtt; /*ms, weighted average of handshake and ping round trips, 0 is not measured*/
 
     CAddrTestParam tTestParam;
+
+    // Score changes are written by CBbAddrPool::FlushScore, iFlushScore is the
+    // score the database holds
+    bool fScoreDirty;
+    int iFlushScore;
+
+    uint32 nTestSeq; /*matches the live test queue entry*/
+    bool fSession;   /*an outbound session is open, the address is not queued for tests*/
+};
+
+class CAddrTestEntry
+{
+public:
+    CAddrTestEntry(const string& strAddrIn, uint32 nSeqIn)
+      : strAddr(strAddrIn), nSeq(nSeqIn) {}
+
+    string strAddr;
+    uint32 nSeq;
 };
 
 class CDbStorage;
+class CDNSeedNode;
 
 class CBbAddrPool
 {
@@ -112,6 +153,7 @@ public:
     bool AddConfidentAddr(string& sAddr);
     bool AddAddrFromDb(CMthNetEndpoint& ep, uint64 nService, int iScore);
     bool AddRecvAddr(tcp::endpoint& ep, uint64 nServiceIn);
+    uint32 AddRecvAddrBatch(CMsgAddressView& tAddrView);
     void DelAddr(CMthNetEndpoint& ep);
     void DelAddr(CBbAddr& addr);
 
@@ -119,9 +161,14 @@ public:
     bool DoScore(CMthNetEndpoint& ep, int iDoValue);
     bool DoScore(CBbAddr& addr, int iDoValue);
     bool UpdateHeight(CMthNetEndpoint& ep, int iHeight);
+    uint32 FlushScore(bool fAll, uint32& nDirtyCount);
+    bool SetSession(CMthNetEndpoint& ep, bool fSessionIn);
+    bool TouchSession(CMthNetEndpoint& ep);
+    bool UpdateRtt(CMthNetEndpoint& ep, uint32 nRttMs);
 
     void GetGoodAddressList(vector<CAddress>& vAddrList);
     bool GetCallConnectAddrList(vector<CBbAddr>& vBbAddr, uint32 nGetAddrCount, bool fStressTest);
+    uint32 GetGoodAddrCount();
 
     int64 GetNetTime();
     bool UpdateNetTime(const boost::asio::ip::address& address, int64 nTimeDelta);
@@ -134,14 +181,27 @@ public:
 protected:
     void ReleaseAddrPool();
     CBbAddr* GetAddrNoLock(const string& sAddrPort);
+    void SetScoreDirtyNoLock(const string& sAddrPort, CBbAddr* pBbAddr);
+    void AddGoodCountNoLock(int iScore, int iCount);
+    void ScheduleTestNoLock(const string& sAddrPort, CBbAddr* pBbAddr);
+    void MoveDueTestNoLock(int64 nCurTime);
+    NMS_E_TEST_PRIORITY GetTestPriority(CBbAddr* pBbAddr);
+    bool AddRecvAddrNoLock(CMthNetEndpoint& tEp, uint64 nServiceIn, CDNSeedNode*& pNode);
 
 private:
     CDnseedConfig* pDnseedCfg;
 
     map<string, CBbAddr*> mapAddrPool;
     set<string> setConfidentAddrPool;
+    set<string> setScoreDirtyAddr;
+    uint32 nGoodAddrCount;
     boost::shared_mutex lockAddrPool;
 
+    /*addresses wait here by due second, then in the bucket of their priority*/
+    map<int64, vector<CAddrTestEntry>> mapTestCalendar;
+    deque<CAddrTestEntry> qTestBucket[NMS_E_TEST_PRIORITY_MAX];
+    uint32 nTestSeqGen;
+
     uint32 nConfidentHeight;
     boost::shared_mutex lockConfidentAddr;
 
@@ -149,8 +209,6 @@ private:
     boost::shared_mutex lockNetTime;
 
     CDbStorage* pDbStorage;
-
-    string sPrevTestAddr;
 };
 
 } // namespace dnseed
@@ -5,6 +5,7 @@
 #include "config.h"
 
 #include <boost/algorithm/string/trim.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "blockhead/util.h"
 #include "netproto.h"
@@ -30,17 +31,36 @@ CDnseedConfig::CDnseedConfig()
     fDaemon = false;
     nWorkThreadCount = 0;
     fAllowAllAddr = false;
+    nMaxAddrPerMsg = NMS_ATP_MAX_ADDR_PER_MSG;
 
     fStressBackTest = false;
     nGetGoodAddrCount = NMS_ATP_GET_GOOD_ADDR_COUNT;
     nBackTestAddrCount = NMS_ATP_TEST_ADDR_COUNT;
+    nTestRateMax = NMS_ATP_TEST_RATE_MAX;
+    nBackTestMinCount = NMS_ATP_TEST_ADDR_MIN_COUNT;
+    nGoodAddrScore = NMS_ATP_GOOD_ADDR_SCORE;
+    nBackTestBurst = NMS_ATP_TEST_ADDR_BURST;
+    nSessionCount = NMS_ATP_SESSION_COUNT;
+    nSessionPingTime = NMS_ATP_SESSION_PING_TIME;
+    nSessionGetAddrTime = NMS_ATP_SESSION_GETADDR_TIME;
+    fPreferLowRtt = false;
+    fPipelineHandshake = false;
+    nLingerTime = NMS_ATP_LINGER_TIME;
 
     fShowRunStatData = true;
     nShowRunStatTime = 1;
 
     fShowDbStatData = false;
     nShowDbStatTime = 10;
-
+    nDbBatchCount = NMS_CFG_DB_BATCH_COUNT;
+    nDbFlushTime = NMS_CFG_DB_FLUSH_TIME;
+    nDbFetchCount = NMS_CFG_DB_FETCH_COUNT;
+    nDbWriterCount = NMS_CFG_DB_WRITER_COUNT;
+    fDbJournal = true;
+    nScoreFlushTime = NMS_CFG_SCORE_FLUSH_TIME;
+    nScoreFlushDelta = NMS_CFG_SCORE_FLUSH_DELTA;
+
+    strDbType = "mysql";
     tDbCfg.iDbType = DBC_DBTYPE_MYSQL;
     tDbCfg.sDbIp = "localhost";
     tDbCfg.usDbPort = 3306;
@@ -98,6 +118,10 @@ bool CDnseedConfig::ReadConfig(int argc, char* argv[],
         ("genesisblock", po::value<string>(&strGenesisBlockHash)->default_value("00000000b0a9be545f022309e148894d1e1c853ccac3ef04cb6f5e5c70f41a70"), "Genesis block hash")
         //allowalladdr
         ("allowalladdr", po::value<bool>(&fAllowAllAddr)->default_value(false), "Allow all address")
+        //maxaddrpermsg
+        ("maxaddrpermsg", po::value<unsigned int>(&nMaxAddrPerMsg)->default_value(NMS_ATP_MAX_ADDR_PER_MSG), "Maximum number of addresses accepted from one address message")
+        //dbtype
+        ("dbtype", po::value<string>(&strDbType)->default_value("mysql"), "Set database type, mysql or log(embedded log file <dbname>.dblog in the data directory) (default: mysql)")
         //dbhost
         ("dbhost", po::value<string>(&tDbCfg.sDbIp)->default_value("localhost"), "Set mysql host (default: localhost)")
         //dbport
@@ -108,6 +132,20 @@ bool CDnseedConfig::ReadConfig(int argc, char* argv[],
         ("dbuser", po::value<string>(&tDbCfg.sDbUser)->default_value("bigdnseed"), "Set mysql user's name (default: bigdnseed)")
         //dbpass
         ("dbpass", po::value<string>(&tDbCfg.sDbPwd)->default_value("bigdnseed"), "Set mysql user's password (default: bigdnseed)")
+        //dbbatchcount
+        ("dbbatchcount", po::value<unsigned int>(&nDbBatchCount)->default_value(NMS_CFG_DB_BATCH_COUNT), "Maximum number of database messages written in one transaction(1 is one statement per message)")
+        //dbflushtime
+        ("dbflushtime", po::value<unsigned int>(&nDbFlushTime)->default_value(NMS_CFG_DB_FLUSH_TIME), "Seconds that changes of one address are merged before writing to database(0 is no merge)")
+        //dbfetchcount
+        ("dbfetchcount", po::value<unsigned int>(&nDbFetchCount)->default_value(NMS_CFG_DB_FETCH_COUNT), "Number of addresses read per query when loading from database(0 is all in one query)")
+        //dbwritercount
+        ("dbwritercount", po::value<unsigned int>(&nDbWriterCount)->default_value(NMS_CFG_DB_WRITER_COUNT), "Number of database writer threads, each with its own connection")
+        //dbjournal
+        ("dbjournal", po::value<bool>(&fDbJournal)->default_value(true), "Write database messages to a journal in the data directory before the database")
+        //scoreflushtime
+        ("scoreflushtime", po::value<unsigned int>(&nScoreFlushTime)->default_value(NMS_CFG_SCORE_FLUSH_TIME), "Seconds between writes of changed address scores to database")
+        //scoreflushdelta
+        ("scoreflushdelta", po::value<unsigned int>(&nScoreFlushDelta)->default_value(NMS_CFG_SCORE_FLUSH_DELTA), "Score change of one address that is written to database(smaller changes wait until exit)")
         //listenaddrv4
         ("listenaddrv4", po::value<string>(&strDNSeedListenAddrV4)->default_value("0.0.0.0"), "Listen for connections on <ipv4>")
         //listenaddrv6
@@ -123,7 +161,25 @@ bool CDnseedConfig::ReadConfig(int argc, char* argv[],
         //getgoodaddrcount
         ("getgoodaddrcount", po::value<unsigned int>(&nGetGoodAddrCount)->default_value(NMS_ATP_GET_GOOD_ADDR_COUNT), "Returns the number of available nodes")
         //backtestaddrcount
-        ("backtestaddrcount", po::value<unsigned int>(&nBackTestAddrCount)->default_value(NMS_ATP_TEST_ADDR_COUNT), "Single test node number")
+        ("backtestaddrcount", po::value<unsigned int>(&nBackTestAddrCount)->default_value(NMS_ATP_TEST_ADDR_COUNT), "Single test node number, tested per second by each work thread")
+        //testratemax
+        ("testratemax", po::value<unsigned int>(&nTestRateMax)->default_value(NMS_ATP_TEST_RATE_MAX), "Most addresses tested per second by all work threads(0 is backtestaddrcount times the work thread number)")
+        //backtestmincount
+        ("backtestmincount", po::value<unsigned int>(&nBackTestMinCount)->default_value(NMS_ATP_TEST_ADDR_MIN_COUNT), "Least addresses tested per second when tests fail or file descriptors run short")
+        //backtestburst
+        ("backtestburst", po::value<unsigned int>(&nBackTestBurst)->default_value(NMS_ATP_TEST_ADDR_BURST), "Most addresses tested at once after an idle period(0 is a fifth of testratemax)")
+        //sessioncount
+        ("sessioncount", po::value<unsigned int>(&nSessionCount)->default_value(NMS_ATP_SESSION_COUNT), "Outbound sessions kept open to the best scored nodes by all work threads(0 is off)")
+        //sessionpingtime
+        ("sessionpingtime", po::value<unsigned int>(&nSessionPingTime)->default_value(NMS_ATP_SESSION_PING_TIME), "Interval time for pinging a kept session")
+        //sessiongetaddrtime
+        ("sessiongetaddrtime", po::value<unsigned int>(&nSessionGetAddrTime)->default_value(NMS_ATP_SESSION_GETADDR_TIME), "Interval time for requesting addresses on a kept session")
+        //preferlowrtt
+        ("preferlowrtt", po::value<bool>(&fPreferLowRtt)->default_value(false), "Whether returned good addresses favor nodes with a low round trip time")
+        //pipelinehandshake
+        ("pipelinehandshake", po::value<bool>(&fPipelineHandshake)->default_value(false), "Whether outbound tests send GETADDRESS together with HELLO instead of after the handshake")
+        //lingertime
+        ("lingertime", po::value<unsigned int>(&nLingerTime)->default_value(NMS_ATP_LINGER_TIME), "Seconds a finished outbound test stays connected(0 closes it at once)")
         //showrunstatdata
         ("showrunstatdata", po::value<bool>(&fShowRunStatData)->default_value(true), "Do you want to display running statistics")
         //showrunstattime
@@ -180,6 +236,8 @@ bool CDnseedConfig::ReadConfig(int argc, char* argv[],
     tNetCfg.tListenEpIPV4.SetAddrPort(strDNSeedListenAddrV4, usDNSeedListenPort);
     tNetCfg.tListenEpIPV6.SetAddrPort(strDNSeedListenAddrV6, usDNSeedListenPort);
     nMagicNum = (fTestNet ? TESTNET_MAGICNUM : MAINNET_MAGICNUM);
+    tDbCfg.iDbType = (strDbType == "log" ? DBC_DBTYPE_LOG : DBC_DBTYPE_MYSQL);
+    tDbCfg.sDbFile = (pathData / (tDbCfg.sDbName + ".dblog")).string();
     if (fDebug)
     {
         blockhead::STD_DEBUG = true;
@@ -194,6 +252,15 @@ bool CDnseedConfig::ReadConfig(int argc, char* argv[],
         nGetGoodAddrCount = 512;
     }
 
+    if (nMaxAddrPerMsg == 0)
+    {
+        nMaxAddrPerMsg = NMS_ATP_MAX_ADDR_PER_MSG;
+    }
+    else if (nMaxAddrPerMsg > 10000)
+    {
+        nMaxAddrPerMsg = 10000;
+    }
+
     if (nBackTestAddrCount == 0)
     {
         nBackTestAddrCount = NMS_ATP_TEST_ADDR_COUNT;
@@ -203,6 +270,62 @@ bool CDnseedConfig::ReadConfig(int argc, char* argv[],
         nBackTestAddrCount = 2000;
     }
 
+    if (nTestRateMax == 0)
+    {
+        uint32 nThreadCount = (nWorkThreadCount > 0 ? nWorkThreadCount : boost::thread::hardware_concurrency());
+        nTestRateMax = nBackTestAddrCount * max(nThreadCount, (uint32)1);
+    }
+    if (nTestRateMax > 100000)
+    {
+        nTestRateMax = 100000;
+    }
+
+    if (nBackTestMinCount == 0)
+    {
+        nBackTestMinCount = 1;
+    }
+    else if (nBackTestMinCount > nTestRateMax)
+    {
+        nBackTestMinCount = nTestRateMax;
+    }
+
+    if (nBackTestBurst == 0)
+    {
+        nBackTestBurst = max(nTestRateMax / 5, (uint32)1);
+    }
+    else if (nBackTestBurst > nTestRateMax)
+    {
+        nBackTestBurst = nTestRateMax;
+    }
+
+    if (nSessionCount > 10000)
+    {
+        nSessionCount = 10000;
+    }
+
+    if (nSessionPingTime == 0)
+    {
+        nSessionPingTime = NMS_ATP_SESSION_PING_TIME;
+    }
+    else if (nSessionPingTime > 3600)
+    {
+        nSessionPingTime = 3600;
+    }
+
+    if (nSessionGetAddrTime < nSessionPingTime)
+    {
+        nSessionGetAddrTime = nSessionPingTime;
+    }
+    else if (nSessionGetAddrTime > 86400)
+    {
+        nSessionGetAddrTime = 86400;
+    }
+
+    if (nLingerTime > 10)
+    {
+        nLingerTime = 10;
+    }
+
     if (nShowRunStatTime == 0)
     {
         nShowRunStatTime = 1;
@@ -221,6 +344,43 @@ bool CDnseedConfig::ReadConfig(int argc, char* argv[],
         nShowDbStatTime = 3600;
     }
 
+    if (nDbBatchCount == 0)
+    {
+        nDbBatchCount = NMS_CFG_DB_BATCH_COUNT;
+    }
+    else if (nDbBatchCount > 10000)
+    {
+        nDbBatchCount = 10000;
+    }
+
+    if (nDbFlushTime > 60)
+    {
+        nDbFlushTime = 60;
+    }
+
+    if (nDbFetchCount > 1000000)
+    {
+        nDbFetchCount = 1000000;
+    }
+
+    if (nDbWriterCount == 0)
+    {
+        nDbWriterCount = NMS_CFG_DB_WRITER_COUNT;
+    }
+    if (nDbWriterCount > 32)
+    {
+        nDbWriterCount = 32;
+    }
+
+    if (nScoreFlushTime == 0)
+    {
+        nScoreFlushTime = 1;
+    }
+    else if (nScoreFlushTime > 3600)
+    {
+        nScoreFlushTime = 3600;
+    }
+
     return true;
 }
 
@@ -237,12 +397,21 @@ void CDnseedConfig::ListConfig()
     cout << "workdir: " << sWorkDir << endl;
     cout << "workthreadcount: " << nWorkThreadCount << endl;
     cout << "allowalladdr: " << (fAllowAllAddr ? "true" : "false") << endl;
+    cout << "maxaddrpermsg: " << nMaxAddrPerMsg << endl;
     cout << "genesisblock: " << strGenesisBlockHash << endl;
+    cout << "dbtype: " << strDbType << endl;
     cout << "dbhost: " << tDbCfg.sDbIp << endl;
     cout << "dbport: " << tDbCfg.usDbPort << endl;
     cout << "dbname: " << tDbCfg.sDbName << endl;
     cout << "dbuser: " << tDbCfg.sDbUser << endl;
     cout << "dbpass: " << tDbCfg.sDbPwd << endl;
+    cout << "dbbatchcount: " << nDbBatchCount << endl;
+    cout << "dbflushtime: " << nDbFlushTime << endl;
+    cout << "dbfetchcount: " << nDbFetchCount << endl;
+    cout << "dbwritercount: " << nDbWriterCount << endl;
+    cout << "dbjournal: " << (fDbJournal ? "true" : "false") << endl;
+    cout << "scoreflushtime: " << nScoreFlushTime << endl;
+    cout << "scoreflushdelta: " << nScoreFlushDelta << endl;
     cout << "listenaddrv4: " << tNetCfg.tListenEpIPV4.GetIp() << endl;
     cout << "listenportv4: " << tNetCfg.tListenEpIPV4.GetPort() << endl;
     cout << "listenaddrv6: " << tNetCfg.tListenEpIPV6.GetIp() << endl;
@@ -257,6 +426,15 @@ void CDnseedConfig::ListConfig()
     cout << "goodaddrscore: " << nGoodAddrScore << endl;
     cout << "getgoodaddrcount: " << nGetGoodAddrCount << endl;
     cout << "backtestaddrcount: " << nBackTestAddrCount << endl;
+    cout << "testratemax: " << nTestRateMax << endl;
+    cout << "backtestmincount: " << nBackTestMinCount << endl;
+    cout << "backtestburst: " << nBackTestBurst << endl;
+    cout << "sessioncount: " << nSessionCount << endl;
+    cout << "sessionpingtime: " << nSessionPingTime << endl;
+    cout << "sessiongetaddrtime: " << nSessionGetAddrTime << endl;
+    cout << "preferlowrtt: " << (fPreferLowRtt ? "true" : "false") << endl;
+    cout << "pipelinehandshake: " << (fPipelineHandshake ? "true" : "false") << endl;
+    cout << "lingertime: " << nLingerTime << endl;
 
     cout << "showrunstatdata: " << (fShowRunStatData ? "true" : "false") << endl;
     cout << "showrunstattime: " << nShowRunStatTime << endl;
@@ -30,6 +30,26 @@ using namespace network;
 #define NMS_ATP_HEIGHT_DIFF_RANGE 20
 #define NMS_ATP_GET_GOOD_ADDR_COUNT 8
 #define NMS_ATP_TEST_ADDR_COUNT 30
+#define NMS_ATP_TEST_RATE_MAX 0
+#define NMS_ATP_TEST_ADDR_BURST 0
+#define NMS_ATP_TEST_ADDR_MIN_COUNT 10
+#define NMS_ATP_TEST_RATE_STEP_TIME 30 /*seconds to go from the min to the max rate*/
+#define NMS_ATP_TEST_FAIL_RISE_PERCENT 20   /*local connect failures above their baseline that halve the rate*/
+#define NMS_ATP_TEST_FAIL_BASELINE_TIME 60  /*seconds the local failure baseline follows the ratio over*/
+#define NMS_ATP_TEST_FAIL_MIN_COUNT 20      /*tests per second needed to judge the failure rate*/
+#define NMS_ATP_TEST_FD_PERCENT 80     /*used file descriptors that halve the rate*/
+#define NMS_ATP_MAX_ADDR_PER_MSG 1000
+#define NMS_ATP_SESSION_COUNT 0
+#define NMS_ATP_SESSION_PING_TIME 30
+#define NMS_ATP_SESSION_GETADDR_TIME 300
+#define NMS_ATP_LINGER_TIME 0
+#define NMS_ATP_RTT_WEIGHT 8 /*a new round trip sample moves the average by 1/8 of the difference*/
+#define NMS_CFG_DB_BATCH_COUNT 1000
+#define NMS_CFG_DB_FLUSH_TIME 1
+#define NMS_CFG_DB_FETCH_COUNT 10000
+#define NMS_CFG_DB_WRITER_COUNT 1
+#define NMS_CFG_SCORE_FLUSH_TIME 10
+#define NMS_CFG_SCORE_FLUSH_DELTA 5
 
 class CNetConfig
 {
@@ -77,18 +97,35 @@ public:
 
     string sWorkDir;
     bool fAllowAllAddr;
+    uint32 nMaxAddrPerMsg;
     uint32 nWorkThreadCount;
 
     bool fStressBackTest;
     uint32 nGetGoodAddrCount;
     uint32 nBackTestAddrCount;
+    uint32 nTestRateMax; /*backtestaddrcount times the work threads unless set*/
+    uint32 nBackTestMinCount;
+    uint32 nBackTestBurst;
     int nGoodAddrScore;
+    uint32 nSessionCount;
+    uint32 nSessionPingTime;
+    uint32 nSessionGetAddrTime;
+    bool fPreferLowRtt;
+    bool fPipelineHandshake;
+    uint32 nLingerTime;
 
     bool fShowRunStatData;
     uint32 nShowRunStatTime;
 
     bool fShowDbStatData;
     uint32 nShowDbStatTime;
+    uint32 nDbBatchCount;
+    uint32 nDbFlushTime;
+    uint32 nDbFetchCount;
+    uint32 nDbWriterCount;
+    bool fDbJournal;
+    uint32 nScoreFlushTime;
+    uint32 nScoreFlushDelta;
 
     uint256 hashGenesisBlock;
 
@@ -101,6 +138,7 @@ public:
     set<string> setTrustAddr;
 
     string strGenesisBlockHash;
+    string strDbType;
 };
 
 class CRunStatData
@@ -119,8 +157,17 @@ public:
         nTotalOutCount = 0;
         nTotalOutSuccessCount = 0;
         nTotalOutFailCount = 0;
+        nTotalOutLocalFailCount = 0;
         nTotalOutWorkSuccessCount = 0;
         nTotalOutWorkFailCount = 0;
+
+        nTotalProbeCount = 0;
+        nTotalDupProbeCount = 0;
+        nTestRate = 0;
+        nGoodAddrCount = 0;
+
+        nSessionCount = 0;
+        nTotalPongCount = 0;
     }
     ~CRunStatData() {}
 
@@ -137,8 +184,17 @@ public:
         nTotalOutCount = t.nTotalOutCount;
         nTotalOutSuccessCount = t.nTotalOutSuccessCount;
         nTotalOutFailCount = t.nTotalOutFailCount;
+        nTotalOutLocalFailCount = t.nTotalOutLocalFailCount;
         nTotalOutWorkSuccessCount = t.nTotalOutWorkSuccessCount;
         nTotalOutWorkFailCount = t.nTotalOutWorkFailCount;
+
+        nTotalProbeCount = t.nTotalProbeCount;
+        nTotalDupProbeCount = t.nTotalDupProbeCount;
+        nTestRate = t.nTestRate;
+        nGoodAddrCount = t.nGoodAddrCount;
+
+        nSessionCount = t.nSessionCount;
+        nTotalPongCount = t.nTotalPongCount;
         return *this;
     }
 
@@ -155,8 +211,15 @@ public:
         nTotalOutCount += t.nTotalOutCount;
         nTotalOutSuccessCount += t.nTotalOutSuccessCount;
         nTotalOutFailCount += t.nTotalOutFailCount;
+        nTotalOutLocalFailCount += t.nTotalOutLocalFailCount;
         nTotalOutWorkSuccessCount += t.nTotalOutWorkSuccessCount;
         nTotalOutWorkFailCount += t.nTotalOutWorkFailCount;
+
+        nTotalProbeCount += t.nTotalProbeCount;
+        nTotalDupProbeCount += t.nTotalDupProbeCount;
+
+        nSessionCount += t.nSessionCount;
+        nTotalPongCount += t.nTotalPongCount;
         return *this;
     }
 
@@ -172,8 +235,17 @@ public:
     uint64 nTotalOutCount;
     uint64 nTotalOutSuccessCount;
     uint64 nTotalOutFailCount;
+    uint64 nTotalOutLocalFailCount; /*timed out or out of local resources, part of the fail count*/
     uint64 nTotalOutWorkSuccessCount;
     uint64 nTotalOutWorkFailCount;
+
+    uint64 nTotalProbeCount;
+    uint64 nTotalDupProbeCount;
+    uint32 nTestRate;
+    uint32 nGoodAddrCount;
+
+    uint32 nSessionCount;
+    uint64 nTotalPongCount;
 };
 
 } //namespace dnseed
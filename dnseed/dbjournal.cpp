@@ -0,0 +1,487 @@
+// Copyright (c) 2019 The BigDNSeed developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "dbjournal.h"
+
+#include <algorithm>
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blockhead/util.h"
+#include "dbstorage.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace dnseed
+{
+
+/*crc32 and body length, the body is seq, type, port, service, score and address*/
+#define DDN_D_JOURNAL_HEAD_SIZE 6
+#define DDN_D_JOURNAL_FIXED_SIZE 23
+
+CDbJournal::CDbJournal()
+  : fOpen(false), nAppendSeq(0), pWriteFile(NULL), nWriteSize(0), nSyncSeq(0),
+    nCheckpointSeq(0), pReadFile(NULL), nReadSegmentSeq(0), nReadSeq(0)
+{
+}
+
+CDbJournal::~CDbJournal()
+{
+    Close();
+}
+
+// Cuts a torn record off the last segment and positions the reader after the checkpoint
+bool CDbJournal::Open(const string& strPathIn)
+{
+    Close();
+    strPath = strPathIn;
+
+    boost::system::error_code ec;
+    fs::create_directories(strPath, ec);
+    if (!fs::is_directory(strPath))
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, ("Create journal directory fail: " + strPath).c_str());
+        return false;
+    }
+
+    nCheckpointSeq = 0;
+    FILE* pFile = fopen((fs::path(strPath) / "checkpoint").string().c_str(), "r");
+    if (pFile)
+    {
+        unsigned long long ullSeq = 0;
+        if (fscanf(pFile, "%llu", &ullSeq) == 1)
+        {
+            nCheckpointSeq = ullSeq;
+        }
+        fclose(pFile);
+    }
+
+    vSegment.clear();
+    for (fs::directory_iterator it(strPath, ec), itEnd; !ec && it != itEnd; it.increment(ec))
+    {
+        if (it->path().extension() == ".jnl")
+        {
+            vSegment.push_back(strtoull(it->path().stem().string().c_str(), NULL, 16));
+        }
+    }
+    sort(vSegment.begin(), vSegment.end());
+
+    uint64 nLastSeq = nCheckpointSeq;
+    for (size_t i = 0; i < vSegment.size(); i++)
+    {
+        LoadSegment(vSegment[i], i + 1 == vSegment.size(), nLastSeq);
+    }
+    nAppendSeq = nLastSeq;
+    nSyncSeq = nLastSeq;
+    nReadSeq = nCheckpointSeq;
+
+    if (!vSegment.empty() && fs::file_size(GetSegmentFile(vSegment.back()), ec) < DDN_D_JOURNAL_SEGMENT_SIZE)
+    {
+        pWriteFile = fopen(GetSegmentFile(vSegment.back()).c_str(), "ab");
+        nWriteSize = fs::file_size(GetSegmentFile(vSegment.back()), ec);
+    }
+    else if (!OpenWriteSegment(nAppendSeq + 1))
+    {
+        return false;
+    }
+    if (pWriteFile == NULL)
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "Open journal segment fail.");
+        return false;
+    }
+
+    if (nLastSeq > nCheckpointSeq)
+    {
+        char sBuf[128] = { 0 };
+        sprintf(sBuf, "Replay journal: %lu records after checkpoint %lu.", nLastSeq - nCheckpointSeq, nCheckpointSeq);
+        blockhead::StdLog("CDbJournal", sBuf);
+    }
+
+    OpenReadSegment(vSegment.front());
+    fOpen = true;
+    return true;
+}
+
+void CDbJournal::Close()
+{
+    if (fOpen)
+    {
+        Sync();
+    }
+    fOpen = false;
+    if (pWriteFile)
+    {
+        fclose(pWriteFile);
+        pWriteFile = NULL;
+    }
+    if (pReadFile)
+    {
+        fclose(pReadFile);
+        pReadFile = NULL;
+    }
+}
+
+bool CDbJournal::IsOpen()
+{
+    return fOpen;
+}
+
+bool CDbJournal::Append(CDNSeedNode* pNode)
+{
+    boost::unique_lock<boost::mutex> lock(lockAppend);
+    if (!fOpen)
+    {
+        return false;
+    }
+    EncodeRecord(vAppendBuf, ++nAppendSeq, pNode);
+    return true;
+}
+
+// Group commit, everything appended since the last call is written and synced
+// once. A failed write is cut off the segment and tried again on the next call.
+bool CDbJournal::Sync()
+{
+    boost::unique_lock<boost::mutex> lockS(lockSync);
+    vector<unsigned char> vBuf;
+    uint64 nSeq;
+    {
+        boost::unique_lock<boost::mutex> lock(lockAppend);
+        vBuf.swap(vAppendBuf);
+        nSeq = nAppendSeq;
+    }
+    if (vBuf.empty())
+    {
+        return true;
+    }
+    if (pWriteFile == NULL)
+    {
+        boost::unique_lock<boost::mutex> lock(lockSegment);
+        if (!OpenWriteSegment(nSyncSeq + 1))
+        {
+            RestoreAppend(vBuf);
+            return false;
+        }
+    }
+    if (fwrite(&vBuf[0], 1, vBuf.size(), pWriteFile) != vBuf.size()
+        || fflush(pWriteFile) != 0 || fdatasync(fileno(pWriteFile)) != 0)
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, (string("Write journal fail: ") + strerror(errno)).c_str());
+        TruncateWriteSegment();
+        RestoreAppend(vBuf);
+        return false;
+    }
+    nWriteSize += vBuf.size();
+
+    boost::unique_lock<boost::mutex> lock(lockSegment);
+    nSyncSeq = nSeq;
+    if (nWriteSize >= DDN_D_JOURNAL_SEGMENT_SIZE)
+    {
+        fclose(pWriteFile);
+        pWriteFile = NULL;
+        return OpenWriteSegment(nSeq + 1);
+    }
+    return true;
+}
+
+// Returns the next synced record, the caller deletes it
+CDNSeedNode* CDbJournal::Read()
+{
+    bool fReread = false;
+    while (pReadFile)
+    {
+        uint64 nNextSegmentSeq = 0;
+        {
+            boost::unique_lock<boost::mutex> lock(lockSegment);
+            if (nReadSeq >= nSyncSeq)
+            {
+                return NULL;
+            }
+            vector<uint64>::iterator it = upper_bound(vSegment.begin(), vSegment.end(), nReadSegmentSeq);
+            if (it != vSegment.end())
+            {
+                nNextSegmentSeq = *it;
+            }
+        }
+
+        long nOffset = ftell(pReadFile);
+        unsigned char sHead[DDN_D_JOURNAL_HEAD_SIZE];
+        unsigned int uiCrc;
+        unsigned short usLen = 0;
+        vector<unsigned char> vBody;
+        bool fOk = (fread(sHead, 1, DDN_D_JOURNAL_HEAD_SIZE, pReadFile) == DDN_D_JOURNAL_HEAD_SIZE);
+        if (fOk)
+        {
+            memcpy(&uiCrc, sHead, 4);
+            memcpy(&usLen, sHead + 4, 2);
+            vBody.resize(usLen);
+            fOk = (usLen >= DDN_D_JOURNAL_FIXED_SIZE && fread(&vBody[0], 1, usLen, pReadFile) == usLen);
+        }
+        if (fOk)
+        {
+            boost::crc_32_type tCrc;
+            tCrc.process_bytes(&vBody[0], usLen);
+            fOk = (tCrc.checksum() == uiCrc);
+        }
+        if (!fOk)
+        {
+            clearerr(pReadFile);
+            fseek(pReadFile, nOffset, SEEK_SET);
+            if (!fReread)
+            {
+                /*The read buffer may hold bytes from before the record was synced*/
+                fReread = true;
+                continue;
+            }
+            /*The synced records left are in the next segment*/
+            fReread = false;
+            if (nNextSegmentSeq == 0 || !OpenReadSegment(nNextSegmentSeq))
+            {
+                return NULL;
+            }
+            continue;
+        }
+
+        const unsigned char* pBody = &vBody[0];
+        uint64 nSeq;
+        unsigned short usPort;
+        uint64 nService;
+        int iScore;
+        memcpy(&nSeq, pBody, 8);
+        memcpy(&usPort, pBody + 9, 2);
+        memcpy(&nService, pBody + 11, 8);
+        memcpy(&iScore, pBody + 19, 4);
+        string strIp((const char*)pBody + DDN_D_JOURNAL_FIXED_SIZE, usLen - DDN_D_JOURNAL_FIXED_SIZE);
+
+        boost::unique_lock<boost::mutex> lock(lockSegment);
+        if (nSeq <= nReadSeq)
+        {
+            continue;
+        }
+        nReadSeq = nSeq;
+        CDNSeedNode* pNode = new CDNSeedNode((DDN_E_MSG_TYPE)pBody[8], strIp, usPort, nService, iScore);
+        pNode->nSeq = nSeq;
+        return pNode;
+    }
+    return NULL;
+}
+
+// Records up to nSeq are in the database, segments holding only such records are removed
+void CDbJournal::SetCheckpoint(uint64 nSeq)
+{
+    if (nSeq <= nCheckpointSeq)
+    {
+        return;
+    }
+    fs::path pathCheckpoint = fs::path(strPath) / "checkpoint";
+    fs::path pathTemp = fs::path(strPath) / "checkpoint.tmp";
+    FILE* pFile = fopen(pathTemp.string().c_str(), "w");
+    if (pFile == NULL)
+    {
+        return;
+    }
+    fprintf(pFile, "%llu\n", (unsigned long long)nSeq);
+    bool fOk = (fflush(pFile) == 0 && fdatasync(fileno(pFile)) == 0);
+    fclose(pFile);
+    if (!fOk || rename(pathTemp.string().c_str(), pathCheckpoint.string().c_str()) != 0)
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "Write journal checkpoint fail.");
+        return;
+    }
+    nCheckpointSeq = nSeq;
+
+    boost::unique_lock<boost::mutex> lock(lockSegment);
+    while (vSegment.size() >= 2 && vSegment[1] <= nSeq + 1 && vSegment[0] != nReadSegmentSeq)
+    {
+        remove(GetSegmentFile(vSegment[0]).c_str());
+        vSegment.erase(vSegment.begin());
+    }
+}
+
+uint64 CDbJournal::GetAppendSeq()
+{
+    boost::unique_lock<boost::mutex> lock(lockAppend);
+    return nAppendSeq;
+}
+
+uint64 CDbJournal::GetReadSeq()
+{
+    boost::unique_lock<boost::mutex> lock(lockSegment);
+    return nReadSeq;
+}
+
+uint64 CDbJournal::GetPendingCount()
+{
+    uint64 nSeq = GetAppendSeq();
+    uint64 nRead = GetReadSeq();
+    return (nSeq > nRead ? nSeq - nRead : 0);
+}
+
+bool CDbJournal::LoadSegment(uint64 nFirstSeq, bool fLast, uint64& nLastSeq)
+{
+    string strFile = GetSegmentFile(nFirstSeq);
+    vector<unsigned char> vData;
+    FILE* pFile = fopen(strFile.c_str(), "rb");
+    if (pFile == NULL)
+    {
+        return false;
+    }
+    unsigned char sBuf[65536];
+    size_t nRead;
+    while ((nRead = fread(sBuf, 1, sizeof(sBuf), pFile)) > 0)
+    {
+        vData.insert(vData.end(), sBuf, sBuf + nRead);
+    }
+    fclose(pFile);
+
+    size_t nPos = 0;
+    if (vData.size() >= 8 && memcmp(&vData[0], DDN_D_JOURNAL_MAGIC, 8) == 0)
+    {
+        nPos = 8;
+        while (nPos + DDN_D_JOURNAL_HEAD_SIZE <= vData.size())
+        {
+            unsigned int uiCrc;
+            unsigned short usLen;
+            memcpy(&uiCrc, &vData[nPos], 4);
+            memcpy(&usLen, &vData[nPos + 4], 2);
+            if (usLen < DDN_D_JOURNAL_FIXED_SIZE || nPos + DDN_D_JOURNAL_HEAD_SIZE + usLen > vData.size())
+            {
+                break;
+            }
+            boost::crc_32_type tCrc;
+            tCrc.process_bytes(&vData[nPos + DDN_D_JOURNAL_HEAD_SIZE], usLen);
+            if (tCrc.checksum() != uiCrc)
+            {
+                break;
+            }
+            uint64 nSeq;
+            memcpy(&nSeq, &vData[nPos + DDN_D_JOURNAL_HEAD_SIZE], 8);
+            nLastSeq = max(nLastSeq, nSeq);
+            nPos += DDN_D_JOURNAL_HEAD_SIZE + usLen;
+        }
+    }
+    if (nPos == vData.size())
+    {
+        return true;
+    }
+
+    char sBuf2[256] = { 0 };
+    sprintf(sBuf2, "Journal segment %s: %lu bytes of incomplete records.", strFile.c_str(), (unsigned long)(vData.size() - nPos));
+    blockhead::StdError(__PRETTY_FUNCTION__, sBuf2);
+    if (fLast)
+    {
+        if (nPos == 0)
+        {
+            pFile = fopen(strFile.c_str(), "wb");
+            if (pFile)
+            {
+                fwrite(DDN_D_JOURNAL_MAGIC, 1, 8, pFile);
+                fclose(pFile);
+            }
+        }
+        else if (truncate(strFile.c_str(), nPos) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CDbJournal::OpenWriteSegment(uint64 nFirstSeq)
+{
+    string strFile = GetSegmentFile(nFirstSeq);
+    pWriteFile = fopen(strFile.c_str(), "wb");
+    if (pWriteFile == NULL || fwrite(DDN_D_JOURNAL_MAGIC, 1, 8, pWriteFile) != 8 || fflush(pWriteFile) != 0)
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, ("Create journal segment fail: " + strFile).c_str());
+        if (pWriteFile)
+        {
+            fclose(pWriteFile);
+            pWriteFile = NULL;
+        }
+        return false;
+    }
+    nWriteSize = 8;
+    /*a segment holding only unsynced records may be started again*/
+    if (vSegment.empty() || vSegment.back() != nFirstSeq)
+    {
+        vSegment.push_back(nFirstSeq);
+    }
+    return true;
+}
+
+// Cuts what a failed write left after the last synced record. If that fails
+// the next write starts a new segment, the reader moves on to it when it
+// reaches the torn record.
+void CDbJournal::TruncateWriteSegment()
+{
+    string strFile;
+    {
+        boost::unique_lock<boost::mutex> lock(lockSegment);
+        strFile = GetSegmentFile(vSegment.back());
+    }
+    fclose(pWriteFile);
+    pWriteFile = NULL;
+    if (truncate(strFile.c_str(), nWriteSize) == 0)
+    {
+        pWriteFile = fopen(strFile.c_str(), "ab");
+    }
+}
+
+// Puts records taken by a failed write back in front of the ones appended since
+void CDbJournal::RestoreAppend(vector<unsigned char>& vBuf)
+{
+    boost::unique_lock<boost::mutex> lock(lockAppend);
+    vBuf.insert(vBuf.end(), vAppendBuf.begin(), vAppendBuf.end());
+    vAppendBuf.swap(vBuf);
+}
+
+bool CDbJournal::OpenReadSegment(uint64 nFirstSeq)
+{
+    if (pReadFile)
+    {
+        fclose(pReadFile);
+    }
+    nReadSegmentSeq = nFirstSeq;
+    pReadFile = fopen(GetSegmentFile(nFirstSeq).c_str(), "rb");
+    if (pReadFile == NULL || fseek(pReadFile, 8, SEEK_SET) != 0)
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "Open journal segment fail.");
+        return false;
+    }
+    return true;
+}
+
+string CDbJournal::GetSegmentFile(uint64 nFirstSeq)
+{
+    char sName[32] = { 0 };
+    sprintf(sName, "%016llx.jnl", (unsigned long long)nFirstSeq);
+    return (fs::path(strPath) / sName).string();
+}
+
+void CDbJournal::EncodeRecord(vector<unsigned char>& vBuf, uint64 nSeq, CDNSeedNode* pNode)
+{
+    unsigned short usLen = (unsigned short)(DDN_D_JOURNAL_FIXED_SIZE + pNode->strIp.size());
+    size_t nBegin = vBuf.size();
+    vBuf.resize(nBegin + DDN_D_JOURNAL_HEAD_SIZE + usLen);
+
+    unsigned char* pBody = &vBuf[nBegin + DDN_D_JOURNAL_HEAD_SIZE];
+    memcpy(pBody, &nSeq, 8);
+    pBody[8] = (unsigned char)pNode->eMsgType;
+    memcpy(pBody + 9, &pNode->nPort, 2);
+    memcpy(pBody + 11, &pNode->nService, 8);
+    memcpy(pBody + 19, &pNode->iScore, 4);
+    memcpy(pBody + DDN_D_JOURNAL_FIXED_SIZE, pNode->strIp.data(), pNode->strIp.size());
+
+    boost::crc_32_type tCrc;
+    tCrc.process_bytes(pBody, usLen);
+    unsigned int uiCrc = tCrc.checksum();
+    memcpy(&vBuf[nBegin], &uiCrc, 4);
+    memcpy(&vBuf[nBegin + 4], &usLen, 2);
+}
+
+} // namespace dnseed
@@ -0,0 +1,82 @@
+// Copyright (c) 2019 The BigDNSeed developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef __DNSEED_DBJOURNAL_H
+#define __DNSEED_DBJOURNAL_H
+
+#include <boost/thread.hpp>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "blockhead/type.h"
+
+namespace dnseed
+{
+
+using namespace std;
+
+#define DDN_D_JOURNAL_MAGIC "BBDNSJN1"
+#define DDN_D_JOURNAL_SYNC_TIME 10                      /*ms between group commits*/
+#define DDN_D_JOURNAL_SEGMENT_SIZE (64 * 1024 * 1024)   /*bytes before a new segment file is started*/
+#define DDN_D_JOURNAL_CHECKPOINT_TIME 1
+
+class CDNSeedNode;
+
+// Append-only journal of database messages, the files are segments named by
+// their first sequence number. Appends are buffered and written with one
+// fdatasync per Sync, the reader only sees synced records. Records up to the
+// checkpoint are in the database, the rest is read again after a restart.
+class CDbJournal
+{
+public:
+    CDbJournal();
+    ~CDbJournal();
+
+    bool Open(const string& strPathIn);
+    void Close();
+    bool IsOpen();
+
+    bool Append(CDNSeedNode* pNode);
+    bool Sync();
+    CDNSeedNode* Read();
+    void SetCheckpoint(uint64 nSeq);
+
+    uint64 GetAppendSeq();
+    uint64 GetReadSeq();
+    uint64 GetPendingCount();
+
+private:
+    bool LoadSegment(uint64 nFirstSeq, bool fLast, uint64& nLastSeq);
+    bool OpenWriteSegment(uint64 nFirstSeq);
+    void TruncateWriteSegment();
+    void RestoreAppend(vector<unsigned char>& vBuf);
+    bool OpenReadSegment(uint64 nFirstSeq);
+    string GetSegmentFile(uint64 nFirstSeq);
+    static void EncodeRecord(vector<unsigned char>& vBuf, uint64 nSeq, CDNSeedNode* pNode);
+
+    string strPath;
+    bool fOpen;
+
+    boost::mutex lockAppend;
+    vector<unsigned char> vAppendBuf;
+    uint64 nAppendSeq;
+
+    boost::mutex lockSync;
+    FILE* pWriteFile;
+    uint64 nWriteSize;
+    uint64 nSyncSeq;
+
+    boost::mutex lockSegment;
+    vector<uint64> vSegment;
+    uint64 nCheckpointSeq;
+
+    FILE* pReadFile;
+    uint64 nReadSegmentSeq;
+    uint64 nReadSeq;
+};
+
+} // namespace dnseed
+
+#endif //__DNSEED_DBJOURNAL_H
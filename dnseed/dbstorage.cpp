@@ -4,6 +4,8 @@
 
 #include "dbstorage.h"
 
+#include <fstream>
+
 #include "addrpool.h"
 
 using namespace std;
@@ -11,59 +13,590 @@ using namespace std;
 namespace dnseed
 {
 
+// Peak resident set size of the process in KB, 0 where /proc is not available
+static uint64 GetPeakMemory()
+{
+    ifstream ifs("/proc/self/status");
+    string strLine;
+    while (getline(ifs, strLine))
+    {
+        if (strLine.compare(0, 6, "VmHWM:") == 0)
+        {
+            return strtoull(strLine.c_str() + 6, NULL, 10);
+        }
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+void CDbLatencyStat::Init()
+{
+    nCount = 0;
+    nMaxTime = 0;
+    memset(nBucket, 0, sizeof(nBucket));
+}
+
+void CDbLatencyStat::AddTime(int64 nTimeUs)
+{
+    uint64 nTime = (nTimeUs > 0 ? nTimeUs : 0);
+    uint32 nIndex = 0;
+    while (nIndex < DDN_D_LATENCY_BUCKET - 1 && (uint64(2) << nIndex) <= nTime)
+    {
+        nIndex++;
+    }
+    nBucket[nIndex]++;
+    nCount++;
+    if (nTime > nMaxTime)
+    {
+        nMaxTime = nTime;
+    }
+}
+
+uint64 CDbLatencyStat::GetPercentile(uint32 nPercent) const
+{
+    if (nCount == 0)
+    {
+        return 0;
+    }
+    uint64 nRank = (nCount * nPercent + 99) / 100;
+    uint64 nSum = 0;
+    for (uint32 i = 0; i < DDN_D_LATENCY_BUCKET; i++)
+    {
+        nSum += nBucket[i];
+        if (nSum >= nRank)
+        {
+            return min(uint64(2) << i, nMaxTime);
+        }
+    }
+    return nMaxTime;
+}
+
+CDbLatencyStat& CDbLatencyStat::operator+=(const CDbLatencyStat& t)
+{
+    nCount += t.nCount;
+    nMaxTime = max(nMaxTime, t.nMaxTime);
+    for (uint32 i = 0; i < DDN_D_LATENCY_BUCKET; i++)
+    {
+        nBucket[i] += t.nBucket[i];
+    }
+    return *this;
+}
+
+void CDbStatData::Init()
+{
+    for (int i = 0; i < DDN_E_STMT_TYPE_MAX; i++)
+    {
+        tExecTime[i].Init();
+    }
+    tFetchTime.Init();
+    tCommitTime.Init();
+    nTxnCount = 0;
+    nTxnRowCount = 0;
+    nTxnMaxRowCount = 0;
+    nQueuePeak = 0;
+    nJournalPeak = 0;
+    nCommitCountChange = 0;
+}
+
+CDbStatData& CDbStatData::operator+=(const CDbStatData& t)
+{
+    for (int i = 0; i < DDN_E_STMT_TYPE_MAX; i++)
+    {
+        tExecTime[i] += t.tExecTime[i];
+    }
+    tFetchTime += t.tFetchTime;
+    tCommitTime += t.tCommitTime;
+    nTxnCount += t.nTxnCount;
+    nTxnRowCount += t.nTxnRowCount;
+    nTxnMaxRowCount = max(nTxnMaxRowCount, t.nTxnMaxRowCount);
+    nQueuePeak = max(nQueuePeak, t.nQueuePeak);
+    nJournalPeak = max(nJournalPeak, t.nJournalPeak);
+    nCommitCountChange += t.nCommitCountChange;
+    return *this;
+}
+
 CDbStorage::CDbStorage()
-  : pAddrPool(NULL), pThreadDbAcc(NULL), fRunFlag(false), pDbConn(NULL)
+  : fRunFlag(false), pDbConn(NULL), pAddrPool(NULL), pThreadJournal(NULL), pJournalNode(NULL), nDispatchSeq(0), nJournalPeak(0)
 {
     nCfgStatTimeLen = DDN_D_STAT_TIME;
     fCfgShowStat = true;
-    nInsertCount = 0;
-    nDeleteCount = 0;
-    nUpdateCount = 0;
-    nPrevInsertCount = 0;
-    nPrevDeleteCount = 0;
-    nPrevUpdateCount = 0;
+    nCfgBatchCount = DDN_D_BATCH_COUNT;
+    nCfgFlushTime = 0;
+    nCfgFetchCount = DDN_D_FETCH_COUNT;
 }
 
 CDbStorage::CDbStorage(CDbcConfig* pDbCfg, CBbAddrPool* pPool)
-  : pAddrPool(pPool), pThreadDbAcc(NULL), fRunFlag(false), pDbConn(NULL)
+  : fRunFlag(false), tDbCfg(*pDbCfg), pDbConn(NULL), pAddrPool(pPool), pThreadJournal(NULL), pJournalNode(NULL), nDispatchSeq(0), nJournalPeak(0)
 {
     nCfgStatTimeLen = DDN_D_STAT_TIME;
     fCfgShowStat = true;
+    nCfgBatchCount = DDN_D_BATCH_COUNT;
+    nCfgFlushTime = 0;
+    nCfgFetchCount = DDN_D_FETCH_COUNT;
+    pDbConn = CDbcDbConnect::DbcCreateDbConnObj(tDbCfg);
+    CreateWriters(1);
+}
+
+CDbStorage::~CDbStorage()
+{
+    Stop();
+    ReleaseWriters();
+
+    if (pDbConn)
+    {
+        pDbConn->DisconnectDb();
+        pDbConn->Release();
+        pDbConn = NULL;
+    }
+}
+
+void CDbStorage::SetDbConfig(CDbcConfig* pDbCfg)
+{
+    tDbCfg = *pDbCfg;
+    pDbConn = CDbcDbConnect::DbcCreateDbConnObj(tDbCfg);
+    CreateWriters(max(vWriter.size(), size_t(1)));
+}
+
+void CDbStorage::SetBbAddrPool(CBbAddrPool* pPool)
+{
+    pAddrPool = pPool;
+}
+
+bool CDbStorage::Start()
+{
+    if (vWriter.empty())
+    {
+        return false;
+    }
+    /*Without the unique key every upsert would add a row*/
+    if (!CreateTables())
+    {
+        return false;
+    }
+
+    fRunFlag = true;
+    for (size_t i = 0; i < vWriter.size(); i++)
+    {
+        if (!vWriter[i]->Start())
+        {
+            return false;
+        }
+    }
+    if (tJournal.IsOpen())
+    {
+        pThreadJournal = new boost::thread(boost::bind(&CDbStorage::JournalWork, this));
+        if (pThreadJournal == NULL)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Journal records not yet handed to a writer stay in the journal for the next start
+void CDbStorage::Stop()
+{
+    fRunFlag = false;
+
+    if (pThreadJournal)
+    {
+        pThreadJournal->join();
+
+        delete pThreadJournal;
+        pThreadJournal = NULL;
+    }
+    for (size_t i = 0; i < vWriter.size(); i++)
+    {
+        vWriter[i]->Stop();
+    }
+    if (tJournal.IsOpen())
+    {
+        tJournal.SetCheckpoint(GetJournalCheckpoint());
+    }
+    if (pJournalNode)
+    {
+        delete pJournalNode;
+        pJournalNode = NULL;
+    }
+}
+
+bool CDbStorage::PurgeData()
+{
+    CDbcLogDbConnect* pLogConn = dynamic_cast<CDbcLogDbConnect*>(pDbConn);
+    if (pLogConn ? !pLogConn->ClearRows() : !pDbConn->ExecuteStaticSql("DROP TABLE dnseednode"))
+    {
+        cerr << "Purge data fail.\n";
+        return false;
+    }
+    return true;
+}
+
+// With the journal the message is written to it and deleted, the writers read
+// it back asynchronously, so a full writer queue never rejects a message
+bool CDbStorage::PostDbMessage(CDNSeedNode* pMsg)
+{
+    if (tJournal.IsOpen())
+    {
+        if (!tJournal.Append(pMsg))
+        {
+            return false;
+        }
+        delete pMsg;
+        return true;
+    }
+    if (vWriter.empty())
+    {
+        return false;
+    }
+    return GetWriter(pMsg)->PostDbMessage(pMsg);
+}
+
+// The address pool is loaded by the first writer
+bool CDbStorage::ReqFetchAddr()
+{
+    if (vWriter.empty())
+    {
+        return false;
+    }
+    CDNSeedNode* pNode = new CDNSeedNode(DDN_E_MSG_TYPE_FETCH);
+    if (!vWriter[0]->PostDbMessage(pNode))
+    {
+        delete pNode;
+        return false;
+    }
+    return true;
+}
+
+uint32 CDbStorage::GetMsgQueueSize()
+{
+    uint32 nSize = 0;
+    for (size_t i = 0; i < vWriter.size(); i++)
+    {
+        nSize += vWriter[i]->GetMsgQueueSize();
+    }
+    if (tJournal.IsOpen())
+    {
+        boost::unique_lock<boost::mutex> lock(lockDispatch);
+        nSize += tJournal.GetAppendSeq() - nDispatchSeq;
+    }
+    return nSize;
+}
+
+// Adds the statistics of every writer since the previous call to tData
+void CDbStorage::StatDbData(CDbStatData& tData)
+{
+    for (size_t i = 0; i < vWriter.size(); i++)
+    {
+        vWriter[i]->StatDbData(tData);
+    }
+    boost::unique_lock<boost::mutex> lock(lockDispatch);
+    tData.nJournalPeak = max(tData.nJournalPeak, nJournalPeak);
+    nJournalPeak = 0;
+}
+
+void CDbStorage::SetStatParam(bool fShowStatIn, uint32 nStatTimeIn)
+{
+    fCfgShowStat = fShowStatIn;
+    nCfgStatTimeLen = nStatTimeIn;
+}
+
+void CDbStorage::SetBatchParam(uint32 nBatchCountIn, uint32 nFlushTimeIn)
+{
+    nCfgBatchCount = (nBatchCountIn > 0 ? nBatchCountIn : 1);
+    nCfgFlushTime = nFlushTimeIn;
+}
+
+void CDbStorage::SetFetchParam(uint32 nFetchCountIn)
+{
+    nCfgFetchCount = nFetchCountIn;
+}
+
+// Must be called before Start, the writers are created again
+void CDbStorage::SetWriterParam(uint32 nWriterCountIn)
+{
+    if (fRunFlag)
+    {
+        return;
+    }
+    CreateWriters(nWriterCountIn > 0 ? nWriterCountIn : 1);
+}
+
+// Must be called before Start, an empty path runs without the journal
+bool CDbStorage::SetJournalParam(const string& strJournalPath)
+{
+    if (fRunFlag)
+    {
+        return false;
+    }
+    if (strJournalPath.empty())
+    {
+        tJournal.Close();
+        return true;
+    }
+    if (!tJournal.Open(strJournalPath))
+    {
+        return false;
+    }
+    boost::unique_lock<boost::mutex> lock(lockDispatch);
+    nDispatchSeq = tJournal.GetReadSeq();
+    return true;
+}
+
+void CDbStorage::CreateWriters(uint32 nWriterCount)
+{
+    ReleaseWriters();
+    for (uint32 i = 0; i < nWriterCount; i++)
+    {
+        vWriter.push_back(new CDbStorageWriter(this, i, tDbCfg));
+    }
+}
+
+void CDbStorage::ReleaseWriters()
+{
+    for (size_t i = 0; i < vWriter.size(); i++)
+    {
+        delete vWriter[i];
+    }
+    vWriter.clear();
+}
+
+CDbStorageWriter* CDbStorage::GetWriter(CDNSeedNode* pMsg)
+{
+    size_t nHash = boost::hash<string>()(pMsg->strIp);
+    boost::hash_combine(nHash, pMsg->nPort);
+    return vWriter[nHash % vWriter.size()];
+}
+
+//----------------------------------------------------------------------------
+// Waits before a failed write is tried again, twice as long after each
+// failure. Returns false once the thread is stopped.
+static bool WaitRetry(bool& fRunFlag, uint32& nRetryTime)
+{
+    for (uint32 nWaitTime = 0; fRunFlag && nWaitTime < nRetryTime; nWaitTime += DDN_D_RETRY_MIN_TIME)
+    {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(DDN_D_RETRY_MIN_TIME));
+    }
+    nRetryTime = min(nRetryTime * 2, (uint32)DDN_D_RETRY_MAX_TIME);
+    return fRunFlag;
+}
+
+void CDbStorage::JournalWork()
+{
+    time_t tmPrevCheckpointTime = time(NULL);
+    time_t tmPrevStatTime = tmPrevCheckpointTime;
+    uint32 nRetryTime = DDN_D_RETRY_MIN_TIME;
+
+    while (fRunFlag)
+    {
+        if (tJournal.Sync())
+        {
+            nRetryTime = DDN_D_RETRY_MIN_TIME;
+        }
+        else if (!WaitRetry(fRunFlag, nRetryTime))
+        {
+            break;
+        }
+        bool fDispatched = DispatchJournal();
+        {
+            boost::unique_lock<boost::mutex> lock(lockDispatch);
+            nJournalPeak = max(nJournalPeak, tJournal.GetAppendSeq() - nDispatchSeq);
+        }
+
+        time_t tmCurTime = time(NULL);
+        if (tmCurTime - tmPrevCheckpointTime >= DDN_D_JOURNAL_CHECKPOINT_TIME || tmCurTime < tmPrevCheckpointTime)
+        {
+            tmPrevCheckpointTime = tmCurTime;
+            tJournal.SetCheckpoint(GetJournalCheckpoint());
+        }
+        if (fCfgShowStat && (tmCurTime - tmPrevStatTime >= nCfgStatTimeLen || tmCurTime < tmPrevStatTime))
+        {
+            tmPrevStatTime = tmCurTime;
+
+            char sBuf[256] = { 0 };
+            sprintf(sBuf, "db journal: append: %lu, pending: %lu, checkpoint: %lu.",
+                    tJournal.GetAppendSeq(), tJournal.GetPendingCount(), GetJournalCheckpoint());
+            blockhead::StdLog("STAT", sBuf);
+        }
+
+        if (!fDispatched)
+        {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(DDN_D_JOURNAL_SYNC_TIME));
+        }
+    }
+    tJournal.Sync();
+}
+
+// Hands synced records to the writers until a writer queue is full, the
+// record is kept and posted again on the next round
+bool CDbStorage::DispatchJournal()
+{
+    int64 nBeginTime = GetTimeMillis();
+    bool fDispatched = false;
+    while (GetTimeMillis() - nBeginTime < DDN_D_JOURNAL_SYNC_TIME)
+    {
+        if (pJournalNode == NULL)
+        {
+            pJournalNode = tJournal.Read();
+            if (pJournalNode == NULL)
+            {
+                break;
+            }
+        }
+        uint64 nSeq = pJournalNode->nSeq;
+        if (!GetWriter(pJournalNode)->PostDbMessage(pJournalNode))
+        {
+            break;
+        }
+        pJournalNode = NULL;
+        fDispatched = true;
+
+        boost::unique_lock<boost::mutex> lock(lockDispatch);
+        nDispatchSeq = nSeq;
+    }
+    return fDispatched;
+}
+
+// The highest sequence with every record up to it written by its writer
+uint64 CDbStorage::GetJournalCheckpoint()
+{
+    uint64 nSafeSeq;
+    {
+        boost::unique_lock<boost::mutex> lock(lockDispatch);
+        nSafeSeq = nDispatchSeq;
+    }
+    for (size_t i = 0; i < vWriter.size(); i++)
+    {
+        uint64 nPost;
+        uint64 nDone;
+        vWriter[i]->GetJournalSeq(nPost, nDone);
+        if (nDone < nPost && nDone < nSafeSeq)
+        {
+            nSafeSeq = nDone;
+        }
+    }
+    return nSafeSeq;
+}
+
+bool CDbStorage::CreateTables()
+{
+    /*the log store keeps one set of rows keyed by address and port*/
+    if (dynamic_cast<CDbcLogDbConnect*>(pDbConn) != NULL)
+    {
+        if (!pDbConn->ConnectDb())
+        {
+            cerr << "open log store fail.\n";
+            return false;
+        }
+        return true;
+    }
+    if (!pDbConn->ExecuteStaticSql("CREATE TABLE IF NOT EXISTS dnseednode("
+                                   "id INT NOT NULL AUTO_INCREMENT,"
+                                   "address varchar(64) NOT NULL,"
+                                   "port INT NOT NULL,"
+                                   "service BIGINT NOT NULL,"
+                                   "score INT NOT NULL,"
+                                   "PRIMARY KEY (id),"
+                                   "UNIQUE KEY i_address_port (address,port))"))
+    {
+        cerr << "create tables fail.\n";
+        return false;
+    }
+    return MigrateUniqueKey();
+}
+
+// Tables created by older versions have a non-unique i_address_port key.
+// Duplicate rows are removed, keeping the newest one, and the key is rebuilt
+// as unique so inserts can use ON DUPLICATE KEY UPDATE.
+bool CDbStorage::MigrateUniqueKey()
+{
+    CDbcSelect* pSelect = pDbConn->Query("SHOW INDEX FROM dnseednode WHERE Key_name='i_address_port'");
+    if (pSelect == NULL)
+    {
+        cerr << "query index fail.\n";
+        return false;
+    }
+    int iNonUnique = 0;
+    if (pSelect->MoveNext() && !pSelect->GetField(1, iNonUnique))
+    {
+        iNonUnique = 0;
+    }
+    pSelect->Release();
+    if (iNonUnique == 0)
+    {
+        return true;
+    }
+
+    blockhead::StdLog("CDbStorage", "Migrate dnseednode key i_address_port to unique.");
+    if (!pDbConn->ExecuteStaticSql("DELETE t1 FROM dnseednode t1 INNER JOIN dnseednode t2 "
+                                   "ON t1.address=t2.address AND t1.port=t2.port AND t1.id<t2.id"))
+    {
+        cerr << "delete duplicate address fail.\n";
+        return false;
+    }
+    if (!pDbConn->ExecuteStaticSql("ALTER TABLE dnseednode DROP KEY i_address_port, "
+                                   "ADD UNIQUE KEY i_address_port (address,port)"))
+    {
+        cerr << "alter key i_address_port fail.\n";
+        return false;
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+CDbStorageWriter::CDbStorageWriter(CDbStorage* pStorageIn, uint32 nWriterIndexIn, CDbcConfig& tDbCfg)
+  : pStorage(pStorageIn), nWriterIndex(nWriterIndexIn), fRunFlag(false), pThreadDbAcc(NULL), nPostSeq(0), nDoneSeq(0), nTakenSeq(0)
+{
     nInsertCount = 0;
     nDeleteCount = 0;
     nUpdateCount = 0;
     nPrevInsertCount = 0;
     nPrevDeleteCount = 0;
     nPrevUpdateCount = 0;
-    pDbConn = CDbcDbConnect::DbcCreateDbConnObj(*pDbCfg);
+    memset(pStmtCache, 0, sizeof(pStmtCache));
+    nSqlCount = 0;
+    nPrevSqlCount = 0;
+    nMergeInCount = 0;
+    nMergeOutCount = 0;
+    nDropCount = 0;
+    iDbCommitCount = 0;
+    pDbConn = CDbcDbConnect::DbcCreateDbConnObj(tDbCfg);
+    pLogConn = dynamic_cast<CDbcLogDbConnect*>(pDbConn);
 }
 
-CDbStorage::~CDbStorage()
+CDbStorageWriter::~CDbStorageWriter()
 {
     Stop();
+    ReleaseStatements();
+
+    CDNSeedNode* pNode = NULL;
+    while (tDbMsgQueue.GetData(pNode, 0))
+    {
+        delete pNode;
+    }
+    map<pair<string, uint16>, CDNSeedPendingNode>::iterator it;
+    for (it = mapPendingNode.begin(); it != mapPendingNode.end(); ++it)
+    {
+        delete it->second.pNode;
+    }
+    mapPendingNode.clear();
 
     if (pDbConn)
     {
         pDbConn->DisconnectDb();
         pDbConn->Release();
         pDbConn = NULL;
+        pLogConn = NULL;
     }
 }
 
-void CDbStorage::SetDbConfig(CDbcConfig* pDbCfg)
-{
-    pDbConn = CDbcDbConnect::DbcCreateDbConnObj(*pDbCfg);
-}
-
-void CDbStorage::SetBbAddrPool(CBbAddrPool* pPool)
-{
-    pAddrPool = pPool;
-}
-
-bool CDbStorage::Start()
+bool CDbStorageWriter::Start()
 {
+    if (pDbConn == NULL)
+    {
+        return false;
+    }
     fRunFlag = true;
-    pThreadDbAcc = new boost::thread(boost::bind(&CDbStorage::Work, this));
+    pThreadDbAcc = new boost::thread(boost::bind(&CDbStorageWriter::Work, this));
     if (pThreadDbAcc == NULL)
     {
         return false;
@@ -71,7 +604,7 @@ bool CDbStorage::Start()
     return true;
 }
 
-void CDbStorage::Stop()
+void CDbStorageWriter::Stop()
 {
     fRunFlag = false;
 
@@ -84,61 +617,115 @@ void CDbStorage::Stop()
     }
 }
 
-bool CDbStorage::PurgeData()
+bool CDbStorageWriter::PostDbMessage(CDNSeedNode* pMsg)
 {
-    if (!pDbConn->ExecuteStaticSql("DROP TABLE dnseednode"))
+    if (pMsg->nSeq > 0)
+    {
+        boost::unique_lock<boost::mutex> lock(lockSeq);
+        nPostSeq = pMsg->nSeq;
+    }
+    if (!tDbMsgQueue.SetData(pMsg))
     {
-        cerr << "Purge data fail.\n";
         return false;
     }
+    uint32 nQueueSize = tDbMsgQueue.GetCount();
+    boost::unique_lock<boost::mutex> lock(lockStat);
+    tStatData.nQueuePeak = max(tStatData.nQueuePeak, nQueueSize);
     return true;
 }
 
-bool CDbStorage::PostDbMessage(CDNSeedNode* pMsg)
+uint32 CDbStorageWriter::GetMsgQueueSize()
 {
-    return tDbMsgQueue.SetData(pMsg);
+    return tDbMsgQueue.GetCount();
 }
 
-bool CDbStorage::ReqFetchAddr()
+void CDbStorageWriter::GetJournalSeq(uint64& nPost, uint64& nDone)
 {
-    CDNSeedNode* pNode = new CDNSeedNode(DDN_E_MSG_TYPE_FETCH);
-    return tDbMsgQueue.SetData(pNode);
+    boost::unique_lock<boost::mutex> lock(lockSeq);
+    nPost = nPostSeq;
+    nDone = nDoneSeq;
 }
 
-uint32 CDbStorage::GetMsgQueueSize()
+void CDbStorageWriter::StatDbData(CDbStatData& tData)
 {
-    return tDbMsgQueue.GetCount();
+    boost::unique_lock<boost::mutex> lock(lockStat);
+    tData += tStatData;
+    tStatData.Init();
 }
 
-void CDbStorage::SetStatParam(bool fShowStatIn, uint32 nStatTimeIn)
+void CDbStorageWriter::SetDoneSeq(uint64 nSeq)
 {
-    fCfgShowStat = fShowStatIn;
-    nCfgStatTimeLen = nStatTimeIn;
+    boost::unique_lock<boost::mutex> lock(lockSeq);
+    if (nSeq > nDoneSeq)
+    {
+        nDoneSeq = nSeq;
+    }
 }
 
 //----------------------------------------------------------------------------
-void CDbStorage::Work()
+void CDbStorageWriter::Work()
 {
-    CreateTables();
-    HandleFetchAddr();
+    if (nWriterIndex == 0)
+    {
+        HandleFetchAddr();
+    }
 
     tmPrevTimerTime = time(NULL);
     tmPrevStatTime = tmPrevTimerTime;
+    tmPrevFlushTime = tmPrevTimerTime;
 
     while (fRunFlag)
     {
         DoTimer();
+        if (pStorage->nCfgBatchCount > 1)
+        {
+            vector<CDNSeedNode*> vNode;
+            tDbMsgQueue.GetDataBatch(vNode, pStorage->nCfgBatchCount, 100);
+            if (pStorage->nCfgFlushTime > 0)
+            {
+                for (size_t i = 0; i < vNode.size(); i++)
+                {
+                    nTakenSeq = max(nTakenSeq, vNode[i]->nSeq);
+                    AddPendingNode(vNode[i]);
+                }
+                time_t tmCurTime = time(NULL);
+                if (mapPendingNode.size() >= pStorage->nCfgBatchCount
+                    || tmCurTime - tmPrevFlushTime >= pStorage->nCfgFlushTime || tmCurTime < tmPrevFlushTime)
+                {
+                    FlushPendingNode();
+                }
+                continue;
+            }
+            if (vNode.empty())
+            {
+                continue;
+            }
+            bool fWritten = WriteBatch(vNode);
+            for (size_t i = 0; i < vNode.size(); i++)
+            {
+                if (fWritten)
+                {
+                    SetDoneSeq(vNode[i]->nSeq);
+                }
+                delete vNode[i];
+            }
+            continue;
+        }
         CDNSeedNode* pNode = NULL;
         if (!tDbMsgQueue.GetData(pNode, 100) || pNode == NULL)
         {
             continue;
         }
-        DoMessage(pNode);
+        if (WriteMessage(pNode))
+        {
+            SetDoneSeq(pNode->nSeq);
+        }
         delete pNode;
     }
+    FlushPendingNode();
 }
 
-void CDbStorage::DoTimer()
+void CDbStorageWriter::DoTimer()
 {
     time_t tmCurTime = time(NULL);
 
@@ -148,39 +735,59 @@ void CDbStorage::DoTimer()
 
         pDbConn->Timer();
 
-        int iDbCommitCount = tDbMsgQueue.GetCount() / 10;
-        if (iDbCommitCount >= 10)
+        int iQueueSize = tDbMsgQueue.GetCount();
+        int iCommitCount = iQueueSize / 10;
+        if (iCommitCount > 1 && iCommitCount < 10)
         {
-            pDbConn->SetCommitCount(iDbCommitCount);
+            iCommitCount = iDbCommitCount;
+        }
+        else if (iCommitCount <= 1)
+        {
+            iCommitCount = 0;
         }
-        else if (iDbCommitCount <= 1)
+        if (iCommitCount != iDbCommitCount)
         {
-            pDbConn->SetCommitCount(0);
+            char sBuf[128] = { 0 };
+            sprintf(sBuf, "db writer %u commit count: %d -> %d, queue: %d.", nWriterIndex, iDbCommitCount, iCommitCount, iQueueSize);
+            blockhead::StdLog("CDbStorage", sBuf);
+
+            iDbCommitCount = iCommitCount;
+            pDbConn->SetCommitCount(iDbCommitCount);
+
+            boost::unique_lock<boost::mutex> lock(lockStat);
+            tStatData.nCommitCountChange++;
         }
     }
 
-    if (tmCurTime - tmPrevStatTime >= nCfgStatTimeLen || tmCurTime < tmPrevStatTime)
+    if (tmCurTime - tmPrevStatTime >= pStorage->nCfgStatTimeLen || tmCurTime < tmPrevStatTime)
     {
         tmPrevStatTime = tmCurTime;
 
-        if (fCfgShowStat)
+        if (pStorage->fCfgShowStat)
         {
+            uint64 nRowCount = nInsertCount + nDeleteCount + nUpdateCount;
+            uint64 nPrevRowCount = nPrevInsertCount + nPrevDeleteCount + nPrevUpdateCount;
             char sBuf[512] = { 0 };
-            sprintf(sBuf, "db queue: %d, Insert: %ld-%ld, Delete: %ld-%ld, Update: %ld-%ld.",
-                    tDbMsgQueue.GetCount(),
-                    nInsertCount, (nInsertCount - nPrevInsertCount) / nCfgStatTimeLen,
-                    nDeleteCount, (nDeleteCount - nPrevDeleteCount) / nCfgStatTimeLen,
-                    nUpdateCount, (nUpdateCount - nPrevUpdateCount) / nCfgStatTimeLen);
+            sprintf(sBuf, "db writer %u queue: %d, Rows: %ld-%ld, Insert: %ld-%ld, Delete: %ld-%ld, Update: %ld-%ld, Sql: %ld-%ld, Merge: %ld->%ld(%.1f%%), Drop: %ld.",
+                    nWriterIndex, tDbMsgQueue.GetCount(),
+                    nRowCount, (nRowCount - nPrevRowCount) / pStorage->nCfgStatTimeLen,
+                    nInsertCount, (nInsertCount - nPrevInsertCount) / pStorage->nCfgStatTimeLen,
+                    nDeleteCount, (nDeleteCount - nPrevDeleteCount) / pStorage->nCfgStatTimeLen,
+                    nUpdateCount, (nUpdateCount - nPrevUpdateCount) / pStorage->nCfgStatTimeLen,
+                    nSqlCount, (nSqlCount - nPrevSqlCount) / pStorage->nCfgStatTimeLen,
+                    nMergeInCount, nMergeOutCount,
+                    (nMergeInCount ? (nMergeInCount - nMergeOutCount) * 100.0 / nMergeInCount : 0.0), nDropCount);
             blockhead::StdLog("STAT", sBuf);
         }
 
         nPrevInsertCount = nInsertCount;
         nPrevDeleteCount = nDeleteCount;
         nPrevUpdateCount = nUpdateCount;
+        nPrevSqlCount = nSqlCount;
     }
 }
 
-void CDbStorage::DoMessage(CDNSeedNode* pNode)
+bool CDbStorageWriter::DoMessage(CDNSeedNode* pNode)
 {
     switch (pNode->eMsgType)
     {
@@ -188,137 +795,622 @@ void CDbStorage::DoMessage(CDNSeedNode* pNode)
         HandleFetchAddr();
         break;
     case DDN_E_MSG_TYPE_INSERT:
-        HandleInsertNode(pNode);
+        if (!HandleInsertNode(pNode))
+        {
+            return false;
+        }
         nInsertCount++;
         break;
     case DDN_E_MSG_TYPE_DELETE:
-        HandleDeleteNode(pNode);
+        if (!HandleDeleteNode(pNode))
+        {
+            return false;
+        }
         nDeleteCount++;
         break;
     case DDN_E_MSG_TYPE_UPDATE:
-        HandleUpdateNode(pNode);
+        if (!HandleUpdateNode(pNode))
+        {
+            return false;
+        }
         nUpdateCount++;
         break;
     }
+    return true;
 }
 
-bool CDbStorage::CreateTables()
+// Consecutive messages of the same type are written with one statement per
+// DDN_D_BATCH_STMT_ROWS rows, so the order between different types is kept.
+// Returns true once the whole batch is committed, a failed batch is rolled back.
+bool CDbStorageWriter::DoMessageBatch(vector<CDNSeedNode*>& vNode)
 {
-    if (!pDbConn->ExecuteStaticSql("CREATE TABLE IF NOT EXISTS dnseednode("
-                                   "id INT NOT NULL AUTO_INCREMENT,"
-                                   "address varchar(64) NOT NULL,"
-                                   "port INT NOT NULL,"
-                                   "service BIGINT NOT NULL,"
-                                   "score INT NOT NULL,"
-                                   "PRIMARY KEY (id),"
-                                   "KEY i_address_port (address,port))"))
+    bool fTransaction = pDbConn->BeginTransaction();
+
+    bool fRet = true;
+    uint64 nInsert = 0;
+    uint64 nDelete = 0;
+    uint64 nUpdate = 0;
+    size_t nBegin = 0;
+    while (fRet && nBegin < vNode.size())
     {
-        cerr << "create tables fail.\n";
-        return false;
+        DDN_E_MSG_TYPE eMsgType = vNode[nBegin]->eMsgType;
+        size_t nEnd = nBegin + 1;
+        while (nEnd < vNode.size() && vNode[nEnd]->eMsgType == eMsgType)
+        {
+            nEnd++;
+        }
+
+        for (size_t nStmtBegin = nBegin; fRet && nStmtBegin < nEnd; nStmtBegin += DDN_D_BATCH_STMT_ROWS)
+        {
+            size_t nStmtEnd = min(nStmtBegin + DDN_D_BATCH_STMT_ROWS, nEnd);
+            switch (eMsgType)
+            {
+            case DDN_E_MSG_TYPE_FETCH:
+                HandleFetchAddr();
+                break;
+            case DDN_E_MSG_TYPE_INSERT:
+                fRet = HandleInsertBatch(vNode, nStmtBegin, nStmtEnd);
+                nInsert += nStmtEnd - nStmtBegin;
+                break;
+            case DDN_E_MSG_TYPE_DELETE:
+                fRet = HandleDeleteBatch(vNode, nStmtBegin, nStmtEnd);
+                nDelete += nStmtEnd - nStmtBegin;
+                break;
+            case DDN_E_MSG_TYPE_UPDATE:
+                fRet = HandleUpdateBatch(vNode, nStmtBegin, nStmtEnd);
+                nUpdate += nStmtEnd - nStmtBegin;
+                break;
+            }
+        }
+        nBegin = nEnd;
+    }
+
+    if (fTransaction)
+    {
+        if (!fRet)
+        {
+            pDbConn->RollbackTransaction();
+            return false;
+        }
+
+        int64 nBeginTime = GetTimeMicros();
+        if (!pDbConn->CommitTransaction())
+        {
+            blockhead::StdError(__PRETTY_FUNCTION__, "Commit transaction fail.");
+            return false;
+        }
+        int64 nCommitTime = GetTimeMicros() - nBeginTime;
+
+        boost::unique_lock<boost::mutex> lock(lockStat);
+        tStatData.tCommitTime.AddTime(nCommitTime);
+        tStatData.nTxnCount++;
+        tStatData.nTxnRowCount += vNode.size();
+        tStatData.nTxnMaxRowCount = max(tStatData.nTxnMaxRowCount, (uint64)vNode.size());
+    }
+    if (fRet)
+    {
+        nInsertCount += nInsert;
+        nDeleteCount += nDelete;
+        nUpdateCount += nUpdate;
+    }
+    return fRet;
+}
+
+// Writes the message, a failure that may pass is retried until it succeeds and
+// a message the database rejects is logged and dropped. Returns false when the
+// writer is stopped first, the message then stays in the journal for the next start.
+bool CDbStorageWriter::WriteMessage(CDNSeedNode* pNode)
+{
+    uint32 nRetryTime = DDN_D_RETRY_MIN_TIME;
+    while (!DoMessage(pNode))
+    {
+        if (!pDbConn->IsTransientError())
+        {
+            char sBuf[256] = { 0 };
+            sprintf(sBuf, "db writer %u drop message: type: %d, address: %s, port: %u, service: %lu, score: %d, seq: %lu.",
+                    nWriterIndex, pNode->eMsgType, pNode->strIp.c_str(), pNode->nPort, pNode->nService, pNode->iScore, pNode->nSeq);
+            blockhead::StdError(__PRETTY_FUNCTION__, sBuf);
+            nDropCount++;
+            return true;
+        }
+        char sBuf[128] = { 0 };
+        sprintf(sBuf, "db writer %u write fail, retry in %u ms.", nWriterIndex, nRetryTime);
+        blockhead::StdError(__PRETTY_FUNCTION__, sBuf);
+        if (!WaitRetry(fRunFlag, nRetryTime))
+        {
+            return false;
+        }
     }
     return true;
 }
 
-void CDbStorage::HandleFetchAddr()
+// A batch the database rejects is written again one message at a time, so
+// only the messages it rejects themselves are dropped
+bool CDbStorageWriter::WriteBatch(vector<CDNSeedNode*>& vNode)
 {
-    std::string strSql = "SELECT address,port,service,score FROM dnseednode";
-    CDbcSelect* pSelect = pDbConn->Query(strSql);
-    if (pSelect == NULL)
+    uint32 nRetryTime = DDN_D_RETRY_MIN_TIME;
+    while (!DoMessageBatch(vNode))
+    {
+        if (!pDbConn->IsTransientError())
+        {
+            char sBuf[128] = { 0 };
+            sprintf(sBuf, "db writer %u write batch of %lu fail, write one message at a time.", nWriterIndex, (unsigned long)vNode.size());
+            blockhead::StdError(__PRETTY_FUNCTION__, sBuf);
+            for (size_t i = 0; i < vNode.size(); i++)
+            {
+                if (!WriteMessage(vNode[i]))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        char sBuf[128] = { 0 };
+        sprintf(sBuf, "db writer %u write batch of %lu fail, retry in %u ms.", nWriterIndex, (unsigned long)vNode.size(), nRetryTime);
+        blockhead::StdError(__PRETTY_FUNCTION__, sBuf);
+        if (!WaitRetry(fRunFlag, nRetryTime))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Merges the new message into the pending change of its address, the last
+// writer wins: insert+update is an insert with the final values, insert+delete
+// cancels out, and an update or delete of a deleted address is dropped.
+void CDbStorageWriter::AddPendingNode(CDNSeedNode* pNode)
+{
+    if (pNode->eMsgType == DDN_E_MSG_TYPE_FETCH)
     {
+        FlushPendingNode();
+        HandleFetchAddr();
+        delete pNode;
         return;
     }
+    nMergeInCount++;
 
-    while (pSelect->MoveNext())
+    pair<string, uint16> tKey(pNode->strIp, pNode->nPort);
+    map<pair<string, uint16>, CDNSeedPendingNode>::iterator it = mapPendingNode.find(tKey);
+    if (it == mapPendingNode.end())
     {
-        string strIp;
-        int iPort;
-        uint64 nService;
-        int iScore;
+        mapPendingNode.insert(make_pair(tKey, CDNSeedPendingNode(pNode)));
+        return;
+    }
 
-        if (!pSelect->GetField(0, strIp))
+    CDNSeedPendingNode& tPending = it->second;
+    CDNSeedNode* pPrevNode = tPending.pNode;
+    switch (pPrevNode->eMsgType)
+    {
+    case DDN_E_MSG_TYPE_INSERT:
+        if (pNode->eMsgType == DDN_E_MSG_TYPE_DELETE)
         {
-            break;
+            if (tPending.fDeleteFirst)
+            {
+                tPending.pNode = pNode;
+                tPending.fDeleteFirst = false;
+            }
+            else
+            {
+                mapPendingNode.erase(it);
+                delete pNode;
+            }
+            delete pPrevNode;
         }
-        if (!pSelect->GetField(1, iPort))
+        else
         {
-            break;
+            pPrevNode->nService = pNode->nService;
+            pPrevNode->iScore = pNode->iScore;
+            delete pNode;
         }
-        if (!pSelect->GetField(2, nService))
+        break;
+    case DDN_E_MSG_TYPE_UPDATE:
+        /*Inserts are upserts, so a later insert also carries the newest service and score*/
+        tPending.pNode = pNode;
+        delete pPrevNode;
+        break;
+    case DDN_E_MSG_TYPE_DELETE:
+        if (pNode->eMsgType == DDN_E_MSG_TYPE_INSERT)
         {
-            break;
+            tPending.pNode = pNode;
+            tPending.fDeleteFirst = true;
+            delete pPrevNode;
         }
-        if (!pSelect->GetField(3, iScore))
+        else
         {
-            break;
+            delete pNode;
         }
+        break;
+    default:
+        delete pNode;
+        break;
+    }
+}
+
+void CDbStorageWriter::FlushPendingNode()
+{
+    tmPrevFlushTime = time(NULL);
+    if (mapPendingNode.empty())
+    {
+        SetDoneSeq(nTakenSeq);
+        return;
+    }
 
-        CMthNetEndpoint ep;
-        if (!ep.SetAddrPort(strIp, uint16(iPort)))
+    // Every address has one change left, an insert of an address deleted
+    // before overwrites the stored row
+    vector<CDNSeedNode*> vNode;
+    map<pair<string, uint16>, CDNSeedPendingNode>::iterator it;
+    for (it = mapPendingNode.begin(); it != mapPendingNode.end(); ++it)
+    {
+        if (it->second.pNode->eMsgType == DDN_E_MSG_TYPE_DELETE)
         {
-            continue;
+            vNode.push_back(it->second.pNode);
+        }
+    }
+    for (it = mapPendingNode.begin(); it != mapPendingNode.end(); ++it)
+    {
+        if (it->second.pNode->eMsgType == DDN_E_MSG_TYPE_INSERT)
+        {
+            vNode.push_back(it->second.pNode);
+        }
+    }
+    for (it = mapPendingNode.begin(); it != mapPendingNode.end(); ++it)
+    {
+        if (it->second.pNode->eMsgType == DDN_E_MSG_TYPE_UPDATE)
+        {
+            vNode.push_back(it->second.pNode);
         }
-        pAddrPool->AddAddrFromDb(ep, nService, iScore);
     }
 
-    pSelect->Release();
+    /*Changes that could not be written stay pending*/
+    if (!WriteBatch(vNode))
+    {
+        return;
+    }
+    mapPendingNode.clear();
+    nMergeOutCount += vNode.size();
+    for (size_t i = 0; i < vNode.size(); i++)
+    {
+        delete vNode[i];
+    }
+    SetDoneSeq(nTakenSeq);
 }
 
-void CDbStorage::HandleInsertNode(CDNSeedNode* pNode)
+// Loads the table in primary key order, nCfgFetchCount rows per query. Rows are
+// streamed from the server and added to the pool as they arrive.
+void CDbStorageWriter::HandleFetchAddr()
 {
-    if (!QueryAddrIfExist(pNode))
+    int64 nBeginTime = GetTimeMillis();
+    int64 nFirstAddrTime = -1;
+    uint64 nRowCount = 0;
+    uint32 nLastId = 0;
+    bool fMore = true;
+
+    while (fMore)
     {
-        std::ostringstream oss;
-        oss << "INSERT INTO dnseednode(address,port,service,score) VALUES("
-            << "\'" << pDbConn->ToEscString(pNode->strIp) << "\',"
-            << pNode->nPort << ","
-            << pNode->nService << ","
-            << pNode->iScore << ")";
-        std::string strSql = oss.str();
-        pDbConn->ExecuteStaticSql(strSql);
+        int64 nQueryTime = GetTimeMicros();
+        CDbcSelect* pSelect = NULL;
+        if (pLogConn)
+        {
+            pSelect = pLogConn->SelectRows(nLastId, pStorage->nCfgFetchCount);
+        }
+        else
+        {
+            std::ostringstream oss;
+            oss << "SELECT id,address,port,service,score FROM dnseednode WHERE id>" << nLastId << " ORDER BY id";
+            if (pStorage->nCfgFetchCount > 0)
+            {
+                oss << " LIMIT " << pStorage->nCfgFetchCount;
+            }
+            pSelect = pDbConn->QueryStream(oss.str());
+        }
+        if (pSelect == NULL)
+        {
+            break;
+        }
+        nQueryTime = GetTimeMicros() - nQueryTime;
+        {
+            boost::unique_lock<boost::mutex> lock(lockStat);
+            tStatData.tFetchTime.AddTime(nQueryTime);
+        }
+
+        uint32 nPageCount = 0;
+        while (pSelect->MoveNext())
+        {
+            string strIp;
+            int iPort;
+            uint64 nService;
+            int iScore;
+
+            if (!pSelect->GetField(0, nLastId))
+            {
+                break;
+            }
+            if (!pSelect->GetField(1, strIp))
+            {
+                break;
+            }
+            if (!pSelect->GetField(2, iPort))
+            {
+                break;
+            }
+            if (!pSelect->GetField(3, nService))
+            {
+                break;
+            }
+            if (!pSelect->GetField(4, iScore))
+            {
+                break;
+            }
+            nPageCount++;
+
+            CMthNetEndpoint ep;
+            if (!ep.SetAddrPort(strIp, uint16(iPort)))
+            {
+                continue;
+            }
+            if (pStorage->pAddrPool->AddAddrFromDb(ep, nService, iScore) && nFirstAddrTime < 0)
+            {
+                nFirstAddrTime = GetTimeMillis() - nBeginTime;
+            }
+        }
+        pSelect->Release();
+
+        nRowCount += nPageCount;
+        fMore = (pStorage->nCfgFetchCount > 0 && nPageCount == pStorage->nCfgFetchCount);
     }
+
+    char sBuf[256] = { 0 };
+    sprintf(sBuf, "Fetch address: rows: %lu, first address: %ld ms, total: %ld ms, peak memory: %lu KB.",
+            nRowCount, nFirstAddrTime, GetTimeMillis() - nBeginTime, GetPeakMemory());
+    blockhead::StdLog("CDbStorage", sBuf);
 }
 
-void CDbStorage::HandleUpdateNode(CDNSeedNode* pNode)
+bool CDbStorageWriter::HandleInsertNode(CDNSeedNode* pNode)
 {
-    std::ostringstream oss;
-    oss << "UPDATE dnseednode SET service=" << pNode->nService << ",score=" << pNode->iScore << " WHERE address=\'"
-        << pDbConn->ToEscString(pNode->strIp) << "\' AND port=" << pNode->nPort;
-    std::string strSql = oss.str();
-    pDbConn->ExecuteStaticSql(strSql);
+    return ExecuteRows(DDN_E_STMT_TYPE_INSERT, &pNode, 1);
 }
 
-void CDbStorage::HandleDeleteNode(CDNSeedNode* pNode)
+bool CDbStorageWriter::HandleUpdateNode(CDNSeedNode* pNode)
 {
-    std::ostringstream oss;
-    oss << "DELETE FROM dnseednode WHERE address=\'"
-        << pDbConn->ToEscString(pNode->strIp) << "\' AND port=" << pNode->nPort;
-    std::string strSql = oss.str();
-    pDbConn->ExecuteStaticSql(strSql);
+    return ExecuteRows(DDN_E_STMT_TYPE_UPDATE, &pNode, 1);
 }
 
-bool CDbStorage::QueryAddrIfExist(CDNSeedNode* pNode)
+bool CDbStorageWriter::HandleDeleteNode(CDNSeedNode* pNode)
 {
-    std::ostringstream oss;
-    oss << "SELECT count(*) FROM dnseednode WHERE address=\'"
-        << pDbConn->ToEscString(pNode->strIp) << "\' AND port=" << pNode->nPort;
-    std::string strSql = oss.str();
+    return ExecuteRows(DDN_E_STMT_TYPE_DELETE, &pNode, 1);
+}
 
-    CDbcSelect* pSelect = pDbConn->Query(strSql);
-    if (pSelect == NULL || !pSelect->MoveNext())
+//----------------------------------------------------------------------------
+bool CDbStorageWriter::HandleInsertBatch(vector<CDNSeedNode*>& vNode, size_t nBegin, size_t nEnd)
+{
+    if (nBegin < nEnd)
     {
-        pSelect->Release();
-        return false;
+        return ExecuteRows(DDN_E_STMT_TYPE_INSERT, &vNode[nBegin], nEnd - nBegin);
     }
+    return true;
+}
 
-    uint32 nCount = 0;
-    if (!pSelect->GetField(0, nCount) || nCount == 0)
+bool CDbStorageWriter::HandleUpdateBatch(vector<CDNSeedNode*>& vNode, size_t nBegin, size_t nEnd)
+{
+    // CASE takes the first matching WHEN, keep only the last update of an address
+    map<pair<string, uint16>, CDNSeedNode*> mapLast;
+    for (size_t i = nBegin; i < nEnd; i++)
     {
-        pSelect->Release();
-        return false;
+        mapLast[make_pair(vNode[i]->strIp, vNode[i]->nPort)] = vNode[i];
     }
-    pSelect->Release();
+    if (mapLast.empty())
+    {
+        return true;
+    }
+
+    vector<CDNSeedNode*> vLast;
+    vLast.reserve(mapLast.size());
+    map<pair<string, uint16>, CDNSeedNode*>::iterator it;
+    for (it = mapLast.begin(); it != mapLast.end(); ++it)
+    {
+        vLast.push_back(it->second);
+    }
+    return ExecuteRows(DDN_E_STMT_TYPE_UPDATE, &vLast[0], vLast.size());
+}
 
+bool CDbStorageWriter::HandleDeleteBatch(vector<CDNSeedNode*>& vNode, size_t nBegin, size_t nEnd)
+{
+    if (nBegin < nEnd)
+    {
+        return ExecuteRows(DDN_E_STMT_TYPE_DELETE, &vNode[nBegin], nEnd - nBegin);
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// Rows are written with the cached statements of power of two sizes, largest
+// first. Stops at the first statement that fails.
+bool CDbStorageWriter::ExecuteRows(DDN_E_STMT_TYPE eType, CDNSeedNode** ppNode, size_t nCount)
+{
+    if (pLogConn)
+    {
+        return ExecuteLogRows(eType, ppNode, nCount);
+    }
+
+    size_t nPos = 0;
+    while (nPos < nCount)
+    {
+        uint32 nSizeClass = DDN_D_STMT_SIZE_CLASS - 1;
+        while ((size_t(1) << nSizeClass) > nCount - nPos)
+        {
+            nSizeClass--;
+        }
+        size_t nRowCount = size_t(1) << nSizeClass;
+
+        CDbcStatement* pStmt = GetStatement(eType, nSizeClass);
+        if (pStmt == NULL)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < nRowCount; i++)
+        {
+            BindRow(pStmt, eType, nRowCount, i, ppNode[nPos + i]);
+        }
+        int64 nBeginTime = GetTimeMicros();
+        bool fOk = pStmt->Execute();
+        int64 nExecTime = GetTimeMicros() - nBeginTime;
+        {
+            boost::unique_lock<boost::mutex> lock(lockStat);
+            tStatData.tExecTime[eType].AddTime(nExecTime);
+        }
+        nSqlCount++;
+        if (!fOk)
+        {
+            return false;
+        }
+        nPos += nRowCount;
+    }
     return true;
 }
 
+// The log store takes the rows one by one, timed as one statement.
+// Stops at the first row that fails.
+bool CDbStorageWriter::ExecuteLogRows(DDN_E_STMT_TYPE eType, CDNSeedNode** ppNode, size_t nCount)
+{
+    int64 nBeginTime = GetTimeMicros();
+    bool fOk = true;
+    for (size_t i = 0; fOk && i < nCount; i++)
+    {
+        CDNSeedNode* pNode = ppNode[i];
+        switch (eType)
+        {
+        case DDN_E_STMT_TYPE_INSERT:
+            fOk = pLogConn->PutRow(pNode->strIp, pNode->nPort, pNode->nService, pNode->iScore, true);
+            break;
+        case DDN_E_STMT_TYPE_UPDATE:
+            fOk = pLogConn->PutRow(pNode->strIp, pNode->nPort, pNode->nService, pNode->iScore, false);
+            break;
+        case DDN_E_STMT_TYPE_DELETE:
+            fOk = pLogConn->DeleteRow(pNode->strIp, pNode->nPort);
+            break;
+        default:
+            fOk = false;
+            break;
+        }
+    }
+    int64 nExecTime = GetTimeMicros() - nBeginTime;
+    {
+        boost::unique_lock<boost::mutex> lock(lockStat);
+        tStatData.tExecTime[eType].AddTime(nExecTime);
+    }
+    nSqlCount++;
+    return fOk;
+}
+
+void CDbStorageWriter::BindRow(CDbcStatement* pStmt, DDN_E_STMT_TYPE eType, size_t nRowCount, size_t nRow, CDNSeedNode* pNode)
+{
+    unsigned int uiPos;
+    switch (eType)
+    {
+    case DDN_E_STMT_TYPE_INSERT:
+        uiPos = nRow * 4;
+        pStmt->Bind(uiPos, pNode->strIp);
+        pStmt->Bind(uiPos + 1, (unsigned int)pNode->nPort);
+        pStmt->Bind(uiPos + 2, (unsigned long long)pNode->nService);
+        pStmt->Bind(uiPos + 3, pNode->iScore);
+        break;
+    case DDN_E_STMT_TYPE_UPDATE:
+        /*service CASE, score CASE, then the IN list*/
+        uiPos = nRow * 3;
+        pStmt->Bind(uiPos, pNode->strIp);
+        pStmt->Bind(uiPos + 1, (unsigned int)pNode->nPort);
+        pStmt->Bind(uiPos + 2, (unsigned long long)pNode->nService);
+        uiPos = nRowCount * 3 + nRow * 3;
+        pStmt->Bind(uiPos, pNode->strIp);
+        pStmt->Bind(uiPos + 1, (unsigned int)pNode->nPort);
+        pStmt->Bind(uiPos + 2, pNode->iScore);
+        uiPos = nRowCount * 6 + nRow * 2;
+        pStmt->Bind(uiPos, pNode->strIp);
+        pStmt->Bind(uiPos + 1, (unsigned int)pNode->nPort);
+        break;
+    case DDN_E_STMT_TYPE_DELETE:
+        uiPos = nRow * 2;
+        pStmt->Bind(uiPos, pNode->strIp);
+        pStmt->Bind(uiPos + 1, (unsigned int)pNode->nPort);
+        break;
+    default:
+        break;
+    }
+}
+
+CDbcStatement* CDbStorageWriter::GetStatement(DDN_E_STMT_TYPE eType, uint32 nSizeClass)
+{
+    CDbcStatement*& pStmt = pStmtCache[eType][nSizeClass];
+    if (pStmt == NULL)
+    {
+        pStmt = pDbConn->Prepare(BuildStatementSql(eType, size_t(1) << nSizeClass));
+        if (pStmt == NULL)
+        {
+            blockhead::StdError(__PRETTY_FUNCTION__, "Prepare statement fail.");
+        }
+    }
+    return pStmt;
+}
+
+string CDbStorageWriter::BuildStatementSql(DDN_E_STMT_TYPE eType, size_t nRowCount)
+{
+    std::ostringstream oss;
+    switch (eType)
+    {
+    case DDN_E_STMT_TYPE_INSERT:
+        oss << "INSERT INTO dnseednode(address,port,service,score) VALUES";
+        for (size_t i = 0; i < nRowCount; i++)
+        {
+            oss << (i ? ",(?,?,?,?)" : "(?,?,?,?)");
+        }
+        oss << " ON DUPLICATE KEY UPDATE service=VALUES(service),score=VALUES(score)";
+        break;
+    case DDN_E_STMT_TYPE_UPDATE:
+        oss << "UPDATE dnseednode SET service=CASE";
+        for (size_t i = 0; i < nRowCount; i++)
+        {
+            oss << " WHEN address=? AND port=? THEN ?";
+        }
+        oss << " ELSE service END,score=CASE";
+        for (size_t i = 0; i < nRowCount; i++)
+        {
+            oss << " WHEN address=? AND port=? THEN ?";
+        }
+        oss << " ELSE score END WHERE (address,port) IN (";
+        for (size_t i = 0; i < nRowCount; i++)
+        {
+            oss << (i ? ",(?,?)" : "(?,?)");
+        }
+        oss << ")";
+        break;
+    case DDN_E_STMT_TYPE_DELETE:
+        oss << "DELETE FROM dnseednode WHERE (address,port) IN (";
+        for (size_t i = 0; i < nRowCount; i++)
+        {
+            oss << (i ? ",(?,?)" : "(?,?)");
+        }
+        oss << ")";
+        break;
+    default:
+        break;
+    }
+    return oss.str();
+}
+
+void CDbStorageWriter::ReleaseStatements()
+{
+    for (int i = 0; i < DDN_E_STMT_TYPE_MAX; i++)
+    {
+        for (int j = 0; j < DDN_D_STMT_SIZE_CLASS; j++)
+        {
+            if (pStmtCache[i][j])
+            {
+                pStmtCache[i][j]->Release();
+                pStmtCache[i][j] = NULL;
+            }
+        }
+    }
+}
+
 } // namespace dnseed
@@ -7,10 +7,15 @@
 
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/thread.hpp>
+#include <map>
+#include <sstream>
 
 #include "blockhead/type.h"
 #include "dbc/dbcacc.h"
+#include "dbc/dbclog.h"
+#include "dbjournal.h"
 #include "nbase/mthbase.h"
 
 namespace dnseed
@@ -21,6 +26,13 @@ using namespace dbc;
 using namespace nbase;
 
 #define DDN_D_STAT_TIME 1
+#define DDN_D_BATCH_COUNT 1000
+#define DDN_D_FETCH_COUNT 10000
+#define DDN_D_BATCH_STMT_ROWS 512
+#define DDN_D_STMT_SIZE_CLASS 10 /*prepared statements of 1,2,4...512 rows*/
+#define DDN_D_LATENCY_BUCKET 32   /*latency buckets of 1,2,4... us*/
+#define DDN_D_RETRY_MIN_TIME 100  /*ms before a failed write is tried again, doubled up to the max*/
+#define DDN_D_RETRY_MAX_TIME 5000
 
 typedef enum _DDN_E_MSG_TYPE
 {
@@ -32,15 +44,25 @@ typedef enum _DDN_E_MSG_TYPE
 } DDN_E_MSG_TYPE,
     *P_DDN_E_MSG_TYPE;
 
+typedef enum _DDN_E_STMT_TYPE
+{
+    DDN_E_STMT_TYPE_INSERT,
+    DDN_E_STMT_TYPE_UPDATE,
+    DDN_E_STMT_TYPE_DELETE,
+    DDN_E_STMT_TYPE_MAX
+
+} DDN_E_STMT_TYPE,
+    *P_DDN_E_STMT_TYPE;
+
 class CDNSeedNode
 {
 public:
     CDNSeedNode(DDN_E_MSG_TYPE e)
-      : eMsgType(e) {}
+      : eMsgType(e), nSeq(0) {}
     CDNSeedNode(DDN_E_MSG_TYPE e, string sIpIn, uint16 nPortIn, uint64 nServiceIn, int iScoreIn)
-      : eMsgType(e), strIp(sIpIn), nPort(nPortIn), nService(nServiceIn), iScore(iScoreIn) {}
+      : eMsgType(e), strIp(sIpIn), nPort(nPortIn), nService(nServiceIn), iScore(iScoreIn), nSeq(0) {}
     CDNSeedNode(CDNSeedNode& tNode)
-      : eMsgType(tNode.eMsgType), strIp(tNode.strIp), nPort(tNode.nPort), nService(tNode.nService), iScore(tNode.iScore) {}
+      : eMsgType(tNode.eMsgType), strIp(tNode.strIp), nPort(tNode.nPort), nService(tNode.nService), iScore(tNode.iScore), nSeq(tNode.nSeq) {}
     ~CDNSeedNode() {}
 
     DDN_E_MSG_TYPE eMsgType;
@@ -49,54 +71,134 @@ public:
     uint16 nPort;
     uint64 nService;
     int iScore;
+    uint64 nSeq; /*journal sequence, 0 when not journaled*/
 };
 
-class CBbAddrPool;
+// Latency histogram, bucket i counts times below 2^(i+1) us. Percentiles are
+// the upper bound of their bucket.
+class CDbLatencyStat
+{
+public:
+    CDbLatencyStat()
+    {
+        Init();
+    }
 
-class CDbStorage
+    void Init();
+    void AddTime(int64 nTimeUs);
+    uint64 GetPercentile(uint32 nPercent) const;
+    CDbLatencyStat& operator+=(const CDbLatencyStat& t);
+
+public:
+    uint64 nCount;
+    uint64 nMaxTime;
+    uint64 nBucket[DDN_D_LATENCY_BUCKET];
+};
+
+// Storage statistics since the previous CDbStorage::StatDbData
+class CDbStatData
 {
 public:
-    CDbStorage();
-    CDbStorage(CDbcConfig* pDbCfg, CBbAddrPool* pPool);
-    ~CDbStorage();
+    CDbStatData()
+    {
+        Init();
+    }
 
-    void SetDbConfig(CDbcConfig* pDbCfg);
-    void SetBbAddrPool(CBbAddrPool* pPool);
+    void Init();
+    CDbStatData& operator+=(const CDbStatData& t);
+
+public:
+    CDbLatencyStat tExecTime[DDN_E_STMT_TYPE_MAX];
+    CDbLatencyStat tFetchTime;
+    CDbLatencyStat tCommitTime;
+
+    uint64 nTxnCount;
+    uint64 nTxnRowCount;
+    uint64 nTxnMaxRowCount;
+
+    uint32 nQueuePeak;
+    uint64 nJournalPeak;
+    uint32 nCommitCountChange;
+};
+
+// Pending change of one address. fDeleteFirst marks an address deleted and
+// inserted again within one flush interval, a later delete must still be written.
+class CDNSeedPendingNode
+{
+public:
+    CDNSeedPendingNode(CDNSeedNode* pNodeIn)
+      : pNode(pNodeIn), fDeleteFirst(false) {}
+
+    CDNSeedNode* pNode;
+    bool fDeleteFirst;
+};
+
+class CBbAddrPool;
+class CDbStorage;
+
+// One writer thread with its own connection and queue. Messages are routed to
+// the writers by address, so the changes of one address keep their order.
+class CDbStorageWriter
+{
+public:
+    CDbStorageWriter(CDbStorage* pStorageIn, uint32 nWriterIndexIn, CDbcConfig& tDbCfg);
+    ~CDbStorageWriter();
 
     bool Start();
     void Stop();
 
-    bool PurgeData();
     bool PostDbMessage(CDNSeedNode* pMsg);
-    bool ReqFetchAddr();
     uint32 GetMsgQueueSize();
-
-    void SetStatParam(bool fShowStatIn, uint32 nStatTimeIn);
+    void GetJournalSeq(uint64& nPost, uint64& nDone);
+    void StatDbData(CDbStatData& tData);
 
 private:
     void Work();
     void DoTimer();
-    void DoMessage(CDNSeedNode* pNode);
-
-    bool CreateTables();
+    bool DoMessage(CDNSeedNode* pNode);
+    bool DoMessageBatch(vector<CDNSeedNode*>& vNode);
+    bool WriteMessage(CDNSeedNode* pNode);
+    bool WriteBatch(vector<CDNSeedNode*>& vNode);
+    void AddPendingNode(CDNSeedNode* pNode);
+    void FlushPendingNode();
+    void SetDoneSeq(uint64 nSeq);
 
     void HandleFetchAddr();
-    void HandleInsertNode(CDNSeedNode* pNode);
-    void HandleUpdateNode(CDNSeedNode* pNode);
-    void HandleDeleteNode(CDNSeedNode* pNode);
+    bool HandleInsertNode(CDNSeedNode* pNode);
+    bool HandleUpdateNode(CDNSeedNode* pNode);
+    bool HandleDeleteNode(CDNSeedNode* pNode);
+
+    bool HandleInsertBatch(vector<CDNSeedNode*>& vNode, size_t nBegin, size_t nEnd);
+    bool HandleUpdateBatch(vector<CDNSeedNode*>& vNode, size_t nBegin, size_t nEnd);
+    bool HandleDeleteBatch(vector<CDNSeedNode*>& vNode, size_t nBegin, size_t nEnd);
 
-    bool QueryAddrIfExist(CDNSeedNode* pNode);
+    bool ExecuteRows(DDN_E_STMT_TYPE eType, CDNSeedNode** ppNode, size_t nCount);
+    bool ExecuteLogRows(DDN_E_STMT_TYPE eType, CDNSeedNode** ppNode, size_t nCount);
+    void BindRow(CDbcStatement* pStmt, DDN_E_STMT_TYPE eType, size_t nRowCount, size_t nRow, CDNSeedNode* pNode);
+    CDbcStatement* GetStatement(DDN_E_STMT_TYPE eType, uint32 nSizeClass);
+    string BuildStatementSql(DDN_E_STMT_TYPE eType, size_t nRowCount);
+    void ReleaseStatements();
 
 private:
+    CDbStorage* pStorage;
+    uint32 nWriterIndex;
+
     bool fRunFlag;
     boost::thread* pThreadDbAcc;
 
     CMthQueue<CDNSeedNode*> tDbMsgQueue;
     CDbcDbConnect* pDbConn;
-    CBbAddrPool* pAddrPool;
+    CDbcLogDbConnect* pLogConn; /*pDbConn when it is the log store, which takes rows instead of SQL*/
+    CDbcStatement* pStmtCache[DDN_E_STMT_TYPE_MAX][DDN_D_STMT_SIZE_CLASS];
 
-    uint32 nCfgStatTimeLen;
-    bool fCfgShowStat;
+    map<pair<string, uint16>, CDNSeedPendingNode> mapPendingNode;
+    time_t tmPrevFlushTime;
+
+    /*journal messages posted to and written by this writer*/
+    boost::mutex lockSeq;
+    uint64 nPostSeq;
+    uint64 nDoneSeq;
+    uint64 nTakenSeq;
 
     time_t tmPrevTimerTime;
     time_t tmPrevStatTime;
@@ -107,6 +209,76 @@ private:
     uint64 nPrevInsertCount;
     uint64 nPrevDeleteCount;
     uint64 nPrevUpdateCount;
+    uint64 nSqlCount;
+    uint64 nPrevSqlCount;
+    uint64 nMergeInCount;
+    uint64 nMergeOutCount;
+    uint64 nDropCount;
+
+    int iDbCommitCount;
+    CDbStatData tStatData;
+    boost::mutex lockStat;
+};
+
+class CDbStorage
+{
+    friend class CDbStorageWriter;
+
+public:
+    CDbStorage();
+    CDbStorage(CDbcConfig* pDbCfg, CBbAddrPool* pPool);
+    ~CDbStorage();
+
+    void SetDbConfig(CDbcConfig* pDbCfg);
+    void SetBbAddrPool(CBbAddrPool* pPool);
+
+    bool Start();
+    void Stop();
+
+    bool PurgeData();
+    /* Returns false when the message is not taken, the caller still owns it */
+    bool PostDbMessage(CDNSeedNode* pMsg);
+    bool ReqFetchAddr();
+    uint32 GetMsgQueueSize();
+    void StatDbData(CDbStatData& tData);
+
+    void SetStatParam(bool fShowStatIn, uint32 nStatTimeIn);
+    void SetBatchParam(uint32 nBatchCountIn, uint32 nFlushTimeIn);
+    void SetFetchParam(uint32 nFetchCountIn);
+    void SetWriterParam(uint32 nWriterCountIn);
+    bool SetJournalParam(const string& strJournalPath);
+
+private:
+    void CreateWriters(uint32 nWriterCount);
+    void ReleaseWriters();
+    CDbStorageWriter* GetWriter(CDNSeedNode* pMsg);
+
+    void JournalWork();
+    bool DispatchJournal();
+    uint64 GetJournalCheckpoint();
+
+    bool CreateTables();
+    bool MigrateUniqueKey();
+
+private:
+    bool fRunFlag;
+    CDbcConfig tDbCfg;
+    CDbcDbConnect* pDbConn;
+    CBbAddrPool* pAddrPool;
+    vector<CDbStorageWriter*> vWriter;
+
+    CDbJournal tJournal;
+    boost::thread* pThreadJournal;
+    CDNSeedNode* pJournalNode;
+    boost::mutex lockDispatch;
+    uint64 nDispatchSeq;
+    uint64 nJournalPeak;
+
+    uint32 nCfgStatTimeLen;
+    bool fCfgShowStat;
+    uint32 nCfgBatchCount;
+    uint32 nCfgFlushTime;
+    uint32 nCfgFetchCount;
 };
 
 } //namespace dnseed
@@ -16,6 +16,8 @@ CDispatcher::CDispatcher()
     pDbStorage = NULL;
     pBbAddrPool = NULL;
     tmPrevStatTime = 0;
+    tmPrevScoreFlushTime = 0;
+    tmPrevDbStatTime = 0;
 }
 
 CDispatcher::~CDispatcher()
@@ -56,8 +58,18 @@ bool CDispatcher::Initialize(CDnseedConfig* pCfg)
     pBbAddrPool->SetTrustAddr(pCfg->setTrustAddr);
 
     pDbStorage->SetStatParam(pCfg->fShowDbStatData, pCfg->nShowDbStatTime);
+    pDbStorage->SetBatchParam(pCfg->nDbBatchCount, pCfg->nDbFlushTime);
+    pDbStorage->SetFetchParam(pCfg->nDbFetchCount);
+    pDbStorage->SetWriterParam(pCfg->nDbWriterCount);
+    if (pCfg->fDbJournal && !pDbStorage->SetJournalParam((pCfg->pathData / "journal").string()))
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "Open db journal fail.");
+        return false;
+    }
 
     tmPrevStatTime = time(NULL);
+    tmPrevScoreFlushTime = tmPrevStatTime;
+    tmPrevDbStatTime = tmPrevStatTime;
 
     return true;
 }
@@ -142,6 +154,11 @@ void CDispatcher::StopService()
     {
         pNetWorkService->StopService();
     }
+    if (pBbAddrPool)
+    {
+        uint32 nDirtyCount = 0;
+        pBbAddrPool->FlushScore(true, nDirtyCount);
+    }
     if (pDbStorage)
     {
         pDbStorage->Stop();
@@ -151,6 +168,11 @@ void CDispatcher::StopService()
 void CDispatcher::Timer()
 {
     time_t tmCurTime = time(NULL);
+    if (pWorkThreadPool)
+    {
+        pWorkThreadPool->AdjustTestRate();
+    }
+
     if (tmCurTime < tmPrevStatTime || tmCurTime - tmPrevStatTime >= pDnseedCfg->nShowRunStatTime)
     {
         tmPrevStatTime = tmCurTime;
@@ -159,11 +181,15 @@ void CDispatcher::Timer()
         {
             CRunStatData tStatData;
             pWorkThreadPool->StatRunData(tStatData);
+            if (pBbAddrPool)
+            {
+                tStatData.nGoodAddrCount = pBbAddrPool->GetGoodAddrCount();
+            }
 
             if (pDnseedCfg->fShowRunStatData)
             {
                 char sTempBuf[512] = { 0 };
-                sprintf(sTempBuf, "Session:%d {In:%d Out:%d}, Total: {In:%ld-%ld (S:%ld-%ld F:%ld-%ld), Out:%ld-%ld (S:%ld-%ld F:%ld-%ld)}",
+                sprintf(sTempBuf, "Session:%d {In:%d Out:%d}, Total: {In:%ld-%ld (S:%ld-%ld F:%ld-%ld), Out:%ld-%ld (S:%ld-%ld F:%ld-%ld)}, Probe: %ld-%ld (target %u, dup %ld-%ld), Good: %u (%+d), Kept: %u (pong %ld-%ld)",
                         tStatData.nTcpConnCount, tStatData.nInBoundCount, tStatData.nOutBoundCount,
                         tStatData.nTotalInCount, (tStatData.nTotalInCount - tPrevStatData.nTotalInCount) / pDnseedCfg->nShowRunStatTime,
                         tStatData.nTotalInWorkSuccessCount, (tStatData.nTotalInWorkSuccessCount - tPrevStatData.nTotalInWorkSuccessCount) / pDnseedCfg->nShowRunStatTime,
@@ -171,13 +197,79 @@ void CDispatcher::Timer()
                         tStatData.nTotalOutCount, (tStatData.nTotalOutCount - tPrevStatData.nTotalOutCount) / pDnseedCfg->nShowRunStatTime,
                         tStatData.nTotalOutWorkSuccessCount, (tStatData.nTotalOutWorkSuccessCount - tPrevStatData.nTotalOutWorkSuccessCount) / pDnseedCfg->nShowRunStatTime,
                         tStatData.nTotalOutFailCount + tStatData.nTotalOutWorkFailCount,
-                        ((tStatData.nTotalOutFailCount + tStatData.nTotalOutWorkFailCount) - (tPrevStatData.nTotalOutFailCount + tPrevStatData.nTotalOutWorkFailCount)) / pDnseedCfg->nShowRunStatTime);
+                        ((tStatData.nTotalOutFailCount + tStatData.nTotalOutWorkFailCount) - (tPrevStatData.nTotalOutFailCount + tPrevStatData.nTotalOutWorkFailCount)) / pDnseedCfg->nShowRunStatTime,
+                        tStatData.nTotalProbeCount, (tStatData.nTotalProbeCount - tPrevStatData.nTotalProbeCount) / pDnseedCfg->nShowRunStatTime,
+                        tStatData.nTestRate,
+                        tStatData.nTotalDupProbeCount, (tStatData.nTotalDupProbeCount - tPrevStatData.nTotalDupProbeCount) / pDnseedCfg->nShowRunStatTime,
+                        tStatData.nGoodAddrCount, (int)(tStatData.nGoodAddrCount - tPrevStatData.nGoodAddrCount),
+                        tStatData.nSessionCount, tStatData.nTotalPongCount, (tStatData.nTotalPongCount - tPrevStatData.nTotalPongCount) / pDnseedCfg->nShowRunStatTime);
                 blockhead::StdLog("STAT", sTempBuf);
+
+                vector<CNetThreadStat> vNetStat;
+                pNetWorkService->StatNetThread(vNetStat);
+                sprintf(sTempBuf, "fd: %u/%u, net thread tcp/open/closing:", CNetWorkService::GetOpenFdCount(), pWorkThreadPool->GetFdLimit());
+                string strNetStat(sTempBuf);
+                for (size_t i = 0; i < vNetStat.size(); i++)
+                {
+                    sprintf(sTempBuf, " %u/%u/%u", vNetStat[i].nTcpConnectCount, vNetStat[i].nOpenSocketCount, vNetStat[i].nClosingCount);
+                    strNetStat += sTempBuf;
+                }
+                blockhead::StdLog("STAT", "%s", strNetStat.c_str());
             }
 
             tPrevStatData = tStatData;
         }
     }
+
+    if (tmCurTime < tmPrevScoreFlushTime || tmCurTime - tmPrevScoreFlushTime >= pDnseedCfg->nScoreFlushTime)
+    {
+        tmPrevScoreFlushTime = tmCurTime;
+
+        if (pBbAddrPool)
+        {
+            uint32 nDirtyCount = 0;
+            uint32 nFlushCount = pBbAddrPool->FlushScore(false, nDirtyCount);
+            if (pDnseedCfg->fShowDbStatData)
+            {
+                char sTempBuf[128] = { 0 };
+                sprintf(sTempBuf, "score flush: %u, dirty: %u", nFlushCount, nDirtyCount);
+                blockhead::StdLog("STAT", sTempBuf);
+            }
+        }
+    }
+
+    if (tmCurTime < tmPrevDbStatTime || tmCurTime - tmPrevDbStatTime >= pDnseedCfg->nShowDbStatTime)
+    {
+        tmPrevDbStatTime = tmCurTime;
+
+        if (pDbStorage)
+        {
+            CDbStatData tDbStat;
+            pDbStorage->StatDbData(tDbStat);
+
+            if (pDnseedCfg->fShowDbStatData)
+            {
+                const char* pTypeName[DDN_E_STMT_TYPE_MAX] = { "Insert", "Update", "Delete" };
+                char sTempBuf[512] = { 0 };
+                int nLen = sprintf(sTempBuf, "Db latency(us) p50/p99/max(count):");
+                for (int i = 0; i < DDN_E_STMT_TYPE_MAX; i++)
+                {
+                    CDbLatencyStat& t = tDbStat.tExecTime[i];
+                    nLen += sprintf(sTempBuf + nLen, " %s: %lu/%lu/%lu(%lu),", pTypeName[i],
+                                    t.GetPercentile(50), t.GetPercentile(99), t.nMaxTime, t.nCount);
+                }
+                sprintf(sTempBuf + nLen, " Fetch: %lu/%lu/%lu(%lu), Commit: %lu/%lu/%lu(%lu)",
+                        tDbStat.tFetchTime.GetPercentile(50), tDbStat.tFetchTime.GetPercentile(99), tDbStat.tFetchTime.nMaxTime, tDbStat.tFetchTime.nCount,
+                        tDbStat.tCommitTime.GetPercentile(50), tDbStat.tCommitTime.GetPercentile(99), tDbStat.tCommitTime.nMaxTime, tDbStat.tCommitTime.nCount);
+                blockhead::StdLog("STAT", sTempBuf);
+
+                sprintf(sTempBuf, "Db txn: %lu, rows avg/max: %.1f/%lu, queue peak: %u, journal peak: %lu, commit count changes: %u",
+                        tDbStat.nTxnCount, (tDbStat.nTxnCount ? (double)tDbStat.nTxnRowCount / tDbStat.nTxnCount : 0.0),
+                        tDbStat.nTxnMaxRowCount, tDbStat.nQueuePeak, tDbStat.nJournalPeak, tDbStat.nCommitCountChange);
+                blockhead::StdLog("STAT", sTempBuf);
+            }
+        }
+    }
 }
 
 } // namespace dnseed
@@ -41,6 +41,8 @@ private:
 
     CRunStatData tPrevStatData;
     time_t tmPrevStatTime;
+    time_t tmPrevScoreFlushTime;
+    time_t tmPrevDbStatTime;
 };
 
 } //namespace dnseed
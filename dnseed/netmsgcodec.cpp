@@ -0,0 +1,109 @@
+// Copyright (c) 2019 The BigDNSeed developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netmsgcodec.h"
+
+namespace dnseed
+{
+
+//-----------------------------------------------------------------------------------------------
+bool CProtoMsgDecoder::ReadRaw(void* pOut, uint32 nSize)
+{
+    if (!fValid || nPayloadLen - nReadPos < nSize)
+    {
+        fValid = false;
+        return false;
+    }
+    if (nSize > 0)
+    {
+        memcpy(pOut, pPayload + nReadPos, nSize);
+        nReadPos += nSize;
+    }
+    return true;
+}
+
+bool CProtoMsgDecoder::ReadVarInt(uint64& nValue)
+{
+    uint8 chSize = 0;
+    if (!ReadRaw(&chSize, 1))
+    {
+        return false;
+    }
+    nValue = 0;
+    if (chSize < 0xFD)
+    {
+        nValue = chSize;
+        return true;
+    }
+    return ReadRaw(&nValue, (2 << (chSize - 0xFD)));
+}
+
+bool CProtoMsgDecoder::ReadRecords(uint32 nRecordSize, uint32& nCount, const unsigned char*& pRecord)
+{
+    uint64 nValue = 0;
+    if (!ReadVarInt(nValue))
+    {
+        return false;
+    }
+    if (nValue > GetRemainSize() / nRecordSize)
+    {
+        fValid = false;
+        return false;
+    }
+    nCount = (uint32)nValue;
+    pRecord = pPayload + nReadPos;
+    nReadPos += nCount * nRecordSize;
+    return true;
+}
+
+void CProtoMsgDecoder::Decode(string& s, ObjectType&)
+{
+    uint64 nSize = 0;
+    if (!ReadVarInt(nSize))
+    {
+        return;
+    }
+    if (nSize > GetRemainSize())
+    {
+        fValid = false;
+        return;
+    }
+    s.assign((const char*)pPayload + nReadPos, nSize);
+    nReadPos += nSize;
+}
+
+void CProtoMsgDecoder::Decode(uint256& h, ObjectType&)
+{
+    ReadRaw(h.begin(), h.size());
+}
+
+void CProtoMsgDecoder::Decode(CAddress& addr, ObjectType&)
+{
+    unsigned char ssEndpoint[CEndpoint::BINSIZE];
+    if (ReadRaw(&addr.nService, sizeof(addr.nService)) && ReadRaw(ssEndpoint, CEndpoint::BINSIZE))
+    {
+        addr.ssEndpoint.CopyFrom(ssEndpoint);
+    }
+}
+
+void CProtoMsgDecoder::Decode(vector<CAddress>& vAddr, ObjectType&)
+{
+    uint64 nCount = 0;
+    if (!ReadVarInt(nCount))
+    {
+        return;
+    }
+    if (nCount > GetRemainSize() / (sizeof(uint64) + CEndpoint::BINSIZE))
+    {
+        fValid = false;
+        return;
+    }
+    vAddr.resize(nCount);
+    for (uint64 i = 0; i < nCount && fValid; i++)
+    {
+        Decode(vAddr[i], ObjectType());
+    }
+}
+
+} // namespace dnseed
@@ -0,0 +1,359 @@
+// Copyright (c) 2019 The BigDNSeed developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef __DNSEED_NETMSGCODEC_H
+#define __DNSEED_NETMSGCODEC_H
+
+#include <iostream>
+
+#include "blockhead/stream/stream.h"
+#include "blockhead/type.h"
+#include "blockhead/util.h"
+#include "netproto.h"
+
+namespace dnseed
+{
+
+using namespace std;
+using namespace blockhead;
+
+//---------------------------------------------------------------------------------
+// Payload encoder, appends the message fields to a stream.
+class CProtoMsgEncoder
+{
+public:
+    CProtoMsgEncoder(CBlockheadStream& ssPayloadIn)
+      : ssPayload(ssPayloadIn) {}
+
+    template <typename T>
+    CProtoMsgEncoder& operator()(T& t)
+    {
+        ssPayload << t;
+        return *this;
+    }
+
+    template <typename T>
+    CProtoMsgEncoder& Optional(T& t, bool& fPresent)
+    {
+        if (fPresent)
+        {
+            ssPayload << t;
+        }
+        return *this;
+    }
+
+private:
+    CBlockheadStream& ssPayload;
+};
+
+// Payload decoder, reads the message fields in place from the packet buffer.
+// Fixed-size fields are copied straight out of the buffer, nothing is allocated.
+class CProtoMsgDecoder
+{
+public:
+    CProtoMsgDecoder(const unsigned char* pPayloadIn, uint32 nPayloadLenIn)
+      : pPayload(pPayloadIn), nPayloadLen(nPayloadLenIn), nReadPos(0), fValid(true) {}
+
+    template <typename T>
+    CProtoMsgDecoder& operator()(T& t)
+    {
+        Decode(t, boost::is_fundamental<T>());
+        return *this;
+    }
+
+    template <typename T>
+    CProtoMsgDecoder& Optional(T& t, bool& fPresent)
+    {
+        fPresent = (fValid && nReadPos < nPayloadLen);
+        if (fPresent)
+        {
+            Decode(t, boost::is_fundamental<T>());
+        }
+        return *this;
+    }
+
+    bool IsValid() const
+    {
+        return fValid;
+    }
+    uint32 GetRemainSize() const
+    {
+        return (fValid ? nPayloadLen - nReadPos : 0);
+    }
+
+    bool ReadRaw(void* pOut, uint32 nSize);
+    bool ReadVarInt(uint64& nValue);
+    bool ReadRecords(uint32 nRecordSize, uint32& nCount, const unsigned char*& pRecord);
+
+protected:
+    template <typename T>
+    void Decode(T& t, BasicType&)
+    {
+        ReadRaw(&t, sizeof(t));
+    }
+    void Decode(string& s, ObjectType&);
+    void Decode(uint256& h, ObjectType&);
+    void Decode(CAddress& addr, ObjectType&);
+    void Decode(vector<CAddress>& vAddr, ObjectType&);
+
+private:
+    const unsigned char* pPayload;
+    uint32 nPayloadLen;
+    uint32 nReadPos;
+    bool fValid;
+};
+
+//---------------------------------------------------------------------------------
+// Message schema, one class per command. Codec() lists the fields in wire order
+// and is shared by encoding and decoding.
+class CMsgHello
+{
+public:
+    enum
+    {
+        COMMAND = BBPROTO_CMD_HELLO
+    };
+    static const char* Name()
+    {
+        return "BBPROTO_CMD_HELLO";
+    }
+
+    CMsgHello()
+      : nVersion(0), nService(0), nTime(0), nNonce(0), nStartingHeight(0), fHasGenesisBlock(false) {}
+
+    template <typename C>
+    void Codec(C& c)
+    {
+        c(nVersion)(nService)(nTime)(nNonce)(strSubVer)(nStartingHeight).Optional(hashGenesisBlock, fHasGenesisBlock);
+    }
+
+public:
+    int nVersion;
+    uint64 nService;
+    int64 nTime;
+    uint64 nNonce;
+    string strSubVer;
+    int nStartingHeight;
+    uint256 hashGenesisBlock;
+    bool fHasGenesisBlock;
+};
+
+template <int N>
+class CMsgEmpty
+{
+public:
+    enum
+    {
+        COMMAND = N
+    };
+
+    template <typename C>
+    void Codec(C&)
+    {
+    }
+};
+
+class CMsgHelloAck : public CMsgEmpty<BBPROTO_CMD_HELLO_ACK>
+{
+public:
+    static const char* Name()
+    {
+        return "BBPROTO_CMD_HELLO_ACK";
+    }
+};
+
+class CMsgGetAddress : public CMsgEmpty<BBPROTO_CMD_GETADDRESS>
+{
+public:
+    static const char* Name()
+    {
+        return "BBPROTO_CMD_GETADDRESS";
+    }
+};
+
+class CMsgAddress
+{
+public:
+    enum
+    {
+        COMMAND = BBPROTO_CMD_ADDRESS
+    };
+    static const char* Name()
+    {
+        return "BBPROTO_CMD_ADDRESS";
+    }
+
+    template <typename C>
+    void Codec(C& c)
+    {
+        c(vAddrList);
+    }
+
+public:
+    vector<CAddress> vAddrList;
+};
+
+// Zero-copy view of a received ADDRESS payload. Decoding only checks the record
+// count against the remaining payload bytes, records are read one at a time.
+class CMsgAddressView
+{
+public:
+    enum
+    {
+        COMMAND = BBPROTO_CMD_ADDRESS,
+        RECORD_SIZE = sizeof(uint64) + CEndpoint::BINSIZE
+    };
+    static const char* Name()
+    {
+        return "BBPROTO_CMD_ADDRESS";
+    }
+
+    CMsgAddressView()
+      : nCount(0), pRecord(NULL) {}
+
+    void Codec(CProtoMsgDecoder& c)
+    {
+        c.ReadRecords(RECORD_SIZE, nCount, pRecord);
+    }
+
+    uint32 GetCount() const
+    {
+        return nCount;
+    }
+    void GetAddress(uint32 nIndex, CAddress& addr) const
+    {
+        const unsigned char* p = pRecord + nIndex * RECORD_SIZE;
+        memcpy(&addr.nService, p, sizeof(addr.nService));
+        addr.ssEndpoint.CopyFrom(p + sizeof(addr.nService));
+    }
+
+private:
+    uint32 nCount;
+    const unsigned char* pRecord;
+};
+
+template <int N>
+class CMsgNonce
+{
+public:
+    enum
+    {
+        COMMAND = N
+    };
+
+    CMsgNonce()
+      : nNonce(0) {}
+
+    template <typename C>
+    void Codec(C& c)
+    {
+        c(nNonce);
+    }
+
+public:
+    uint64 nNonce;
+};
+
+class CMsgPing : public CMsgNonce<BBPROTO_CMD_PING>
+{
+public:
+    static const char* Name()
+    {
+        return "BBPROTO_CMD_PING";
+    }
+};
+
+class CMsgPong : public CMsgNonce<BBPROTO_CMD_PONG>
+{
+public:
+    static const char* Name()
+    {
+        return "BBPROTO_CMD_PONG";
+    }
+};
+
+//---------------------------------------------------------------------------------
+template <typename M>
+void ProtoMsgEncode(M& tMsg, CBlockheadStream& ssPayload)
+{
+    CProtoMsgEncoder tEncoder(ssPayload);
+    tMsg.Codec(tEncoder);
+}
+
+template <typename M>
+bool ProtoMsgDecode(const unsigned char* pPayload, uint32 nPayloadLen, M& tMsg)
+{
+    CProtoMsgDecoder tDecoder(pPayload, nPayloadLen);
+    tMsg.Codec(tDecoder);
+    return tDecoder.IsValid();
+}
+
+//---------------------------------------------------------------------------------
+// Static dispatch table. Each peer class defines one CProtoMsgEntry array with
+// BBPROTO_MSG_ENTRY, the entry decodes the payload and calls the typed handler.
+template <typename P>
+struct CProtoMsgEntry
+{
+    int nCommand;
+    const char* pName;
+    bool (*pfnDispatch)(P* pPeer, const unsigned char* pPayload, uint32 nPayloadLen);
+};
+
+template <typename P, typename M, bool (P::*Handler)(M&)>
+bool ProtoMsgDispatch(P* pPeer, const unsigned char* pPayload, uint32 nPayloadLen)
+{
+    M tMsg;
+    if (!ProtoMsgDecode(pPayload, nPayloadLen, tMsg))
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "Decode payload fail.");
+        return false;
+    }
+    return (pPeer->*Handler)(tMsg);
+}
+
+#define BBPROTO_MSG_ENTRY(P, M, fn)          \
+    {                                        \
+        M::COMMAND, M::Name(),               \
+            &ProtoMsgDispatch<P, M, &P::fn>  \
+    }
+
+template <typename P, size_t N>
+bool ProtoMsgDoPacket(const CProtoMsgEntry<P> (&vMsgTable)[N], P* pPeer, CProtoDataBuf& tPacketBuf)
+{
+    int nCommand = tPacketBuf.GetCommand();
+    for (size_t i = 0; i < N; i++)
+    {
+        if (vMsgTable[i].nCommand == nCommand)
+        {
+            if (STD_DEBUG)
+            {
+                string sInfo = string("Recv msg: ") + vMsgTable[i].pName;
+                blockhead::StdDebug("CFLOW", sInfo.c_str());
+            }
+
+            uint32 nPayloadLen = 0;
+            unsigned char* pPayload = tPacketBuf.GetPayload(nPayloadLen);
+            if (pPayload == NULL)
+            {
+                blockhead::StdError(__PRETTY_FUNCTION__, "GetPayload fail.");
+                return false;
+            }
+            try
+            {
+                return vMsgTable[i].pfnDispatch(pPeer, pPayload, nPayloadLen);
+            }
+            catch (exception& e)
+            {
+                blockhead::StdError(__PRETTY_FUNCTION__, e.what());
+                return false;
+            }
+        }
+    }
+    blockhead::StdError(__PRETTY_FUNCTION__, "Error message.");
+    return true;
+}
+
+} // namespace dnseed
+
+#endif //__DNSEED_NETMSGCODEC_H
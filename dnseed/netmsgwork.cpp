@@ -4,13 +4,207 @@
 
 #include "netmsgwork.h"
 
+#include <sys/resource.h>
+
 namespace dnseed
 {
 
+//---------------------------------------------------------------------------
+CConnectPacer::CConnectPacer(uint32 nRateIn, uint32 nBurstIn)
+  : nRate(nRateIn), nBurst(nBurstIn), nTokenMicro(0)
+{
+    nPrevRefillTime = GetTimeMicros();
+}
+
+// Returns the tokens taken, at most nWant, without waiting for more
+uint32 CConnectPacer::Take(uint32 nWant)
+{
+    boost::unique_lock<boost::mutex> lock(lockPacer);
+    Refill();
+    uint32 nTake = min((uint64)nWant, nTokenMicro / 1000000);
+    nTokenMicro -= (uint64)nTake * 1000000;
+    return nTake;
+}
+
+// Gives back tokens that were taken but not used
+void CConnectPacer::Refund(uint32 nCount)
+{
+    boost::unique_lock<boost::mutex> lock(lockPacer);
+    nTokenMicro = min(nTokenMicro + (uint64)nCount * 1000000, (uint64)nBurst * 1000000);
+}
+
+void CConnectPacer::SetRate(uint32 nRateIn, uint32 nBurstIn)
+{
+    boost::unique_lock<boost::mutex> lock(lockPacer);
+    Refill();
+    nRate = nRateIn;
+    nBurst = nBurstIn;
+    nTokenMicro = min(nTokenMicro, (uint64)nBurst * 1000000);
+}
+
+uint32 CConnectPacer::GetRate()
+{
+    boost::unique_lock<boost::mutex> lock(lockPacer);
+    return nRate;
+}
+
+void CConnectPacer::Refill()
+{
+    int64 nCurTime = GetTimeMicros();
+    if (nCurTime > nPrevRefillTime)
+    {
+        nTokenMicro = min(nTokenMicro + (uint64)(nCurTime - nPrevRefillTime) * nRate, (uint64)nBurst * 1000000);
+    }
+    nPrevRefillTime = nCurTime;
+}
+
+//---------------------------------------------------------------------------
+CProbeEndpointSet::CProbeEndpointSet()
+{
+    pBucket = new CBucket[NMS_D_PROBE_SET_BUCKET_COUNT];
+    for (uint32 i = 0; i < NMS_D_PROBE_SET_BUCKET_COUNT; i++)
+    {
+        pBucket[i].nVersion.store(0);
+        for (uint32 j = 0; j < NMS_D_PROBE_SET_BUCKET_SIZE; j++)
+        {
+            pBucket[i].nSlotKey[j].store(0);
+            pBucket[i].nSlotTime[j].store(NMS_D_PROBE_TIME_FREE);
+        }
+    }
+}
+
+CProbeEndpointSet::~CProbeEndpointSet()
+{
+    delete[] pBucket;
+}
+
+// Reports a duplicate when the endpoint is already in flight, including a
+// claim not committed yet. If its bucket is full or the claim keeps losing
+// to other adds it is tested untracked and gets no token.
+NMS_E_PROBE_ADD CProbeEndpointSet::Add(CMthNetEndpoint& ep, uint64& nTokenOut)
+{
+    nTokenOut = 0;
+    uint64 nKey = GetKey(ep);
+    uint32 nBucket = GetBucketIndex(nKey);
+    CBucket& tBucket = pBucket[nBucket];
+    uint32 nCurTime = (uint32)GetTime();
+    for (uint32 nTry = 0; nTry < NMS_D_PROBE_SET_MAX_RETRY; nTry++)
+    {
+        uint64 nVersion = tBucket.nVersion.load();
+        int nFree = -1;
+        for (uint32 i = 0; i < NMS_D_PROBE_SET_BUCKET_SIZE; i++)
+        {
+            uint64 nSlotKey = tBucket.nSlotKey[i].load();
+            if (nSlotKey == nKey)
+            {
+                uint32 nAddTime = tBucket.nSlotTime[i].load();
+                if (nAddTime == NMS_D_PROBE_TIME_FREE)
+                {
+                    /*being freed, the endpoint is no longer in flight*/
+                    continue;
+                }
+                if (nAddTime == NMS_D_PROBE_TIME_CLAIM || !IsStale(nAddTime, nCurTime)
+                    || !tBucket.nSlotTime[i].compare_exchange_strong(nAddTime, nCurTime))
+                {
+                    return NMS_E_PROBE_ADD_DUPLICATE;
+                }
+                nTokenOut = MakeToken(nBucket, i, nCurTime);
+                return NMS_E_PROBE_ADD_TRACKED;
+            }
+            if (nSlotKey == 0 && nFree < 0)
+            {
+                nFree = i;
+            }
+        }
+        if (nFree < 0)
+        {
+            return NMS_E_PROBE_ADD_UNTRACKED;
+        }
+        uint64 nFreeKey = 0;
+        if (!tBucket.nSlotKey[nFree].compare_exchange_strong(nFreeKey, nKey))
+        {
+            continue;
+        }
+        tBucket.nSlotTime[nFree].store(NMS_D_PROBE_TIME_CLAIM);
+        if (tBucket.nVersion.compare_exchange_strong(nVersion, nVersion + 1))
+        {
+            tBucket.nSlotTime[nFree].store(nCurTime);
+            nTokenOut = MakeToken(nBucket, nFree, nCurTime);
+            return NMS_E_PROBE_ADD_TRACKED;
+        }
+        tBucket.nSlotTime[nFree].store(NMS_D_PROBE_TIME_FREE);
+        tBucket.nSlotKey[nFree].store(0);
+    }
+    return NMS_E_PROBE_ADD_UNTRACKED;
+}
+
+// The slot is freed only if it still holds the endpoint with the add time of
+// the token, a takeover gave it a new add time.
+void CProbeEndpointSet::Remove(CMthNetEndpoint& ep, uint64 nToken)
+{
+    uint32 nIndex = (uint32)nToken;
+    uint32 nAddTime = (uint32)(nToken >> 32);
+    if (nToken == 0 || nIndex >= NMS_D_PROBE_SET_BUCKET_COUNT * NMS_D_PROBE_SET_BUCKET_SIZE)
+    {
+        return;
+    }
+    CBucket& tBucket = pBucket[nIndex / NMS_D_PROBE_SET_BUCKET_SIZE];
+    uint32 nSlot = nIndex % NMS_D_PROBE_SET_BUCKET_SIZE;
+    if (tBucket.nSlotKey[nSlot].load() == GetKey(ep)
+        && tBucket.nSlotTime[nSlot].compare_exchange_strong(nAddTime, NMS_D_PROBE_TIME_FREE))
+    {
+        tBucket.nSlotKey[nSlot].store(0);
+    }
+}
+
+uint32 CProbeEndpointSet::GetBucketIndex(uint64 nKey)
+{
+    return (uint32)((nKey * 0x9E3779B97F4A7C15ULL) >> 32) & (NMS_D_PROBE_SET_BUCKET_COUNT - 1);
+}
+
+// The add time is never CLAIM or FREE, so a token is never 0
+uint64 CProbeEndpointSet::MakeToken(uint32 nBucket, uint32 nSlot, uint32 nAddTime)
+{
+    return ((uint64)nAddTime << 32) | (nBucket * NMS_D_PROBE_SET_BUCKET_SIZE + nSlot);
+}
+
+// An ipv4 endpoint is packed as flag, address and port, an ipv6 one is
+// hashed with the top bit set. Neither is ever 0, which marks a free slot.
+uint64 CProbeEndpointSet::GetKey(CMthNetEndpoint& ep)
+{
+    tcp::endpoint tEp;
+    if (!ep.GetEndpoint(tEp))
+    {
+        return 1;
+    }
+    if (tEp.address().is_v4())
+    {
+        return (1ULL << 48) | ((uint64)tEp.address().to_v4().to_ulong() << 16) | tEp.port();
+    }
+    boost::asio::ip::address_v6::bytes_type tBytes = tEp.address().to_v6().to_bytes();
+    uint64 nHash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < tBytes.size(); i++)
+    {
+        nHash = (nHash ^ tBytes[i]) * 0x100000001B3ULL;
+    }
+    nHash = (nHash ^ tEp.port()) * 0x100000001B3ULL;
+    return nHash | (1ULL << 63);
+}
+
+// An entry whose close was never seen is taken over after a while
+bool CProbeEndpointSet::IsStale(uint32 nAddTime, uint32 nCurTime)
+{
+    return (nCurTime < nAddTime || nCurTime - nAddTime > NMS_D_PROBE_MAX_TIME);
+}
+
 //---------------------------------------------------------------------------
 CWorkThreadPool::CWorkThreadPool(CDnseedConfig* pCfg, CNetWorkService* nws, CBbAddrPool* pBbAddrPoolIn)
-  : pDNSeedCfg(pCfg), pNetWorkService(nws), pBbAddrPool(pBbAddrPoolIn)
+  : tConnectPacer(pCfg->nTestRateMax, pCfg->nBackTestBurst), pDNSeedCfg(pCfg), pNetWorkService(nws), pBbAddrPool(pBbAddrPoolIn)
 {
+    nTestRate = pCfg->nBackTestMinCount;
+    nLocalFailBaseline = -1;
+    tConnectPacer.SetRate(nTestRate, max((uint32)((uint64)pCfg->nBackTestBurst * nTestRate / pCfg->nTestRateMax), (uint32)1));
+
     nWorkThreadCount = pNetWorkService->GetWorkThreadCount();
     if (nWorkThreadCount > MAX_NET_WORK_THREAD_COUNT)
     {
@@ -19,7 +213,7 @@ CWorkThreadPool::CWorkThreadPool(CDnseedConfig* pCfg, CNetWorkService* nws, CBbA
 
     for (uint32 i = 0; i < nWorkThreadCount; i++)
     {
-        pWorkThreadTable[i] = new CMsgWorkThread(nWorkThreadCount, i, pCfg, nws, pBbAddrPoolIn);
+        pWorkThreadTable[i] = new CMsgWorkThread(nWorkThreadCount, i, pCfg, nws, pBbAddrPoolIn, &tConnectPacer, &tProbeSet);
     }
 }
 
@@ -67,39 +261,93 @@ bool CWorkThreadPool::StatRunData(CRunStatData& tStatData)
             tStatData += tTempStat;
         }
     }
+    tStatData.nTestRate = tConnectPacer.GetRate();
 
     return true;
 }
 
-//-----------------------------------------------------------------------------------------------
-CMsgWorkThread::CMsgWorkThread(uint32 nThreadCount, uint32 nThreadIndex, CDnseedConfig* pCfg, CNetWorkService* nws, CBbAddrPool* pBbAddrPoolIn)
-  : nWorkThreadCount(nThreadCount), nWorkThreadIndex(nThreadIndex), pDNSeedCfg(pCfg), pNetWorkService(nws), pBbAddrPool(pBbAddrPoolIn),
-    pThreadMsgWork(NULL), pNetDataQueue(NULL), fRunFlag(false), tmPrevTimerDoTime(0)
+// Called once a second. The test rate grows by a step while sockets are
+// available, and is halved when the open sockets near the file descriptor
+// limit or when connects failing on this host rise well above their moving
+// baseline. Refused or unreachable peers do not count, most tested addresses
+// are gone and that says nothing about the load here.
+void CWorkThreadPool::AdjustTestRate()
 {
-    pNetDataQueue = &(nws->GetWorkRecvQueue(nThreadIndex));
+    CRunStatData tStatData;
+    StatRunData(tStatData);
+
+    uint64 nConnectCount = (tStatData.nTotalOutSuccessCount - tPrevRateStat.nTotalOutSuccessCount)
+                           + (tStatData.nTotalOutFailCount - tPrevRateStat.nTotalOutFailCount);
+    uint64 nLocalFailCount = tStatData.nTotalOutLocalFailCount - tPrevRateStat.nTotalOutLocalFailCount;
+    tPrevRateStat = tStatData;
+
+    /*sessions plus connects not completed yet*/
+    uint64 nSocketCount = tStatData.nTcpConnCount;
+    uint64 nDoneCount = tStatData.nTotalOutSuccessCount + tStatData.nTotalOutFailCount;
+    if (tStatData.nTotalProbeCount > nDoneCount)
+    {
+        nSocketCount += tStatData.nTotalProbeCount - nDoneCount;
+    }
 
-    if (nThreadCount > 1)
+    bool fLocalOverload = false;
+    if (nConnectCount >= NMS_ATP_TEST_FAIL_MIN_COUNT)
     {
-        if (pCfg->nBackTestAddrCount < nThreadCount)
-        {
-            nPersCalloutAddrCount = 1;
-        }
-        else
+        int32 nLocalFailRatio = (int32)(nLocalFailCount * 10000 / nConnectCount);
+        if (nLocalFailBaseline < 0)
         {
-            nPersCalloutAddrCount = pCfg->nBackTestAddrCount / nThreadCount;
-            if (nThreadIndex == nThreadCount - 1)
-            {
-                nPersCalloutAddrCount += pCfg->nBackTestAddrCount % nThreadCount;
-            }
+            nLocalFailBaseline = nLocalFailRatio;
         }
+        fLocalOverload = (nLocalFailRatio >= nLocalFailBaseline + NMS_ATP_TEST_FAIL_RISE_PERCENT * 100);
+        nLocalFailBaseline += (nLocalFailRatio - nLocalFailBaseline) / NMS_ATP_TEST_FAIL_BASELINE_TIME;
+    }
+
+    uint32 nMinRate = pDNSeedCfg->nBackTestMinCount;
+    uint32 nMaxRate = pDNSeedCfg->nTestRateMax;
+    uint32 nNewRate = nTestRate;
+    if (nSocketCount * 100 >= (uint64)GetFdLimit() * NMS_ATP_TEST_FD_PERCENT || fLocalOverload)
+    {
+        nNewRate = max(nTestRate / 2, nMinRate);
     }
     else
     {
-        nPersCalloutAddrCount = pCfg->nBackTestAddrCount;
+        nNewRate = min(nTestRate + max((nMaxRate - nMinRate) / NMS_ATP_TEST_RATE_STEP_TIME, (uint32)1), nMaxRate);
+    }
+
+    if (nNewRate != nTestRate)
+    {
+        char sBuf[256] = { 0 };
+        sprintf(sBuf, "Test rate: %u -> %u, sockets: %lu, connect: %lu, local fail: %lu, baseline: %d.%02d%%.",
+                nTestRate, nNewRate, nSocketCount, nConnectCount, nLocalFailCount,
+                max(nLocalFailBaseline, 0) / 100, max(nLocalFailBaseline, 0) % 100);
+        blockhead::StdLog("CWorkThreadPool", sBuf);
+        nTestRate = nNewRate;
+        tConnectPacer.SetRate(nTestRate, max((uint32)((uint64)pDNSeedCfg->nBackTestBurst * nTestRate / nMaxRate), (uint32)1));
+    }
+}
+
+uint32 CWorkThreadPool::GetFdLimit()
+{
+    struct rlimit tLimit;
+    if (getrlimit(RLIMIT_NOFILE, &tLimit) != 0 || tLimit.rlim_cur == RLIM_INFINITY || tLimit.rlim_cur > 0xFFFFFFFF)
+    {
+        return 0xFFFFFFFF;
     }
+    return (uint32)tLimit.rlim_cur;
+}
 
-    nStartBackTestTime = 0;
-    nCompBackTestCount = 0;
+//-----------------------------------------------------------------------------------------------
+CMsgWorkThread::CMsgWorkThread(uint32 nThreadCount, uint32 nThreadIndex, CDnseedConfig* pCfg, CNetWorkService* nws, CBbAddrPool* pBbAddrPoolIn,
+                               CConnectPacer* pConnectPacerIn, CProbeEndpointSet* pProbeSetIn)
+  : fRunFlag(false), pThreadMsgWork(NULL), nWorkThreadCount(nThreadCount), nWorkThreadIndex(nThreadIndex), pDNSeedCfg(pCfg), pNetWorkService(nws),
+    pBbAddrPool(pBbAddrPoolIn), pNetDataQueue(NULL), pConnectPacer(pConnectPacerIn), pProbeSet(pProbeSetIn)
+{
+    pNetDataQueue = &(nws->GetWorkRecvQueue(nThreadIndex));
+
+    /*most tokens taken at once, so every thread gets a share of the burst*/
+    nPersCalloutAddrCount = max(pCfg->nBackTestBurst / max(nThreadCount, (uint32)1), (uint32)1);
+    nMaxSessionCount = (pCfg->nSessionCount + max(nThreadCount, (uint32)1) - 1) / max(nThreadCount, (uint32)1);
+
+    tMsgTemplate.Init(pCfg->nMagicNum, &pBbAddrPoolIn->GetGenesisBlockHash());
 }
 
 CMsgWorkThread::~CMsgWorkThread()
@@ -140,14 +388,12 @@ void CMsgWorkThread::GetNetStatData(CRunStatData& tStatOut)
 //-------------------------------------------------------------------------------
 void CMsgWorkThread::Work()
 {
-    nStartBackTestTime = GetTimeMillis();
-
     while (fRunFlag)
     {
         Timer();
 
         CMthNetPackData* pPackData = NULL;
-        if (!pNetDataQueue->GetData(pPackData, 100) || pPackData == NULL)
+        if (!pNetDataQueue->GetData(pPackData, DNP_D_WHEEL_TICK) || pPackData == NULL)
         {
             continue;
         }
@@ -158,12 +404,7 @@ void CMsgWorkThread::Work()
 
 void CMsgWorkThread::Timer()
 {
-    time_t tmCurTime = time(NULL);
-    if (tmCurTime - tmPrevTimerDoTime >= 1 || tmCurTime < tmPrevTimerDoTime)
-    {
-        tmPrevTimerDoTime = tmCurTime;
-        DoPeerState(tmCurTime);
-    }
+    DoPeerTimeout(GetTimeMillis());
     DoCallConnect();
 }
 
@@ -192,7 +433,7 @@ void CMsgWorkThread::DoPacket(CMthNetPackData* pPackData)
         CNetPeer* pNetPeer = GetNetPeer(pPackData->ui64NetId);
         if (pNetPeer)
         {
-            if (!pNetPeer->DoRecvPacket(pPackData))
+            if (!pNetPeer->DoRecvPacket(pPackData) || pNetPeer->IsDone())
             {
                 ActiveClosePeer(pPackData->ui64NetId);
                 break;
@@ -235,11 +476,16 @@ void CMsgWorkThread::DoPacket(CMthNetPackData* pPackData)
                 string sErrorInfo = string("Connect peer fail, peer: ") + pPackData->epPeerAddr.ToString();
                 blockhead::StdDebug("CFLOW", sErrorInfo.c_str());
             }
+            pProbeSet->Remove(pPackData->epPeerAddr, pPackData->ui64ConnTag);
 
             {
                 boost::unique_lock<boost::shared_mutex> lock(lockStat);
                 tNetStatData.nTotalOutCount++;
                 tNetStatData.nTotalOutFailCount++;
+                if (pPackData->eDisCause == NET_DIS_CAUSE_CONNECT_LOCAL_FAIL)
+                {
+                    tNetStatData.nTotalOutLocalFailCount++;
+                }
             }
             break;
         }
@@ -253,9 +499,11 @@ void CMsgWorkThread::DoPacket(CMthNetPackData* pPackData)
         if (pNetPeer == NULL)
         {
             blockhead::StdError(__PRETTY_FUNCTION__, "DoPacket NET_MSG_TYPE_COMPLETE_NOTIFY AddNetPeer error.");
+            pProbeSet->Remove(pPackData->epPeerAddr, pPackData->ui64ConnTag);
             ActiveClosePeer(pPackData->ui64NetId);
             break;
         }
+        pNetPeer->nProbeToken = pPackData->ui64ConnTag;
         if (!pNetPeer->DoOutBoundConnectSuccess(pPackData->epLocalAddr))
         {
             ActiveClosePeer(pPackData->ui64NetId);
@@ -292,14 +540,15 @@ CNetPeer* CMsgWorkThread::AddNetPeer(bool fInBoundIn, uint64 nPeerNetId, CMthNet
 {
     if (GetNetPeer(nPeerNetId) == NULL)
     {
-        CNetPeer* pNetPeer = new CNetPeer(this, pBbAddrPool, pDNSeedCfg->nMagicNum,
-                                          fInBoundIn, nPeerNetId, tPeerEpIn, tLocalEpIn, pDNSeedCfg->fAllowAllAddr);
-        if (pNetPeer == NULL)
+        void* pMem = tPeerPool.Alloc();
+        if (pMem == NULL)
         {
             blockhead::StdError(__PRETTY_FUNCTION__, "new CNetPeer fail.");
             return NULL;
         }
-        if (mapPeer.insert(make_pair(nPeerNetId, pNetPeer)).second)
+        CNetPeer* pNetPeer = new (pMem) CNetPeer(this, pBbAddrPool, pDNSeedCfg->nMagicNum,
+                                                 fInBoundIn, nPeerNetId, tPeerEpIn, tLocalEpIn, pDNSeedCfg->fAllowAllAddr);
+        if (tPeerTable.Insert(nPeerNetId, pNetPeer))
         {
             boost::unique_lock<boost::shared_mutex> lock(lockStat);
             if (fInBoundIn)
@@ -316,7 +565,8 @@ CNetPeer* CMsgWorkThread::AddNetPeer(bool fInBoundIn, uint64 nPeerNetId, CMthNet
         }
         else
         {
-            blockhead::StdError(__PRETTY_FUNCTION__, "mapPeer insert fail.");
+            blockhead::StdError(__PRETTY_FUNCTION__, "tPeerTable insert fail.");
+            tPeerPool.Free(pNetPeer);
         }
     }
     return NULL;
@@ -324,64 +574,63 @@ CNetPeer* CMsgWorkThread::AddNetPeer(bool fInBoundIn, uint64 nPeerNetId, CMthNet
 
 void CMsgWorkThread::DelNetPeer(uint64 nPeerNetId)
 {
-    map<uint64, CNetPeer*>::iterator it;
-    it = mapPeer.find(nPeerNetId);
-    if (it != mapPeer.end())
+    CNetPeer* pPeer = tPeerTable.Remove(nPeerNetId);
+    if (pPeer)
     {
-        CNetPeer* pPeer = it->second;
-        mapPeer.erase(it);
-        if (pPeer)
+        if (setSessionPeer.erase(nPeerNetId))
+        {
+            pBbAddrPool->SetSession(pPeer->tPeerEp, false);
+            boost::unique_lock<boost::shared_mutex> lock(lockStat);
+            tNetStatData.nSessionCount--;
+        }
+        else if (!pPeer->fInBound)
+        {
+            pProbeSet->Remove(pPeer->tPeerEp, pPeer->nProbeToken);
+        }
         {
+            boost::unique_lock<boost::shared_mutex> lock(lockStat);
+            if (pPeer->fInBound)
+            {
+                tNetStatData.nInBoundCount--;
+                tNetStatData.nTotalInCount++;
+            }
+            else
+            {
+                tNetStatData.nOutBoundCount--;
+                tNetStatData.nTotalOutCount++;
+            }
+            tNetStatData.nTcpConnCount--;
+
+            if (pPeer->fIfDoComplete)
             {
-                boost::unique_lock<boost::shared_mutex> lock(lockStat);
                 if (pPeer->fInBound)
                 {
-                    tNetStatData.nInBoundCount--;
-                    tNetStatData.nTotalInCount++;
+                    tNetStatData.nTotalInWorkSuccessCount++;
                 }
                 else
                 {
-                    tNetStatData.nOutBoundCount--;
-                    tNetStatData.nTotalOutCount++;
+                    tNetStatData.nTotalOutWorkSuccessCount++;
                 }
-                tNetStatData.nTcpConnCount--;
-
-                if (pPeer->fIfDoComplete)
+            }
+            else
+            {
+                if (pPeer->fInBound)
                 {
-                    if (pPeer->fInBound)
-                    {
-                        tNetStatData.nTotalInWorkSuccessCount++;
-                    }
-                    else
-                    {
-                        tNetStatData.nTotalOutWorkSuccessCount++;
-                    }
+                    tNetStatData.nTotalInWorkFailCount++;
                 }
                 else
                 {
-                    if (pPeer->fInBound)
-                    {
-                        tNetStatData.nTotalInWorkFailCount++;
-                    }
-                    else
-                    {
-                        tNetStatData.nTotalOutWorkFailCount++;
-                    }
+                    tNetStatData.nTotalOutWorkFailCount++;
                 }
             }
-            delete pPeer;
         }
+        tPeerPool.Free(pPeer);
     }
 }
 
 CNetPeer* CMsgWorkThread::GetNetPeer(uint64 nPeerNetId)
 {
-    map<uint64, CNetPeer*>::iterator it = mapPeer.find(nPeerNetId);
-    if (it != mapPeer.end())
-    {
-        return it->second;
-    }
-    return NULL;
+    return tPeerTable.Find(nPeerNetId);
 }
 
 void CMsgWorkThread::ActiveClosePeer(uint64 nPeerNetId)
@@ -397,77 +646,137 @@ bool CMsgWorkThread::HandlePeerHandshaked(CNetPeer* pPeer)
     pPeer->tPeerEp.GetEndpoint(ep);
     pBbAddrPool->UpdateNetTime(ep.address(), pPeer->nTimeDelta);
     pBbAddrPool->UpdateHeight(pPeer->tPeerEp, pPeer->nStartingHeight);
+    if (pPeer->nHelloRtt > 0)
+    {
+        pBbAddrPool->UpdateRtt(pPeer->tPeerEp, pPeer->nHelloRtt);
+    }
     return true;
 }
 
-void CMsgWorkThread::DoCallConnect()
+// A finished outbound test of a good address becomes a kept session while the
+// thread has room, or when it scores above the worst session it has.
+bool CMsgWorkThread::KeepSession(CNetPeer* pPeer)
 {
-    int64 nTestTimeLen = GetTimeMillis() - nStartBackTestTime;
-    uint64 nNeedTestCount = nPersCalloutAddrCount * nTestTimeLen / 1000 - nCompBackTestCount;
-    if (nNeedTestCount <= 0)
+    if (nMaxSessionCount == 0 || pPeer->fInBound)
     {
-        return;
+        return false;
     }
-
-    vector<CBbAddr> vBbAddr;
-    if (!pBbAddrPool->GetCallConnectAddrList(vBbAddr, nNeedTestCount, pDNSeedCfg->fStressBackTest) || vBbAddr.size() == 0)
+    CBbAddr tBbAddr;
+    if (!pBbAddrPool->QueryAddr(pPeer->tPeerEp, tBbAddr) || tBbAddr.GetScore() < pDNSeedCfg->nGoodAddrScore)
     {
-        nStartBackTestTime = GetTimeMillis();
-        nCompBackTestCount = 0;
-        return;
+        return false;
     }
-    if (vBbAddr.size() < nNeedTestCount)
+
+    if (setSessionPeer.size() >= nMaxSessionCount)
     {
-        nStartBackTestTime = GetTimeMillis();
-        nCompBackTestCount = 0;
+        uint64 nWorstNetId = 0;
+        int iWorstScore = tBbAddr.GetScore();
+        for (set<uint64>::iterator it = setSessionPeer.begin(); it != setSessionPeer.end(); ++it)
+        {
+            CNetPeer* pSessionPeer = GetNetPeer(*it);
+            CBbAddr tSessionAddr;
+            if (pSessionPeer && pBbAddrPool->QueryAddr(pSessionPeer->tPeerEp, tSessionAddr) && tSessionAddr.GetScore() < iWorstScore)
+            {
+                nWorstNetId = *it;
+                iWorstScore = tSessionAddr.GetScore();
+            }
+        }
+        if (nWorstNetId == 0)
+        {
+            return false;
+        }
+        ActiveClosePeer(nWorstNetId);
     }
 
-    vector<CBbAddr>::iterator it;
-    for (it = vBbAddr.begin(); it != vBbAddr.end(); it++)
+    if (!pBbAddrPool->SetSession(pPeer->tPeerEp, true))
     {
-        StartConnectPeer(*it);
-        nCompBackTestCount++;
+        return false;
+    }
+    setSessionPeer.insert(pPeer->nPeerNetId);
+    /*the pool no longer schedules tests for a session*/
+    pProbeSet->Remove(pPeer->tPeerEp, pPeer->nProbeToken);
+    pPeer->nProbeToken = 0;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(lockStat);
+        tNetStatData.nSessionCount++;
     }
+    return true;
 }
 
-void CMsgWorkThread::DoPeerState(time_t tmCurTime)
+void CMsgWorkThread::HandleSessionPong(CNetPeer* pPeer, uint32 nRtt)
 {
-    CNetPeer* pNetPeer;
-    uint32 nInCount = 0, nOutCount = 0;
+    pBbAddrPool->TouchSession(pPeer->tPeerEp);
+    pBbAddrPool->UpdateRtt(pPeer->tPeerEp, nRtt);
+    boost::unique_lock<boost::shared_mutex> lock(lockStat);
+    tNetStatData.nTotalPongCount++;
+}
 
-    map<uint64, CNetPeer*>::iterator it;
-    for (it = mapPeer.begin(); it != mapPeer.end();)
+void CMsgWorkThread::DoCallConnect()
+{
+    uint32 nNeedTestCount = pConnectPacer->Take(nPersCalloutAddrCount);
+    if (nNeedTestCount == 0)
     {
-        if (it->second)
-        {
-            pNetPeer = it->second;
-            it++;
+        return;
+    }
 
-            if (pNetPeer->fInBound)
-                nInCount++;
-            else
-                nOutCount++;
+    vector<CBbAddr> vBbAddr;
+    if (!pBbAddrPool->GetCallConnectAddrList(vBbAddr, nNeedTestCount, pDNSeedCfg->fStressBackTest))
+    {
+        vBbAddr.clear();
+    }
+    if (vBbAddr.size() < nNeedTestCount)
+    {
+        pConnectPacer->Refund(nNeedTestCount - vBbAddr.size());
+    }
 
-            if (!pNetPeer->DoStateTimer(tmCurTime))
-            {
-                ActiveClosePeer(pNetPeer->nPeerNetId);
-            }
+    uint32 nProbeCount = 0;
+    uint32 nDupCount = 0;
+    vector<CBbAddr>::iterator it;
+    for (it = vBbAddr.begin(); it != vBbAddr.end(); it++)
+    {
+        uint64 nProbeToken = 0;
+        NMS_E_PROBE_ADD eAdd = pProbeSet->Add(it->GetEp(), nProbeToken);
+        if (eAdd == NMS_E_PROBE_ADD_DUPLICATE)
+        {
+            nDupCount++;
+            continue;
         }
-        else
+        if (StartConnectPeer(*it, nProbeToken))
         {
-            it++;
+            nProbeCount++;
+        }
+        else if (eAdd == NMS_E_PROBE_ADD_TRACKED)
+        {
+            pProbeSet->Remove(it->GetEp(), nProbeToken);
         }
     }
-
+    if (nDupCount > 0)
+    {
+        pConnectPacer->Refund(nDupCount);
+    }
+    if (nProbeCount > 0 || nDupCount > 0)
     {
         boost::unique_lock<boost::shared_mutex> lock(lockStat);
-        tNetStatData.nInBoundCount = nInCount;
-        tNetStatData.nOutBoundCount = nOutCount;
-        tNetStatData.nTcpConnCount = nInCount + nOutCount;
+        tNetStatData.nTotalProbeCount += nProbeCount;
+        tNetStatData.nTotalDupProbeCount += nDupCount;
+    }
+}
+
+void CMsgWorkThread::DoPeerTimeout(int64 nCurTime)
+{
+    vector<CPeerTimerEntry> vExpired;
+    tPeerTimer.Expire(nCurTime, vExpired);
+    for (size_t i = 0; i < vExpired.size(); i++)
+    {
+        CNetPeer* pNetPeer = GetNetPeer(vExpired[i].nNetId);
+        if (pNetPeer && pNetPeer->nTimerSeq == vExpired[i].nSeq && !pNetPeer->DoStateTimer(nCurTime))
+        {
+            ActiveClosePeer(pNetPeer->nPeerNetId);
+        }
     }
 }
 
-void CMsgWorkThread::StartConnectPeer(CBbAddr& tBbAddr)
+bool CMsgWorkThread::StartConnectPeer(CBbAddr& tBbAddr, uint64 nProbeToken)
 {
     if (STD_DEBUG)
     {
@@ -476,12 +785,13 @@ void CMsgWorkThread::StartConnectPeer(CBbAddr& tBbAddr)
     }
 
     uint64 nOutNetId = 0;
-    if (!pNetWorkService->ReqTcpConnect(tBbAddr.GetEp(), nOutNetId))
+    if (!pNetWorkService->ReqTcpConnect(tBbAddr.GetEp(), nOutNetId, nProbeToken))
     {
         string sInfo = string("ReqTcpConnect fail, peer: ") + tBbAddr.GetEp().ToString();
         blockhead::StdError(__PRETTY_FUNCTION__, sInfo.c_str());
-        return;
+        return false;
     }
+    return true;
 }
 
 } // namespace dnseed
@@ -7,8 +7,10 @@
 
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
+#include <atomic>
 #include <boost/thread.hpp>
 #include <iostream>
+#include <set>
 
 #include "addrpool.h"
 #include "blockhead/type.h"
@@ -26,6 +28,75 @@ using namespace blockhead;
 
 class CMsgWorkThread;
 
+#define NMS_D_PROBE_SET_BUCKET_COUNT 8192
+#define NMS_D_PROBE_SET_BUCKET_SIZE 32 /*slots in the bucket of an endpoint*/
+#define NMS_D_PROBE_SET_MAX_RETRY 8    /*claims lost to other adds before testing untracked*/
+#define NMS_D_PROBE_MAX_TIME 300       /*seconds before an entry left behind may be taken over*/
+#define NMS_D_PROBE_TIME_CLAIM 0       /*slot time while a claim is not committed*/
+#define NMS_D_PROBE_TIME_FREE 1        /*slot time of a free slot or one being freed*/
+
+typedef enum _NMS_E_PROBE_ADD
+{
+    NMS_E_PROBE_ADD_TRACKED,   /*the slot token must be given back to Remove*/
+    NMS_E_PROBE_ADD_UNTRACKED, /*tested without a slot, nothing to remove*/
+    NMS_E_PROBE_ADD_DUPLICATE  /*already in flight*/
+} NMS_E_PROBE_ADD;
+
+// Token bucket shared by the work threads, tokens are added at nRate per
+// second up to nBurst and each outbound test takes one.
+class CConnectPacer
+{
+public:
+    CConnectPacer(uint32 nRateIn, uint32 nBurstIn);
+    ~CConnectPacer() {}
+
+    uint32 Take(uint32 nWant);
+    void Refund(uint32 nCount);
+    void SetRate(uint32 nRateIn, uint32 nBurstIn);
+    uint32 GetRate();
+
+private:
+    void Refill();
+
+    uint32 nRate;
+    uint32 nBurst;
+    uint64 nTokenMicro; /*tokens in millionths*/
+    int64 nPrevRefillTime;
+    boost::mutex lockPacer;
+};
+
+// Endpoints with an outbound test in flight, shared by the work threads
+// without a lock. An endpoint is packed into one word and claims a slot of
+// the bucket at its hash. A claim only holds if no other claim in the bucket
+// was committed since the bucket was scanned, which the bucket version tells,
+// so an endpoint never holds two slots. Add hands out a token of the slot and
+// its add time, Remove frees the slot only while it still holds that token,
+// so a late Remove after a takeover leaves the new holder alone.
+class CProbeEndpointSet
+{
+public:
+    CProbeEndpointSet();
+    ~CProbeEndpointSet();
+
+    NMS_E_PROBE_ADD Add(CMthNetEndpoint& ep, uint64& nTokenOut);
+    void Remove(CMthNetEndpoint& ep, uint64 nToken);
+
+private:
+    struct CBucket
+    {
+        std::atomic<uint64> nVersion;
+        std::atomic<uint64> nSlotKey[NMS_D_PROBE_SET_BUCKET_SIZE];
+        std::atomic<uint32> nSlotTime[NMS_D_PROBE_SET_BUCKET_SIZE]; /*add time, or CLAIM or FREE*/
+    };
+
+    static uint64 GetKey(CMthNetEndpoint& ep);
+    static bool IsStale(uint32 nAddTime, uint32 nCurTime);
+    static uint64 MakeToken(uint32 nBucket, uint32 nSlot, uint32 nAddTime);
+    uint32 GetBucketIndex(uint64 nKey);
+
+    CBucket* pBucket;
+};
+
 class CWorkThreadPool
 {
 public:
@@ -36,10 +107,18 @@ public:
     void StopAll();
 
     bool StatRunData(CRunStatData& tStatData);
+    void AdjustTestRate();
+    uint32 GetFdLimit();
 
 private:
+
     CMsgWorkThread* pWorkThreadTable[MAX_NET_WORK_THREAD_COUNT];
     uint32 nWorkThreadCount;
+    CConnectPacer tConnectPacer;
+    CProbeEndpointSet tProbeSet;
+    uint32 nTestRate;
+    int32 nLocalFailBaseline; /*moving local connect fail ratio in 1/100 percent, -1 until sampled*/
+    CRunStatData tPrevRateStat;
 
     CDnseedConfig* pDNSeedCfg;
     CNetWorkService* pNetWorkService;
@@ -51,7 +130,8 @@ class CMsgWorkThread
     friend class CNetPeer;
 
 public:
-    CMsgWorkThread(uint32 nThreadCount, uint32 nThreadIndex, CDnseedConfig* pCfg, CNetWorkService* nws, CBbAddrPool* pBbAddrPoolIn);
+    CMsgWorkThread(uint32 nThreadCount, uint32 nThreadIndex, CDnseedConfig* pCfg, CNetWorkService* nws, CBbAddrPool* pBbAddrPoolIn,
+                   CConnectPacer* pConnectPacerIn, CProbeEndpointSet* pProbeSetIn);
     ~CMsgWorkThread();
 
     bool Start();
@@ -72,11 +152,13 @@ private:
 
     void ActiveClosePeer(uint64 nPeerNetId);
     bool HandlePeerHandshaked(CNetPeer* pPeer);
+    bool KeepSession(CNetPeer* pPeer);
+    void HandleSessionPong(CNetPeer* pPeer, uint32 nRtt);
 
     void DoCallConnect();
-    void DoPeerState(time_t tmCurTime);
+    void DoPeerTimeout(int64 nCurTime);
 
-    void StartConnectPeer(CBbAddr& tBbAddr);
+    bool StartConnectPeer(CBbAddr& tBbAddr, uint64 nProbeToken);
 
 private:
     bool fRunFlag;
@@ -88,17 +170,19 @@ private:
     CNetWorkService* pNetWorkService;
     CBbAddrPool* pBbAddrPool;
     CNetDataQueue* pNetDataQueue;
+    CConnectPacer* pConnectPacer;
+    CProbeEndpointSet* pProbeSet;
     uint32 nPersCalloutAddrCount;
+    uint32 nMaxSessionCount;
+    set<uint64> setSessionPeer;
 
-    int64 nStartBackTestTime;
-    uint64 nCompBackTestCount;
-
-    map<uint64, CNetPeer*> mapPeer;
+    CPeerSlotTable tPeerTable;
+    CNetPeerPool tPeerPool;
+    CPeerTimerWheel tPeerTimer;
+    CProtoMsgTemplate tMsgTemplate;
 
     CRunStatData tNetStatData;
     boost::shared_mutex lockStat;
-
-    time_t tmPrevTimerDoTime;
 };
 
 } //namespace dnseed
@@ -12,6 +12,202 @@ using boost::asio::ip::tcp;
 namespace dnseed
 {
 
+// Seconds a peer may stay in each state, 0 is no limit. A kept session
+// pings after the configured idle time and a finished outbound test stays
+// for the configured linger time instead.
+static const int nPeerStateTimeout[] = {
+    0,                          /*INIT*/
+    30, 10, 30, 10, 2,          /*IN_CONNECTED ... IN_COMPLETE*/
+    20, 20, 10, 30, 10, 2,      /*OUT_CONNECTING ... OUT_COMPLETE*/
+    0, 10,                      /*OUT_SESSION, OUT_SESSION_WAIT_PONG*/
+    2                           /*OUT_WAIT_EARLY_ADDRESS_RSP*/
+};
+
+//-----------------------------------------------------------------------------------------------
+CPeerTimerWheel::CPeerTimerWheel()
+  : vSlot(DNP_D_WHEEL_SLOT_COUNT), nSeqGen(0), nEntryCount(0)
+{
+    nCurTick = GetTimeMillis() / DNP_D_WHEEL_TICK;
+}
+
+uint32 CPeerTimerWheel::Add(uint64 nNetId, int64 nDeadline)
+{
+    int64 nTick = nDeadline / DNP_D_WHEEL_TICK;
+    if (nTick <= nCurTick)
+    {
+        nTick = nCurTick + 1;
+    }
+    vSlot[nTick % DNP_D_WHEEL_SLOT_COUNT].push_back(CPeerTimerEntry(nNetId, nDeadline, ++nSeqGen));
+    nEntryCount++;
+    return nSeqGen;
+}
+
+void CPeerTimerWheel::Expire(int64 nCurTime, vector<CPeerTimerEntry>& vExpired)
+{
+    int64 nTick = nCurTime / DNP_D_WHEEL_TICK;
+    if (nTick <= nCurTick)
+    {
+        return;
+    }
+    int64 nBeginTick = max(nCurTick + 1, nTick - DNP_D_WHEEL_SLOT_COUNT + 1);
+    for (int64 t = nBeginTick; t <= nTick; t++)
+    {
+        vector<CPeerTimerEntry>& vEntry = vSlot[t % DNP_D_WHEEL_SLOT_COUNT];
+        for (size_t i = 0; i < vEntry.size();)
+        {
+            if (vEntry[i].nDeadline <= nCurTime)
+            {
+                vExpired.push_back(vEntry[i]);
+                vEntry[i] = vEntry.back();
+                vEntry.pop_back();
+                nEntryCount--;
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+    nCurTick = nTick;
+}
+
+//-----------------------------------------------------------------------------------------------
+CPeerSlotTable::CPeerSlotTable()
+  : vSlot(DNP_D_PEER_SLOT_INIT_COUNT), nMask(DNP_D_PEER_SLOT_INIT_COUNT - 1), nCount(0)
+{
+}
+
+size_t CPeerSlotTable::GetSlot(uint64 nNetId) const
+{
+    return CBaseUniqueId(nNetId).GetId() & nMask;
+}
+
+bool CPeerSlotTable::Insert(uint64 nNetId, CNetPeer* pPeer)
+{
+    if (nNetId == 0 || pPeer == NULL || Find(nNetId) != NULL)
+    {
+        return false;
+    }
+    if ((nCount + 1) * 2 > vSlot.size())
+    {
+        Resize(vSlot.size() * 2);
+    }
+    size_t i = GetSlot(nNetId);
+    while (vSlot[i].nNetId != 0)
+    {
+        i = (i + 1) & nMask;
+    }
+    vSlot[i].nNetId = nNetId;
+    vSlot[i].pPeer = pPeer;
+    nCount++;
+    return true;
+}
+
+CNetPeer* CPeerSlotTable::Find(uint64 nNetId) const
+{
+    if (nNetId == 0)
+    {
+        return NULL;
+    }
+    for (size_t i = GetSlot(nNetId); vSlot[i].nNetId != 0; i = (i + 1) & nMask)
+    {
+        if (vSlot[i].nNetId == nNetId)
+        {
+            return vSlot[i].pPeer;
+        }
+    }
+    return NULL;
+}
+
+CNetPeer* CPeerSlotTable::Remove(uint64 nNetId)
+{
+    if (nNetId == 0)
+    {
+        return NULL;
+    }
+    size_t i = GetSlot(nNetId);
+    while (vSlot[i].nNetId != nNetId)
+    {
+        if (vSlot[i].nNetId == 0)
+        {
+            return NULL;
+        }
+        i = (i + 1) & nMask;
+    }
+    CNetPeer* pPeer = vSlot[i].pPeer;
+    vSlot[i] = CPeerSlot();
+    nCount--;
+
+    // Move back the entries after the hole that can no longer be reached
+    for (size_t j = (i + 1) & nMask; vSlot[j].nNetId != 0; j = (j + 1) & nMask)
+    {
+        size_t k = GetSlot(vSlot[j].nNetId);
+        if (((j - k) & nMask) >= ((j - i) & nMask))
+        {
+            vSlot[i] = vSlot[j];
+            vSlot[j] = CPeerSlot();
+            i = j;
+        }
+    }
+    return pPeer;
+}
+
+void CPeerSlotTable::Resize(size_t nSlotCount)
+{
+    vector<CPeerSlot> vOld(nSlotCount);
+    vOld.swap(vSlot);
+    nMask = nSlotCount - 1;
+    for (size_t i = 0; i < vOld.size(); i++)
+    {
+        if (vOld[i].nNetId != 0)
+        {
+            size_t j = GetSlot(vOld[i].nNetId);
+            while (vSlot[j].nNetId != 0)
+            {
+                j = (j + 1) & nMask;
+            }
+            vSlot[j] = vOld[i];
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------------------------
+CNetPeerPool::~CNetPeerPool()
+{
+    for (size_t i = 0; i < vFree.size(); i++)
+    {
+        ::operator delete(vFree[i]);
+    }
+}
+
+void* CNetPeerPool::Alloc()
+{
+    if (vFree.empty())
+    {
+        return ::operator new(sizeof(CNetPeer));
+    }
+    void* pMem = vFree.back();
+    vFree.pop_back();
+    return pMem;
+}
+
+void CNetPeerPool::Free(CNetPeer* pPeer)
+{
+    if (pPeer == NULL)
+    {
+        return;
+    }
+    pPeer->~CNetPeer();
+    if (vFree.size() < DNP_D_PEER_POOL_MAX_FREE)
+    {
+        vFree.push_back(pPeer);
+    }
+    else
+    {
+        ::operator delete(pPeer);
+    }
+}
+
 //-----------------------------------------------------------------------------------------------
 CNetPeer::CNetPeer(CMsgWorkThread* pMsgWorkThreadIn, CBbAddrPool* pBbAddrPoolIn, uint32 nMsgMagicIn,
                    bool fInBoundIn, uint64 nNetIdIn, CMthNetEndpoint& tPeerEpIn, CMthNetEndpoint& tLocalEpIn, bool fAllowAllAddrIn)
@@ -23,10 +219,18 @@ CNetPeer::CNetPeer(CMsgWorkThread* pMsgWorkThreadIn, CBbAddrPool* pBbAddrPoolIn,
     nNonceFrom = 0;
     nTimeDelta = 0;
     nSendHelloTime = 0;
+    nSendHelloMillis = 0;
+    nHelloRtt = 0;
     nStartingHeight = 0;
     fGetPeerAddress = false;
     fIfNeedRespGetAddress = false;
     fIfDoComplete = false;
+    nTimerSeq = 0;
+    nSendGetAddrTime = 0;
+    fEarlyGetAddress = false;
+    nPingNonce = 0;
+    nSendPingTime = 0;
+    nProbeToken = 0;
 
     if (fInBoundIn)
     {
@@ -74,7 +278,8 @@ bool CNetPeer::DoOutBoundConnectSuccess(CMthNetEndpoint& tLocalEpIn)
 {
     tLocalEp = tLocalEpIn;
     ModifyPeerState(DNP_E_PEER_STATE_OUT_CONNECTED);
-    if (!SendMsgHello())
+    fEarlyGetAddress = pMsgWorkThread->pDNSeedCfg->fPipelineHandshake;
+    if (!SendMsgHello(fEarlyGetAddress))
     {
         blockhead::StdError(__PRETTY_FUNCTION__, "Send hello message fail.");
         return false;
@@ -84,358 +289,421 @@ bool CNetPeer::DoOutBoundConnectSuccess(CMthNetEndpoint& tLocalEpIn)
 }
 
 //------------------------------------------------------------------------------------
+const CProtoMsgEntry<CNetPeer> CNetPeer::tMsgTable[] = {
+    BBPROTO_MSG_ENTRY(CNetPeer, CMsgHello, HandleHello),
+    BBPROTO_MSG_ENTRY(CNetPeer, CMsgHelloAck, HandleHelloAck),
+    BBPROTO_MSG_ENTRY(CNetPeer, CMsgGetAddress, HandleGetAddress),
+    BBPROTO_MSG_ENTRY(CNetPeer, CMsgAddressView, HandleAddress),
+    BBPROTO_MSG_ENTRY(CNetPeer, CMsgPing, HandlePing),
+    BBPROTO_MSG_ENTRY(CNetPeer, CMsgPong, HandlePong),
+};
+
 bool CNetPeer::DoPacket()
+{
+    return ProtoMsgDoPacket(tMsgTable, this, tRecvDataBuf);
+}
+
+bool CNetPeer::HandleHello(CMsgHello& tMsg)
 {
     int64 nTimeRecv = GetTime();
-    switch (tRecvDataBuf.GetCommand())
+    if (nVersion != 0)
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "nVersion error.");
+        return false;
+    }
+
+    nVersion = tMsg.nVersion;
+    nService = tMsg.nService;
+    nNonceFrom = tMsg.nNonce;
+    strSubVer = tMsg.strSubVer;
+    nStartingHeight = tMsg.nStartingHeight;
+    nTimeDelta = tMsg.nTime - nTimeRecv;
+
+    if (STD_DEBUG)
     {
-    case BBPROTO_CMD_HELLO:
+        string sInfo = string("hello peer: ") + tPeerEp.ToString() + string(", height: ") + to_string(nStartingHeight);
+        blockhead::StdDebug("CFLOW", sInfo.c_str());
+    }
+
+    if (fInBound)
     {
-        try
+        if (ePeerState == DNP_E_PEER_STATE_IN_CONNECTED)
         {
-            blockhead::StdDebug("CFLOW", "Recv msg: BBPROTO_CMD_HELLO");
-            if (nVersion != 0)
+            if (!SendMsgHello())
             {
-                blockhead::StdError(__PRETTY_FUNCTION__, "nVersion error.");
+                blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgHello fail.");
                 return false;
             }
+            ModifyPeerState(DNP_E_PEER_STATE_IN_WAIT_HELLO_ACK);
+        }
+        else
+        {
+            blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_HELLO in state error.");
+            return false;
+        }
+    }
+    else
+    {
+        if (ePeerState == DNP_E_PEER_STATE_OUT_WAIT_HELLO)
+        {
+            ModifyPeerState(DNP_E_PEER_STATE_OUT_HANDSHAKED_COMPLETE);
+            nTimeDelta += (nTimeRecv - nSendHelloTime) / 2;
+            nHelloRtt = max(GetTimeMillis() - nSendHelloMillis, (int64)1);
+            pMsgWorkThread->HandlePeerHandshaked(this);
 
-            CBlockheadBufStream ssPayload;
-            if (!tRecvDataBuf.GetPayload(ssPayload))
+            if (!SendMsgHelloAck())
             {
-                blockhead::StdError(__PRETTY_FUNCTION__, "GetPayload fail.");
+                blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgHelloAck fail.");
                 return false;
             }
-
-            int64 nTime;
-            uint256 hashRecvGenesisBlock;
-            ssPayload >> nVersion >> nService >> nTime >> nNonceFrom >> strSubVer >> nStartingHeight >> hashRecvGenesisBlock;
-            nTimeDelta = nTime - nTimeRecv;
-
-            if (STD_DEBUG)
-            {
-                string sInfo = string("hello peer: ") + tPeerEp.ToString() + string(", height: ") + to_string(nStartingHeight);
-                blockhead::StdDebug("CFLOW", sInfo.c_str());
-            }
-
-            if (fInBound)
+            if (fEarlyGetAddress)
             {
-                if (ePeerState == DNP_E_PEER_STATE_IN_CONNECTED)
-                {
-                    if (!SendMsgHello())
-                    {
-                        blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgHello fail.");
-                        return false;
-                    }
-                    ModifyPeerState(DNP_E_PEER_STATE_IN_WAIT_HELLO_ACK);
-                }
-                else
-                {
-                    blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_HELLO in state error.");
-                    return false;
-                }
+                /*the answer to the early GETADDRESS is taken once HELLO checked out*/
+                ModifyPeerState(DNP_E_PEER_STATE_OUT_WAIT_EARLY_ADDRESS_RSP);
+                return true;
             }
-            else
+            if (!SendMsgGetAddress())
             {
-                if (ePeerState == DNP_E_PEER_STATE_OUT_WAIT_HELLO)
-                {
-                    ModifyPeerState(DNP_E_PEER_STATE_OUT_HANDSHAKED_COMPLETE);
-                    nTimeDelta += (nTimeRecv - nSendHelloTime) / 2;
-                    pMsgWorkThread->HandlePeerHandshaked(this);
-
-                    if (!SendMsgHelloAck())
-                    {
-                        blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgHelloAck fail.");
-                        return false;
-                    }
-                    if (!SendMsgGetAddress())
-                    {
-                        blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgGetAddress fail.");
-                        return false;
-                    }
-                    ModifyPeerState(DNP_E_PEER_STATE_OUT_WAIT_ADDRESS_RSP);
-                }
-                else
-                {
-                    blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_HELLO out state error.");
-                    return false;
-                }
+                blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgGetAddress fail.");
+                return false;
             }
+            ModifyPeerState(DNP_E_PEER_STATE_OUT_WAIT_ADDRESS_RSP);
         }
-        catch (exception& e)
+        else
         {
-            blockhead::StdError(__PRETTY_FUNCTION__, e.what());
+            blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_HELLO out state error.");
             return false;
         }
-        break;
     }
-    case BBPROTO_CMD_HELLO_ACK:
+    return true;
+}
+
+bool CNetPeer::HandleHelloAck(CMsgHelloAck&)
+{
+    if (fInBound)
     {
-        blockhead::StdDebug("CFLOW", "Recv msg: BBPROTO_CMD_HELLO_ACK");
-        if (fInBound)
+        if (ePeerState == DNP_E_PEER_STATE_IN_WAIT_HELLO_ACK)
         {
-            if (ePeerState == DNP_E_PEER_STATE_IN_WAIT_HELLO_ACK)
+            if (nVersion == 0)
             {
-                if (nVersion == 0)
-                {
-                    blockhead::StdError(__PRETTY_FUNCTION__, "nVersion error.");
-                    return false;
-                }
-                ModifyPeerState(DNP_E_PEER_STATE_IN_HANDSHAKED_COMPLETE);
-                nTimeDelta += (nTimeRecv - nSendHelloTime) / 2;
-                pMsgWorkThread->HandlePeerHandshaked(this);
-                if (!SendMsgGetAddress())
-                {
-                    blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgGetAddress fail.");
-                    return false;
-                }
-                ModifyPeerState(DNP_E_PEER_STATE_IN_WAIT_ADDRESS_RSP);
+                blockhead::StdError(__PRETTY_FUNCTION__, "nVersion error.");
+                return false;
             }
-            else
+            ModifyPeerState(DNP_E_PEER_STATE_IN_HANDSHAKED_COMPLETE);
+            nTimeDelta += (GetTime() - nSendHelloTime) / 2;
+            nHelloRtt = max(GetTimeMillis() - nSendHelloMillis, (int64)1);
+            pMsgWorkThread->HandlePeerHandshaked(this);
+            if (!SendMsgGetAddress())
             {
-                blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_HELLO_ACK in state error.");
+                blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgGetAddress fail.");
                 return false;
             }
+            ModifyPeerState(DNP_E_PEER_STATE_IN_WAIT_ADDRESS_RSP);
         }
-        break;
-    }
-    case BBPROTO_CMD_GETADDRESS:
-    {
-        blockhead::StdDebug("CFLOW", "Recv msg: BBPROTO_CMD_GETADDRESS");
-        if (!SendMsgAddress())
+        else
         {
-            blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgAddress fail.");
+            blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_HELLO_ACK in state error.");
             return false;
         }
-        /*if(!fGetPeerAddress)
-        {
-            fIfNeedRespGetAddress = true;
-        }
-        else
-        {
-            if (!SendMsgAddress())
-            {
-                blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgAddress fail.");
-                return false;
-            }
-        }*/
-        break;
     }
-    case BBPROTO_CMD_ADDRESS:
+    return true;
+}
+
+bool CNetPeer::HandleGetAddress(CMsgGetAddress&)
+{
+    if (!SendMsgAddress())
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgAddress fail.");
+        return false;
+    }
+    /*if(!fGetPeerAddress)
     {
-        vector<CAddress> vAddrList;
-        CBlockheadBufStream ssPayload;
-        if (!tRecvDataBuf.GetPayload(ssPayload))
+        fIfNeedRespGetAddress = true;
+    }
+    else
+    {
+        if (!SendMsgAddress())
         {
-            blockhead::StdError(__PRETTY_FUNCTION__, "GetPayload fail.");
+            blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgAddress fail.");
             return false;
         }
-        ssPayload >> vAddrList;
-
-        if (STD_DEBUG)
-        {
-            string sInfo = string("Recv address count: ") + to_string(vAddrList.size());
-            blockhead::StdDebug("CFLOW", sInfo.c_str());
-        }
+    }*/
+    return true;
+}
 
-        for (vector<CAddress>::iterator it = vAddrList.begin(); it != vAddrList.end(); ++it)
-        {
-            if (((*it).nService & NODE_NETWORK) == NODE_NETWORK && (fPeerAllowAllAddr || (*it).ssEndpoint.IsRoutable()))
-            {
-                tcp::endpoint ep;
-                (*it).ssEndpoint.GetEndpoint(ep);
-                pBbAddrPool->AddRecvAddr(ep, (*it).nService);
-
-                /*if (STD_DEBUG)
-                {
-                    string strAddAddr = string("Address: ") + ep.address().to_string() + ":" + to_string(ep.port());
-                    blockhead::StdDebug("CFLOW", strAddAddr.c_str());
-                }*/
-            }
-        }
-        /*fGetPeerAddress = true;
+bool CNetPeer::HandleAddress(CMsgAddressView& tMsg)
+{
+    uint32 nAcceptCount = pBbAddrPool->AddRecvAddrBatch(tMsg);
+    if (STD_DEBUG)
+    {
+        string sInfo = string("Recv address count: ") + to_string(tMsg.GetCount()) + string(", accept count: ") + to_string(nAcceptCount);
+        blockhead::StdDebug("CFLOW", sInfo.c_str());
+    }
 
-        if (fIfNeedRespGetAddress)
-        {
-            if (!SendMsgAddress())
-            {
-                blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgAddress fail.");
-                return false;
-            }
-        }*/
+    /*fGetPeerAddress = true;
 
-        if (ePeerState == DNP_E_PEER_STATE_IN_WAIT_ADDRESS_RSP)
+    if (fIfNeedRespGetAddress)
+    {
+        if (!SendMsgAddress())
         {
-            ModifyPeerState(DNP_E_PEER_STATE_IN_COMPLETE);
-            fIfDoComplete = true;
+            blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgAddress fail.");
+            return false;
         }
-        else if (ePeerState == DNP_E_PEER_STATE_OUT_WAIT_ADDRESS_RSP)
+    }*/
+
+    if (ePeerState == DNP_E_PEER_STATE_IN_WAIT_ADDRESS_RSP)
+    {
+        ModifyPeerState(DNP_E_PEER_STATE_IN_COMPLETE);
+        fIfDoComplete = true;
+    }
+    else if (ePeerState == DNP_E_PEER_STATE_OUT_WAIT_ADDRESS_RSP || ePeerState == DNP_E_PEER_STATE_OUT_WAIT_EARLY_ADDRESS_RSP)
+    {
+        fIfDoComplete = true;
+        if (pMsgWorkThread->KeepSession(this))
         {
-            ModifyPeerState(DNP_E_PEER_STATE_OUT_COMPLETE);
-            fIfDoComplete = true;
+            ModifyPeerState(DNP_E_PEER_STATE_OUT_SESSION);
         }
         else
         {
-            blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_ADDRESS stat error.");
-            return false;
+            ModifyPeerState(DNP_E_PEER_STATE_OUT_COMPLETE);
         }
-        break;
     }
-    default:
-        blockhead::StdError(__PRETTY_FUNCTION__, "Error message.");
-        break;
+    else if (ePeerState == DNP_E_PEER_STATE_OUT_SESSION || ePeerState == DNP_E_PEER_STATE_OUT_SESSION_WAIT_PONG)
+    {
+        /*answer to the periodic GETADDRESS of a kept session*/
+    }
+    else
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_ADDRESS stat error.");
+        return false;
+    }
+    return true;
+}
+
+bool CNetPeer::HandlePing(CMsgPing& tMsg)
+{
+    if (nVersion == 0)
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_PING before hello.");
+        return false;
     }
+    return SendMsgPong(tMsg.nNonce);
+}
 
+bool CNetPeer::HandlePong(CMsgPong& tMsg)
+{
+    if (ePeerState != DNP_E_PEER_STATE_OUT_SESSION_WAIT_PONG || tMsg.nNonce != nPingNonce)
+    {
+        return true;
+    }
+    pMsgWorkThread->HandleSessionPong(this, max(GetTimeMillis() - nSendPingTime, (int64)1));
+    ModifyPeerState(DNP_E_PEER_STATE_OUT_SESSION);
     return true;
 }
 
+int CNetPeer::GetStateTimeout(DNP_E_PEER_STATE eState)
+{
+    if (eState == DNP_E_PEER_STATE_OUT_SESSION)
+    {
+        return pMsgWorkThread->pDNSeedCfg->nSessionPingTime;
+    }
+    if (eState == DNP_E_PEER_STATE_OUT_COMPLETE)
+    {
+        return pMsgWorkThread->pDNSeedCfg->nLingerTime;
+    }
+    return nPeerStateTimeout[eState];
+}
+
+// A finished outbound test without linger time is closed right away
+bool CNetPeer::IsDone()
+{
+    return (ePeerState == DNP_E_PEER_STATE_OUT_COMPLETE && GetStateTimeout(ePeerState) == 0);
+}
+
 void CNetPeer::ModifyPeerState(DNP_E_PEER_STATE eState)
 {
     ePeerState = eState;
-    tmStateBeginTime = time(NULL);
+    nStateBeginTime = GetTimeMillis();
+    int nTimeout = GetStateTimeout(eState);
+    if (nTimeout > 0)
+    {
+        nTimerSeq = pMsgWorkThread->tPeerTimer.Add(nPeerNetId, nStateBeginTime + nTimeout * 1000);
+    }
 }
 
-bool CNetPeer::SendMessage(int nChannel, int nCommand, CBlockheadBufStream& ssPayload)
+bool CNetPeer::SendMessage(int nChannel, int nCommand, CProtoPacketStream& ssPacket)
 {
-    CProtoDataBuf tPacketBuf(nMsgMagic, nChannel, nCommand, ssPayload);
-    return pMsgWorkThread->SendDataPacket(nPeerNetId, tPeerEp, tLocalEp, tPacketBuf.GetDataBuf(), tPacketBuf.GetDataLen());
+    ssPacket.SetHeader(nMsgMagic, nChannel, nCommand);
+    return pMsgWorkThread->SendDataPacket(nPeerNetId, tPeerEp, tLocalEp, ssPacket.GetData(), ssPacket.GetSize());
 }
 
-bool CNetPeer::DoStateTimer(time_t tmCurTime)
+bool CNetPeer::SendEmptyMessage(int nCommand)
 {
-    switch (ePeerState)
+    char* pPacket = NULL;
+    uint32 nPacketLen = 0;
+    if (!pMsgWorkThread->tMsgTemplate.GetEmptyPacket(nCommand, pPacket, nPacketLen))
     {
-    case DNP_E_PEER_STATE_INIT:
-        break;
+        blockhead::StdError(__PRETTY_FUNCTION__, "GetEmptyPacket fail.");
+        return false;
+    }
+    return pMsgWorkThread->SendDataPacket(nPeerNetId, tPeerEp, tLocalEp, pPacket, nPacketLen);
+}
 
-    case DNP_E_PEER_STATE_IN_CONNECTED:
-        if (DNP_STATE_TIMEOUT(tmCurTime, 30))
+// Called when the deadline set by ModifyPeerState passes, an idle kept
+// session sends a ping and asks for addresses again when that is due
+bool CNetPeer::DoStateTimer(int64 nCurTime)
+{
+    int nTimeout = GetStateTimeout(ePeerState);
+    if (nTimeout == 0 || !DNP_STATE_TIMEOUT(nCurTime, nTimeout))
+    {
+        return true;
+    }
+
+    if (ePeerState == DNP_E_PEER_STATE_OUT_SESSION)
+    {
+        if (!SendMsgPing())
         {
-            blockhead::StdDebug("CFLOW", "In connect timeout.");
+            blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgPing fail.");
             return false;
         }
-        break;
-    case DNP_E_PEER_STATE_IN_WAIT_HELLO_ACK:
-        if (DNP_STATE_TIMEOUT(tmCurTime, 10))
+        if (nCurTime - nSendGetAddrTime >= (int64)pMsgWorkThread->pDNSeedCfg->nSessionGetAddrTime * 1000 || nCurTime < nSendGetAddrTime)
         {
-            blockhead::StdDebug("CFLOW", "In connect wait hello ack timeout.");
-            return false;
+            if (!SendMsgGetAddress())
+            {
+                blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgGetAddress fail.");
+                return false;
+            }
         }
-        break;
-    case DNP_E_PEER_STATE_IN_HANDSHAKED_COMPLETE:
-        if (DNP_STATE_TIMEOUT(tmCurTime, 30))
+        ModifyPeerState(DNP_E_PEER_STATE_OUT_SESSION_WAIT_PONG);
+        return true;
+    }
+    if (ePeerState == DNP_E_PEER_STATE_OUT_WAIT_EARLY_ADDRESS_RSP)
+    {
+        /*the peer dropped the early request, ask again after the handshake*/
+        blockhead::StdDebug("CFLOW", "Out connect early address rsp timeout.");
+        if (!SendMsgGetAddress())
         {
-            blockhead::StdDebug("CFLOW", "In connect handshaked complete timeout.");
+            blockhead::StdError(__PRETTY_FUNCTION__, "SendMsgGetAddress fail.");
             return false;
         }
+        ModifyPeerState(DNP_E_PEER_STATE_OUT_WAIT_ADDRESS_RSP);
+        return true;
+    }
+
+    switch (ePeerState)
+    {
+    case DNP_E_PEER_STATE_IN_CONNECTED:
+        blockhead::StdDebug("CFLOW", "In connect timeout.");
+        break;
+    case DNP_E_PEER_STATE_IN_WAIT_HELLO_ACK:
+        blockhead::StdDebug("CFLOW", "In connect wait hello ack timeout.");
+        break;
+    case DNP_E_PEER_STATE_IN_HANDSHAKED_COMPLETE:
+        blockhead::StdDebug("CFLOW", "In connect handshaked complete timeout.");
         break;
     case DNP_E_PEER_STATE_IN_WAIT_ADDRESS_RSP:
-        if (DNP_STATE_TIMEOUT(tmCurTime, 10))
-        {
-            blockhead::StdDebug("CFLOW", "In connect wait address rsp timeout.");
-            return false;
-        }
+        blockhead::StdDebug("CFLOW", "In connect wait address rsp timeout.");
         break;
     case DNP_E_PEER_STATE_IN_COMPLETE:
-        if (DNP_STATE_TIMEOUT(tmCurTime, 2))
-        {
-            blockhead::StdDebug("CFLOW", "In connect work complete.");
-            return false;
-        }
+        blockhead::StdDebug("CFLOW", "In connect work complete.");
         break;
-
     case DNP_E_PEER_STATE_OUT_CONNECTING:
-        if (DNP_STATE_TIMEOUT(tmCurTime, 20))
-        {
-            blockhead::StdDebug("CFLOW", "Out connecting timeout.");
-            return false;
-        }
+        blockhead::StdDebug("CFLOW", "Out connecting timeout.");
         break;
     case DNP_E_PEER_STATE_OUT_CONNECTED:
-        if (DNP_STATE_TIMEOUT(tmCurTime, 20))
-        {
-            blockhead::StdDebug("CFLOW", "Out connect connected timeout.");
-            return false;
-        }
+        blockhead::StdDebug("CFLOW", "Out connect connected timeout.");
         break;
     case DNP_E_PEER_STATE_OUT_WAIT_HELLO:
-        if (DNP_STATE_TIMEOUT(tmCurTime, 10))
-        {
-            blockhead::StdDebug("CFLOW", "Out connect wait hello timeout.");
-            return false;
-        }
+        blockhead::StdDebug("CFLOW", "Out connect wait hello timeout.");
         break;
     case DNP_E_PEER_STATE_OUT_HANDSHAKED_COMPLETE:
-        if (DNP_STATE_TIMEOUT(tmCurTime, 30))
-        {
-            blockhead::StdDebug("CFLOW", "Out connect handshaked complete timeout.");
-            return false;
-        }
+        blockhead::StdDebug("CFLOW", "Out connect handshaked complete timeout.");
         break;
     case DNP_E_PEER_STATE_OUT_WAIT_ADDRESS_RSP:
-        if (DNP_STATE_TIMEOUT(tmCurTime, 10))
-        {
-            blockhead::StdDebug("CFLOW", "Out connect wait address rsp timeout.");
-            return false;
-        }
+        blockhead::StdDebug("CFLOW", "Out connect wait address rsp timeout.");
         break;
     case DNP_E_PEER_STATE_OUT_COMPLETE:
-        if (DNP_STATE_TIMEOUT(tmCurTime, 2))
-        {
-            blockhead::StdDebug("CFLOW", "Out connect work complete.");
-            return false;
-        }
+        blockhead::StdDebug("CFLOW", "Out connect work complete.");
+        break;
+    case DNP_E_PEER_STATE_OUT_SESSION_WAIT_PONG:
+        blockhead::StdDebug("CFLOW", "Out session wait pong timeout.");
+        break;
+    default:
         break;
     }
-    return true;
+    return false;
 }
 
 //-----------------------------------------------------------------------------------
-bool CNetPeer::SendMsgHello()
+bool CNetPeer::SendMsgHello(bool fWithGetAddress)
 {
-    blockhead::StdDebug("CFLOW", "Send msg: BBPROTO_CMD_HELLO");
-    CBlockheadBufStream ssPayload;
-    int iLocalVersion = PROTO_VERSION;
-    uint64 nLocalService = NODE_NETWORK;
-    string strLocalSubVer = FormatSubVersion();
-
-    uint64 nNonce = nPeerNetId;
-    int64 nTime = pBbAddrPool->GetNetTime();
-    int nHeight = pBbAddrPool->GetConfidentHeight();
-    ssPayload << iLocalVersion << nLocalService << nTime << nNonce << strLocalSubVer << nHeight << pBbAddrPool->GetGenesisBlockHash();
+    blockhead::StdDebug("CFLOW", (fWithGetAddress ? "Send msg: BBPROTO_CMD_HELLO, BBPROTO_CMD_GETADDRESS" : "Send msg: BBPROTO_CMD_HELLO"));
+    char* pPacket = NULL;
+    uint32 nPacketLen = 0;
+    if (!pMsgWorkThread->tMsgTemplate.GetHelloPacket(pBbAddrPool->GetNetTime(), nPeerNetId, pBbAddrPool->GetConfidentHeight(),
+                                                     pPacket, nPacketLen, fWithGetAddress))
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "GetHelloPacket fail.");
+        return false;
+    }
 
     nSendHelloTime = GetTime();
-    return SendMessage(BBPROTO_CHN_NETWORK, BBPROTO_CMD_HELLO, ssPayload);
+    nSendHelloMillis = GetTimeMillis();
+    if (fWithGetAddress)
+    {
+        nSendGetAddrTime = nSendHelloMillis;
+    }
+    return pMsgWorkThread->SendDataPacket(nPeerNetId, tPeerEp, tLocalEp, pPacket, nPacketLen);
 }
 
 bool CNetPeer::SendMsgHelloAck()
 {
     blockhead::StdDebug("CFLOW", "Send msg: BBPROTO_CMD_HELLO_ACK");
-    CBlockheadBufStream ssPayload;
-    return SendMessage(BBPROTO_CHN_NETWORK, BBPROTO_CMD_HELLO_ACK, ssPayload);
+    return SendEmptyMessage(BBPROTO_CMD_HELLO_ACK);
 }
 
 bool CNetPeer::SendMsgGetAddress()
 {
     blockhead::StdDebug("CFLOW", "Send msg: BBPROTO_CMD_GETADDRESS");
-    CBlockheadBufStream ssPayload;
-    return SendMessage(BBPROTO_CHN_NETWORK, BBPROTO_CMD_GETADDRESS, ssPayload);
+    nSendGetAddrTime = GetTimeMillis();
+    return SendEmptyMessage(BBPROTO_CMD_GETADDRESS);
 }
 
 bool CNetPeer::SendMsgAddress()
 {
-    CBlockheadBufStream ssPayload;
-    vector<CAddress> vAddrList;
-    pBbAddrPool->GetGoodAddressList(vAddrList);
+    CProtoPacketStream ssPacket;
+    CMsgAddress tMsg;
+    pBbAddrPool->GetGoodAddressList(tMsg.vAddrList);
 
     if (STD_DEBUG)
     {
-        string sInfo = string("Send msg: BBPROTO_CMD_ADDRESS, addr count: ") + to_string(vAddrList.size());
+        string sInfo = string("Send msg: BBPROTO_CMD_ADDRESS, addr count: ") + to_string(tMsg.vAddrList.size());
         blockhead::StdDebug("CFLOW", sInfo.c_str());
     }
 
-    ssPayload << vAddrList;
-    return SendMessage(BBPROTO_CHN_NETWORK, BBPROTO_CMD_ADDRESS, ssPayload);
+    ProtoMsgEncode(tMsg, ssPacket);
+    return SendMessage(BBPROTO_CHN_NETWORK, BBPROTO_CMD_ADDRESS, ssPacket);
+}
+
+bool CNetPeer::SendMsgPing()
+{
+    blockhead::StdDebug("CFLOW", "Send msg: BBPROTO_CMD_PING");
+    CProtoPacketStream ssPacket;
+    CMsgPing tMsg;
+    nSendPingTime = GetTimeMillis();
+    tMsg.nNonce = nPingNonce = (uint64)nSendPingTime ^ nPeerNetId;
+    ProtoMsgEncode(tMsg, ssPacket);
+    return SendMessage(BBPROTO_CHN_NETWORK, BBPROTO_CMD_PING, ssPacket);
+}
+
+bool CNetPeer::SendMsgPong(uint64 nNonce)
+{
+    blockhead::StdDebug("CFLOW", "Send msg: BBPROTO_CMD_PONG");
+    CProtoPacketStream ssPacket;
+    CMsgPong tMsg;
+    tMsg.nNonce = nNonce;
+    ProtoMsgEncode(tMsg, ssPacket);
+    return SendMessage(BBPROTO_CHN_NETWORK, BBPROTO_CMD_PONG, ssPacket);
 }
 
 } // namespace dnseed
@@ -6,9 +6,11 @@
 #define __DNSEED_NETPEER_H
 
 #include <iostream>
+#include <vector>
 
 #include "addrpool.h"
 #include "blockhead/type.h"
+#include "netmsgcodec.h"
 #include "netproto.h"
 #include "network/networkbase.h"
 
@@ -36,12 +38,112 @@ typedef enum _DNP_E_PEER_STATE
     DNP_E_PEER_STATE_OUT_WAIT_HELLO,
     DNP_E_PEER_STATE_OUT_HANDSHAKED_COMPLETE,
     DNP_E_PEER_STATE_OUT_WAIT_ADDRESS_RSP,
-    DNP_E_PEER_STATE_OUT_COMPLETE
+    DNP_E_PEER_STATE_OUT_COMPLETE,
+
+    DNP_E_PEER_STATE_OUT_SESSION,
+    DNP_E_PEER_STATE_OUT_SESSION_WAIT_PONG,
+
+    DNP_E_PEER_STATE_OUT_WAIT_EARLY_ADDRESS_RSP
 
 } DNP_E_PEER_STATE,
     *PDNP_E_PEER_STATE;
 
-#define DNP_STATE_TIMEOUT(tmCurTime, nSeconds) (tmCurTime - tmStateBeginTime >= nSeconds || tmCurTime < tmStateBeginTime)
+#define DNP_STATE_TIMEOUT(nCurTime, nSeconds) (nCurTime - nStateBeginTime >= nSeconds * 1000 || nCurTime < nStateBeginTime)
+
+#define DNP_D_WHEEL_TICK 10          /*ms per wheel slot*/
+#define DNP_D_WHEEL_SLOT_COUNT 1024
+
+class CPeerTimerEntry
+{
+public:
+    CPeerTimerEntry(uint64 nNetIdIn, int64 nDeadlineIn, uint32 nSeqIn)
+      : nNetId(nNetIdIn), nDeadline(nDeadlineIn), nSeq(nSeqIn) {}
+
+    uint64 nNetId;
+    int64 nDeadline;
+    uint32 nSeq;
+};
+
+// Hashed timing wheel of peer state deadlines in ms. A slot holds the entries
+// due in it on any turn of the wheel, Expire only walks the slots passed since
+// the previous call. Entries are not removed when a peer changes state, the
+// owner drops the ones whose sequence is no longer the peer's.
+class CPeerTimerWheel
+{
+public:
+    CPeerTimerWheel();
+    ~CPeerTimerWheel() {}
+
+    uint32 Add(uint64 nNetId, int64 nDeadline);
+    void Expire(int64 nCurTime, vector<CPeerTimerEntry>& vExpired);
+    size_t GetCount() const
+    {
+        return nEntryCount;
+    }
+
+private:
+    vector<vector<CPeerTimerEntry>> vSlot;
+    int64 nCurTick;
+    uint32 nSeqGen;
+    size_t nEntryCount;
+};
+
+class CNetPeer;
+
+#define DNP_D_PEER_SLOT_INIT_COUNT 1024
+#define DNP_D_PEER_POOL_MAX_FREE 4096
+
+class CPeerSlot
+{
+public:
+    CPeerSlot()
+      : nNetId(0), pPeer(NULL) {}
+
+    uint64 nNetId;
+    CNetPeer* pPeer;
+};
+
+// Open addressing table of the peers of one work thread. The slot is taken
+// from the sequence part of the net id, which grows by one per connection, so
+// live peers rarely share a slot; the full id is compared on lookup. Net id 0
+// marks an empty slot.
+class CPeerSlotTable
+{
+public:
+    CPeerSlotTable();
+    ~CPeerSlotTable() {}
+
+    bool Insert(uint64 nNetId, CNetPeer* pPeer);
+    CNetPeer* Find(uint64 nNetId) const;
+    CNetPeer* Remove(uint64 nNetId);
+    size_t GetCount() const
+    {
+        return nCount;
+    }
+
+private:
+    size_t GetSlot(uint64 nNetId) const;
+    void Resize(size_t nSlotCount);
+
+    vector<CPeerSlot> vSlot;
+    size_t nMask;
+    size_t nCount;
+};
+
+// Storage for CNetPeer objects of one work thread, released peers are kept
+// for the next connection instead of going back to the heap.
+class CNetPeerPool
+{
+public:
+    CNetPeerPool() {}
+    ~CNetPeerPool();
+
+    void* Alloc();
+    void Free(CNetPeer* pPeer);
+
+private:
+    vector<void*> vFree;
+};
 
 class CNetPeer
 {
@@ -54,30 +156,45 @@ public:
 
     bool DoRecvPacket(CMthNetPackData* pPackData);
     bool DoOutBoundConnectSuccess(CMthNetEndpoint& tLocalEpIn);
+    bool IsDone();
 
 private:
     bool DoPacket();
-
+    bool HandleHello(CMsgHello& tMsg);
+    bool HandleHelloAck(CMsgHelloAck& tMsg);
+    bool HandleGetAddress(CMsgGetAddress& tMsg);
+    bool HandleAddress(CMsgAddressView& tMsg);
+    bool HandlePing(CMsgPing& tMsg);
+    bool HandlePong(CMsgPong& tMsg);
+
+    int GetStateTimeout(DNP_E_PEER_STATE eState);
     void ModifyPeerState(DNP_E_PEER_STATE eState);
-    bool SendMessage(int nChannel, int nCommand, CBlockheadBufStream& ssPayload);
-    bool DoStateTimer(time_t tmCurTime);
+    bool SendMessage(int nChannel, int nCommand, CProtoPacketStream& ssPacket);
+    bool SendEmptyMessage(int nCommand);
+    bool DoStateTimer(int64 nCurTime);
 
-    bool SendMsgHello();
+    bool SendMsgHello(bool fWithGetAddress = false);
     bool SendMsgHelloAck();
 
     bool SendMsgGetAddress();
     bool SendMsgAddress();
+    bool SendMsgPing();
+    bool SendMsgPong(uint64 nNonce);
 
 private:
+    static const CProtoMsgEntry<CNetPeer> tMsgTable[];
+
     bool fInBound;
     DNP_E_PEER_STATE ePeerState;
-    time_t tmStateBeginTime;
+    int64 nStateBeginTime;
+    uint32 nTimerSeq;
 
     uint32 nMsgMagic;
     CMsgWorkThread* pMsgWorkThread;
     CBbAddrPool* pBbAddrPool;
 
     uint64 nPeerNetId;
+    uint64 nProbeToken; /*probe set token of an outbound test, 0 when untracked*/
     CMthNetEndpoint tPeerEp;
     CMthNetEndpoint tLocalEp;
     bool fPeerAllowAllAddr;
@@ -89,12 +206,19 @@ private:
     uint64 nNonceFrom;
     int64 nTimeDelta;
     int64 nSendHelloTime;
+    int64 nSendHelloMillis;
+    uint32 nHelloRtt; /*ms from our HELLO to the answer, 0 is not measured*/
     string strSubVer;
     int nStartingHeight;
 
     bool fGetPeerAddress;
     bool fIfNeedRespGetAddress;
     bool fIfDoComplete;
+
+    int64 nSendGetAddrTime;
+    bool fEarlyGetAddress; /*GETADDRESS went out with our HELLO*/
+    uint64 nPingNonce;
+    int64 nSendPingTime;
 };
 
 } //namespace dnseed
@@ -4,13 +4,33 @@
 
 #include "netproto.h"
 
+#include <stddef.h>
+
 #include "blockhead/util.h"
+#include "version.h"
 
 using boost::asio::ip::tcp;
 
 namespace dnseed
 {
 
+//-----------------------------------------------------------------------------------------------
+CProtoPacketStream::CProtoPacketStream()
+{
+    char chHeader[NMS_MESSAGE_HEADER_SIZE] = { 0 };
+    Write(chHeader, NMS_MESSAGE_HEADER_SIZE);
+}
+
+uint32 CProtoPacketStream::GetPayloadSize()
+{
+    return GetSize() - NMS_MESSAGE_HEADER_SIZE;
+}
+
+void CProtoPacketStream::SetHeader(uint32 ui32MsgMagic, int nChannel, int nCommand)
+{
+    CProtoDataBuf::SetPacketHeader(ui32MsgMagic, nChannel, nCommand, GetData(), GetPayloadSize());
+}
+
 //-----------------------------------------------------------------------------------------------
 CProtoDataBuf::CProtoDataBuf()
   : fPacketVerifyIntegrity(false)
@@ -122,27 +142,139 @@ void CProtoDataBuf::ErasePacket()
     fPacketVerifyIntegrity = false;
 }
 
+void CProtoDataBuf::SetPacketHeader(uint32 ui32MsgMagic, int nChannel, int nCommand, char* pPacket, uint32 ui32PayloadSize)
+{
+    PNMS_MSG_HEAD pMsgHead = (PNMS_MSG_HEAD)pPacket;
+    pMsgHead->nMagic = ui32MsgMagic;
+    pMsgHead->nType = GetMessageType(nChannel, nCommand);
+    pMsgHead->nPayloadSize = ui32PayloadSize;
+    pMsgHead->nPayloadChecksum = bigbang::crypto::CryptoHash(pPacket + NMS_MESSAGE_HEADER_SIZE, ui32PayloadSize).Get32();
+
+    // header checksum is 24 bits, its last byte overlaps the first payload byte
+    uint32 nHeaderChecksum = GetHeaderChecksum((unsigned char*)pMsgHead);
+    memcpy(pPacket + offsetof(NMS_MSG_HEAD, nHeaderChecksum), &nHeaderChecksum, NMS_MESSAGE_HEADER_SIZE - offsetof(NMS_MSG_HEAD, nHeaderChecksum));
+}
+
 bool CProtoDataBuf::AllocPacketBuf(uint32 ui32MsgMagic, int nChannel, int nCommand, CBlockheadBufStream& ssPayload)
 {
     uint32 nPacketSize = NMS_MESSAGE_HEADER_SIZE + ssPayload.GetSize();
     reserve(nPacketSize);
 
-    PNMS_MSG_HEAD pMsgHead = (PNMS_MSG_HEAD)pDataBuf;
-    pMsgHead->nMagic = ui32MsgMagic;
-    pMsgHead->nType = GetMessageType(nChannel, nCommand);
-    pMsgHead->nPayloadSize = ssPayload.GetSize();
-    pMsgHead->nPayloadChecksum = bigbang::crypto::CryptoHash(ssPayload.GetData(), ssPayload.GetSize()).Get32();
-    pMsgHead->nHeaderChecksum = GetHeaderChecksum((unsigned char*)pMsgHead);
-
     if (ssPayload.GetSize())
     {
         memcpy(pDataBuf + NMS_MESSAGE_HEADER_SIZE, ssPayload.GetData(), ssPayload.GetSize());
     }
+    SetPacketHeader(ui32MsgMagic, nChannel, nCommand, pDataBuf, ssPayload.GetSize());
     ui32DataLen = nPacketSize;
 
     return VerifyPacket(ui32MsgMagic);
 }
 
+bool CProtoDataBuf::AllocPacketBuf(uint32 ui32MsgMagic, int nChannel, int nCommand, CProtoPacketStream& ssPacket)
+{
+    ssPacket.SetHeader(ui32MsgMagic, nChannel, nCommand);
+
+    uint32 nPacketSize = ssPacket.GetSize();
+    reserve(nPacketSize);
+    memcpy(pDataBuf, ssPacket.GetData(), nPacketSize);
+    ui32DataLen = nPacketSize;
+
+    return VerifyPacket(ui32MsgMagic);
+}
+
+//-----------------------------------------------------------------------------------------------
+CProtoMsgTemplate::CProtoMsgTemplate()
+  : fInit(false), nMsgMagic(0), nHelloTimePos(0), nHelloNoncePos(0), nHelloHeightPos(0)
+{
+}
+
+CProtoMsgTemplate::~CProtoMsgTemplate()
+{
+}
+
+void CProtoMsgTemplate::Init(uint32 ui32MsgMagic, const uint256* pHashGenesisBlock)
+{
+    nMsgMagic = ui32MsgMagic;
+
+    CProtoPacketStream ssHello;
+    int iLocalVersion = PROTO_VERSION;
+    uint64 nLocalService = NODE_NETWORK;
+    int64 nTime = 0;
+    uint64 nNonce = 0;
+    string strLocalSubVer = FormatSubVersion();
+    int nHeight = 0;
+
+    ssHello << iLocalVersion << nLocalService;
+    nHelloTimePos = ssHello.GetSize();
+    ssHello << nTime;
+    nHelloNoncePos = ssHello.GetSize();
+    ssHello << nNonce << strLocalSubVer;
+    nHelloHeightPos = ssHello.GetSize();
+    ssHello << nHeight;
+    if (pHashGenesisBlock)
+    {
+        ssHello << *pHashGenesisBlock;
+    }
+    BuildPacket(BBPROTO_CMD_HELLO, ssHello, vHelloPacket);
+
+    CProtoPacketStream ssHelloAck;
+    BuildPacket(BBPROTO_CMD_HELLO_ACK, ssHelloAck, vHelloAckPacket);
+    CProtoPacketStream ssGetAddress;
+    BuildPacket(BBPROTO_CMD_GETADDRESS, ssGetAddress, vGetAddressPacket);
+
+    vHelloGetAddressPacket = vHelloPacket;
+    vHelloGetAddressPacket.insert(vHelloGetAddressPacket.end(), vGetAddressPacket.begin(), vGetAddressPacket.end());
+
+    fInit = true;
+}
+
+bool CProtoMsgTemplate::GetHelloPacket(int64 nTime, uint64 nNonce, int nHeight, char*& pBuf, uint32& ui32Len, bool fWithGetAddress)
+{
+    if (!fInit)
+    {
+        return false;
+    }
+    vector<char>& vPacket = (fWithGetAddress ? vHelloGetAddressPacket : vHelloPacket);
+    char* pPacket = &vPacket[0];
+    memcpy(pPacket + nHelloTimePos, &nTime, sizeof(nTime));
+    memcpy(pPacket + nHelloNoncePos, &nNonce, sizeof(nNonce));
+    memcpy(pPacket + nHelloHeightPos, &nHeight, sizeof(nHeight));
+    CProtoDataBuf::SetPacketHeader(nMsgMagic, BBPROTO_CHN_NETWORK, BBPROTO_CMD_HELLO, pPacket, vHelloPacket.size() - NMS_MESSAGE_HEADER_SIZE);
+
+    pBuf = pPacket;
+    ui32Len = vPacket.size();
+    return true;
+}
+
+bool CProtoMsgTemplate::GetEmptyPacket(int nCommand, char*& pBuf, uint32& ui32Len)
+{
+    if (!fInit)
+    {
+        return false;
+    }
+    vector<char>* pPacket = NULL;
+    switch (nCommand)
+    {
+    case BBPROTO_CMD_HELLO_ACK:
+        pPacket = &vHelloAckPacket;
+        break;
+    case BBPROTO_CMD_GETADDRESS:
+        pPacket = &vGetAddressPacket;
+        break;
+    default:
+        return false;
+    }
+    pBuf = &(*pPacket)[0];
+    ui32Len = pPacket->size();
+    return true;
+}
+
+void CProtoMsgTemplate::BuildPacket(int nCommand, CProtoPacketStream& ssPacket, vector<char>& vPacket)
+{
+    ssPacket.SetHeader(nMsgMagic, BBPROTO_CHN_NETWORK, nCommand);
+    vPacket.assign(ssPacket.GetData(), ssPacket.GetData() + ssPacket.GetSize());
+}
+
 ///////////////////////////////
 // CEndpoint
 
@@ -221,6 +353,11 @@ void CEndpoint::CopyTo(unsigned char* ssTo) const
     memmove(ssTo, ss, BINSIZE);
 }
 
+void CEndpoint::CopyFrom(const unsigned char* ssFrom)
+{
+    memmove(ss, ssFrom, BINSIZE);
+}
+
 bool CEndpoint::IsRoutable()
 {
     if (memcmp(epipv4, ss, 12) == 0)
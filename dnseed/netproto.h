@@ -27,6 +27,7 @@ using namespace nbase;
 
 #define NMS_MESSAGE_HEADER_SIZE 16
 #define NMS_MESSAGE_PAYLOAD_MAX_SIZE 0x400000
+#define NMS_MESSAGE_INLINE_SIZE 512
 
 //---------------------------------------------------------------------------------
 enum
@@ -69,6 +70,17 @@ typedef struct _NMS_MSG_HEAD
 #pragma pack()
 
 //---------------------------------------------------------------------------------
+// Outbound packet serialized in place, the header room is followed by the
+// payload. Small messages never leave the stack buffer.
+class CProtoPacketStream : public CBlockheadInlineStream<NMS_MESSAGE_INLINE_SIZE>
+{
+public:
+    CProtoPacketStream();
+
+    uint32 GetPayloadSize();
+    void SetHeader(uint32 ui32MsgMagic, int nChannel, int nCommand);
+};
+
 class CProtoDataBuf : public CMthDataBuf
 {
 public:
@@ -88,6 +100,7 @@ public:
     {
         return bigbang::crypto::crc24q(pBuf, 13);
     }
+    static void SetPacketHeader(uint32 ui32MsgMagic, int nChannel, int nCommand, char* pPacket, uint32 ui32PayloadSize);
 
     unsigned char* GetPayload(uint32& ui32PayloadLen);
     bool GetPayload(CBlockheadBufStream& ssPayload);
@@ -96,11 +109,44 @@ public:
     void ErasePacket();
     bool AllocPacketBuf(uint32 ui32MsgMagic, int nChannel, int nCommand,
                         CBlockheadBufStream& ssPayload);
+    bool AllocPacketBuf(uint32 ui32MsgMagic, int nChannel, int nCommand,
+                        CProtoPacketStream& ssPacket);
 
 private:
     bool fPacketVerifyIntegrity;
 };
 
+// Pre-encoded handshake packets, built once per work thread. Only the time,
+// nonce and height fields of HELLO change between connections, so they are
+// patched in place; HELLO_ACK and GETADDRESS have constant packets.
+class CProtoMsgTemplate
+{
+public:
+    CProtoMsgTemplate();
+    ~CProtoMsgTemplate();
+
+    void Init(uint32 ui32MsgMagic, const uint256* pHashGenesisBlock);
+
+    bool GetHelloPacket(int64 nTime, uint64 nNonce, int nHeight, char*& pBuf, uint32& ui32Len, bool fWithGetAddress = false);
+    bool GetEmptyPacket(int nCommand, char*& pBuf, uint32& ui32Len);
+
+private:
+    void BuildPacket(int nCommand, CProtoPacketStream& ssPacket, vector<char>& vPacket);
+
+private:
+    bool fInit;
+    uint32 nMsgMagic;
+
+    vector<char> vHelloPacket;
+    uint32 nHelloTimePos;
+    uint32 nHelloNoncePos;
+    uint32 nHelloHeightPos;
+
+    vector<char> vHelloAckPacket;
+    vector<char> vGetAddressPacket;
+    vector<char> vHelloGetAddressPacket; /*HELLO followed by GETADDRESS, sent in one write*/
+};
+
 class CEndpoint : public blockhead::CBinary
 {
 public:
@@ -114,6 +160,7 @@ public:
     void SetEndpoint(const boost::asio::ip::tcp::endpoint& ep);
     void GetEndpoint(boost::asio::ip::tcp::endpoint& ep);
     void CopyTo(unsigned char* ssTo) const;
+    void CopyFrom(const unsigned char* ssFrom);
     bool IsRoutable();
     const CEndpoint& operator=(const CEndpoint& other)
     {
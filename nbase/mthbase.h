@@ -7,6 +7,7 @@
 #include <boost/thread.hpp>
 #include <iostream>
 #include <queue>
+#include <vector>
 
 #include "blockhead/type.h"
 #include "blockhead/util.h"
@@ -391,6 +392,25 @@ public:
         return PrtGetData(lock, data, ui32Timeout);
     }
 
+    /* Waits like GetData for the first item, then takes what is queued up to ui32MaxCount */
+    uint32 GetDataBatch(std::vector<T>& vData, uint32 ui32MaxCount, uint32 ui32Timeout = 0)
+    {
+        boost::unique_lock<boost::mutex> lock(lockQueue);
+        T data;
+        uint32 ui32Count = 0;
+        if (ui32MaxCount > 0 && PrtGetData(lock, data, ui32Timeout))
+        {
+            vData.push_back(data);
+            ui32Count++;
+            while (ui32Count < ui32MaxCount && PrtGetData(lock, data, 0))
+            {
+                vData.push_back(data);
+                ui32Count++;
+            }
+        }
+        return ui32Count;
+    }
+
     uint32 GetCount()
     {
         boost::unique_lock<boost::mutex> lock(lockQueue);
@@ -129,29 +129,31 @@ typedef enum _E_DISCONNECT_CAUSE
     NET_DIS_CAUSE_PEER_CLOSE,
     NET_DIS_CAUSE_LOCAL_CLOSE,
     NET_DIS_CAUSE_CONNECT_SUCCESS,
-    NET_DIS_CAUSE_CONNECT_FAIL
+    NET_DIS_CAUSE_CONNECT_FAIL,
+    NET_DIS_CAUSE_CONNECT_LOCAL_FAIL /*timed out or out of local sockets, ports or memory*/
 } E_DISCONNECT_CAUSE;
 
 class CMthNetPackData : public CMthDataBuf
 {
 public:
     CMthNetPackData()
-      : ui64NetId(0) {}
+      : ui64NetId(0), ui64ConnTag(0) {}
     CMthNetPackData(uint64 nNetIdIn, E_NET_MSG_TYPE eMsgTypeIn, E_DISCONNECT_CAUSE eCauseIn,
                     CMthNetEndpoint& naPeer, CMthNetEndpoint& naLocal, char* p, uint32 n)
-      : ui64NetId(nNetIdIn), eMsgType(eMsgTypeIn), eDisCause(eCauseIn),
+      : ui64NetId(nNetIdIn), ui64ConnTag(0), eMsgType(eMsgTypeIn), eDisCause(eCauseIn),
         epPeerAddr(naPeer), epLocalAddr(naLocal), CMthDataBuf(p, n)
     {
     }
     CMthNetPackData(uint64 nNetIdIn, E_NET_MSG_TYPE eMsgTypeIn, E_DISCONNECT_CAUSE eCauseIn,
                     CMthNetEndpoint& naPeer, CMthNetEndpoint& naLocal)
-      : ui64NetId(nNetIdIn), eMsgType(eMsgTypeIn), eDisCause(eCauseIn),
+      : ui64NetId(nNetIdIn), ui64ConnTag(0), eMsgType(eMsgTypeIn), eDisCause(eCauseIn),
         epPeerAddr(naPeer), epLocalAddr(naLocal)
     {
     }
 
 public:
     uint64 ui64NetId;
+    uint64 ui64ConnTag; /*tag of the connect request, in COMPLETE_NOTIFY*/
     E_NET_MSG_TYPE eMsgType;
     E_DISCONNECT_CAUSE eDisCause;
     CMthNetEndpoint epPeerAddr;
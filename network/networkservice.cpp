@@ -4,6 +4,8 @@
 
 #include "networkservice.h"
 
+#include <dirent.h>
+
 #include "nbase/mthbase.h"
 #include "networkthread.h"
 #include "tcpconnect.h"
@@ -283,7 +285,7 @@ bool CNetWorkService::ReqSendData(CMthNetPackData* pNvBuf)
     return true;
 }
 
-bool CNetWorkService::ReqTcpConnect(CMthNetEndpoint& epPeer, uint64& nNetIdOut)
+bool CNetWorkService::ReqTcpConnect(CMthNetEndpoint& epPeer, uint64& nNetIdOut, uint64 nConnTag)
 {
     uint32 nWorkThreadIndex = AddStatNetPort();
     if (pNetworkThreadTable[nWorkThreadIndex] == NULL)
@@ -293,7 +295,7 @@ bool CNetWorkService::ReqTcpConnect(CMthNetEndpoint& epPeer, uint64& nNetIdOut)
         RemoveStatNetPort(nWorkThreadIndex);
         return false;
     }
-    if (!pNetworkThreadTable[nWorkThreadIndex]->PostTcpConnectRequest(epPeer, nNetIdOut))
+    if (!pNetworkThreadTable[nWorkThreadIndex]->PostTcpConnectRequest(epPeer, nNetIdOut, nConnTag))
     {
         blockhead::StdError(__PRETTY_FUNCTION__, "PostTcpConnectRequest fail.");
         RemoveStatNetPort(nWorkThreadIndex);
@@ -314,6 +316,40 @@ void CNetWorkService::RemoveNetPort(uint64 nNetId)
     }
 }
 
+void CNetWorkService::StatNetThread(vector<CNetThreadStat>& vStat)
+{
+    vStat.resize(ui32NetWorkThreadCount);
+    for (uint32 i = 0; i < ui32NetWorkThreadCount; i++)
+    {
+        if (pNetworkThreadTable[i])
+        {
+            pNetworkThreadTable[i]->GetStat(vStat[i]);
+        }
+    }
+}
+
+// Descriptors open in the process, 0 when /proc is not available
+uint32 CNetWorkService::GetOpenFdCount()
+{
+    DIR* pDir = opendir("/proc/self/fd");
+    if (pDir == NULL)
+    {
+        return 0;
+    }
+    uint32 nCount = 0;
+    struct dirent* pEntry;
+    while ((pEntry = readdir(pDir)) != NULL)
+    {
+        if (pEntry->d_name[0] != '.')
+        {
+            nCount++;
+        }
+    }
+    closedir(pDir);
+    /*the descriptor of the directory itself*/
+    return (nCount > 0 ? nCount - 1 : 0);
+}
+
 //--------------------------------------------------------------------------------------------
 void CNetWorkService::ListenWork()
 {
@@ -57,6 +57,19 @@ private:
 class CNetWorkThread;
 class CTcpConnect;
 
+// Connection counts of one network thread. A connection is closing from the
+// socket close until its last asynchronous operation completes.
+class CNetThreadStat
+{
+public:
+    CNetThreadStat()
+      : nTcpConnectCount(0), nOpenSocketCount(0), nClosingCount(0) {}
+
+    uint32 nTcpConnectCount;
+    uint32 nOpenSocketCount;
+    uint32 nClosingCount;
+};
+
 class CNetWorkService
 {
     friend class CNetWorkThread;
@@ -82,9 +95,13 @@ public:
 
     CNetDataQueue& GetWorkRecvQueue(uint32 nWorkThreadIndex);
     bool ReqSendData(CMthNetPackData* pNvBuf);
-    bool ReqTcpConnect(CMthNetEndpoint& epPeer, uint64& nNetIdOut);
+    /* nConnTag comes back in the COMPLETE_NOTIFY of the connect */
+    bool ReqTcpConnect(CMthNetEndpoint& epPeer, uint64& nNetIdOut, uint64 nConnTag = 0);
     void RemoveNetPort(uint64 nNetId);
 
+    void StatNetThread(vector<CNetThreadStat>& vStat);
+    static uint32 GetOpenFdCount();
+
 private:
     void ListenWork();
 
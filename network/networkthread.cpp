@@ -19,7 +19,7 @@ namespace network
 //--------------------------------------------------------------------------------------------------------
 CNetWorkThread::CNetWorkThread(uint16 usThreadWorkIdIn, CNetWorkService& inNetWork)
   : usThreadWorkId(usThreadWorkIdIn), tNetWorkService(inNetWork), workClientWork(ioServiceClientWork),
-    pThreadClientWork(NULL), pTimerClientWork(NULL)
+    pThreadClientWork(NULL), pTimerClientWork(NULL), nTcpConnectCount(0), nOpenSocketCount(0)
 {
     qRecvQueue.SetLowTrigger(20, boost::bind(&CNetWorkThread::PostRecvRequest, this, _1));
 }
@@ -87,6 +87,7 @@ void CNetWorkThread::Disconnect(CTcpConnect* pTcpConnIn)
             mapTcpRemove.insert(make_pair(pTcpConnIn->GetTcpConnNetId(), pTcpConnIn));
         }
         mapTcpConn.erase(pTcpConnIn->GetTcpConnNetId());
+        mapTcpClosing.erase(pTcpConnIn->GetTcpConnNetId());
         tNetWorkService.RemoveStatNetPort(usThreadWorkId);
     }
 }
@@ -99,9 +100,9 @@ void CNetWorkThread::RemoveTcpConnect(CTcpConnect* pTcpConnIn)
     }
 }
 
-bool CNetWorkThread::PostTcpConnectRequest(CMthNetEndpoint& epPeer, uint64& nNetIdOut)
+bool CNetWorkThread::PostTcpConnectRequest(CMthNetEndpoint& epPeer, uint64& nNetIdOut, uint64 nConnTag)
 {
-    CTcpConnect* pTcpConnect = new CTcpConnect(*this, epPeer);
+    CTcpConnect* pTcpConnect = new CTcpConnect(*this, epPeer, nConnTag);
     if (pTcpConnect == NULL)
     {
         StdError("NetWorkThread", "PostTcpConnectRequest: new CTcpConnect fail.");
@@ -137,11 +138,38 @@ void CNetWorkThread::PostRecvRequest(uint64 nNetId)
     ioServiceClientWork.post(boost::bind(&CNetWorkThread::HandleRecvRequest, this, nNetId));
 }
 
+void CNetWorkThread::GetStat(CNetThreadStat& tStat)
+{
+    boost::unique_lock<boost::mutex> lock(lockStat);
+    tStat.nTcpConnectCount = nTcpConnectCount;
+    tStat.nOpenSocketCount = nOpenSocketCount;
+    tStat.nClosingCount = nTcpConnectCount - nOpenSocketCount;
+}
+
+void CNetWorkThread::AddConnectStat(int nConnect, int nOpenSocket)
+{
+    boost::unique_lock<boost::mutex> lock(lockStat);
+    nTcpConnectCount += nConnect;
+    nOpenSocketCount += nOpenSocket;
+}
+
 //--------------------------------------------------------------------------------------------
+// Closed connections are deleted by their last completion handler, the
+// timer only sweeps the ones left without a pending operation and closes
+// the ones whose send queue did not drain in time.
 void CNetWorkThread::DoTcpRemoveTimer()
 {
     CTcpConnect* pTcpConn;
     map<uint64, CTcpConnect*>::iterator it;
+    for (it = mapTcpClosing.begin(); it != mapTcpClosing.end();)
+    {
+        pTcpConn = it->second;
+        it++;
+        if (pTcpConn)
+        {
+            pTcpConn->DoCloseTimer();
+        }
+    }
     for (it = mapTcpRemove.begin(); it != mapTcpRemove.end();)
     {
         pTcpConn = it->second;
@@ -206,7 +234,10 @@ void CNetWorkThread::HandleSendData(CMthNetPackData* pNvBuf)
             it->second->SetSendData(pNvBuf);
             return;
         case NET_MSG_TYPE_CLOSE:
-            it->second->TcpRemove(NET_DIS_CAUSE_LOCAL_CLOSE);
+            if (it->second->CloseAfterSend())
+            {
+                mapTcpClosing.insert(*it);
+            }
             break;
         }
     }
@@ -230,6 +261,9 @@ void CNetWorkThread::HandleConnectCompleted(CTcpConnect* pTcpConnect, const boos
         return;
     }
 
+    /*the connect operation is done, the socket is only referenced by reads and writes now*/
+    pTcpConnect->nRefCount--;
+
     bool fIfSuccess = false;
     if (!ec)
     {
@@ -262,10 +296,22 @@ void CNetWorkThread::HandleConnectCompleted(CTcpConnect* pTcpConnect, const boos
             }
         }
 
-        pTcpConnect->ConnectFail();
+        pTcpConnect->ConnectFail(IsLocalConnectFail(ec) ? NET_DIS_CAUSE_CONNECT_LOCAL_FAIL : NET_DIS_CAUSE_CONNECT_FAIL);
         tNetWorkService.RemoveStatNetPort(usThreadWorkId);
         delete pTcpConnect;
     }
 }
 
+// Failures that tell this host is overloaded rather than that the peer is
+// down or refuses, a refused or unreachable peer is ordinary for a seeder.
+bool CNetWorkThread::IsLocalConnectFail(const boost::system::error_code& ec)
+{
+    return (ec == boost::system::errc::timed_out
+            || ec == boost::system::errc::too_many_files_open
+            || ec == boost::system::errc::too_many_files_open_in_system
+            || ec == boost::system::errc::no_buffer_space
+            || ec == boost::system::errc::not_enough_memory
+            || ec == boost::system::errc::address_not_available);
+}
+
 } // namespace network
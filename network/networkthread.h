@@ -27,6 +27,7 @@ using boost::asio::ip::tcp;
 class CNetWorkService;
 class CTcpConnect;
 class CMthNetPackData;
+class CNetThreadStat;
 
 class CNetWorkThread
 {
@@ -55,15 +56,18 @@ public:
 
     void Disconnect(CTcpConnect* pTcpConnIn);
     void RemoveTcpConnect(CTcpConnect* pTcpConnIn);
-    bool PostTcpConnectRequest(CMthNetEndpoint& epPeer, uint64& nNetIdOut);
+    bool PostTcpConnectRequest(CMthNetEndpoint& epPeer, uint64& nNetIdOut, uint64 nConnTag);
     void PostAccept(CTcpConnect* pTcpConnect);
     void PostSendData(CMthNetPackData* pNvBuf);
     void PostRecvRequest(uint64 nNetId);
 
+    void GetStat(CNetThreadStat& tStat);
+
 private:
     void Work();
 
     void DoTcpRemoveTimer();
+    void AddConnectStat(int nConnect, int nOpenSocket);
 
     void HandleTimer(const boost::system::error_code& err);
     void HandleAccept(CTcpConnect* pTcpConnect);
@@ -71,6 +75,8 @@ private:
     void HandleRecvRequest(uint64 nNetId);
     void HandleConnectCompleted(CTcpConnect* pTcpConnect, const boost::system::error_code& ec);
 
+    static bool IsLocalConnectFail(const boost::system::error_code& ec);
+
 private:
     CNetWorkService& tNetWorkService;
     uint16 usThreadWorkId;
@@ -82,6 +88,12 @@ private:
 
     std::map<uint64, CTcpConnect*> mapTcpConn;
     std::map<uint64, CTcpConnect*> mapTcpRemove;
+    std::map<uint64, CTcpConnect*> mapTcpClosing; /*close requested, waits for the send queue*/
+
+    /*CTcpConnect objects are created outside the thread too*/
+    boost::mutex lockStat;
+    uint32 nTcpConnectCount;
+    uint32 nOpenSocketCount;
 
     CNetDataQueue qRecvQueue;
 };
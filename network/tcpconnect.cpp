@@ -18,24 +18,31 @@ namespace network
 
 CTcpConnect::CTcpConnect(CNetWorkThread& inNetWorkThread, uint64 nListenNetId, CMthNetEndpoint& epListen)
   : socketClient(inNetWorkThread.GetIoService()), tNetWorkThread(inNetWorkThread),
-    ui64LinkListenNetId(nListenNetId), epLinkListen(epListen), pCurSendNvBuf(NULL), nPostRecvOpCount(0), nRefCount(0)
+    ui64LinkListenNetId(nListenNetId), ui64ConnTag(0), epLinkListen(epListen), pCurSendNvBuf(NULL), nPostRecvOpCount(0), nRefCount(0)
 {
     fInBound = true;
     fIfOpenSocket = true;
+    fClosePending = false;
+    tmCloseTime = 0;
     ui64TcpConnNetId = CBaseUniqueId::CreateUniqueId(0, 0, inNetWorkThread.GetThreadId(), 0);
+    tNetWorkThread.AddConnectStat(1, 1);
 }
 
-CTcpConnect::CTcpConnect(CNetWorkThread& inNetWorkThread, CMthNetEndpoint& epPeer)
+CTcpConnect::CTcpConnect(CNetWorkThread& inNetWorkThread, CMthNetEndpoint& epPeer, uint64 nConnTag)
   : socketClient(inNetWorkThread.GetIoService()), tNetWorkThread(inNetWorkThread),
-    epPeer(epPeer), pCurSendNvBuf(NULL), nPostRecvOpCount(0), nRefCount(0)
+    ui64ConnTag(nConnTag), epPeer(epPeer), pCurSendNvBuf(NULL), nPostRecvOpCount(0), nRefCount(0)
 {
     fInBound = false;
     fIfOpenSocket = true;
+    fClosePending = false;
+    tmCloseTime = 0;
     ui64TcpConnNetId = CBaseUniqueId::CreateUniqueId(0, 1, inNetWorkThread.GetThreadId(), 0);
+    tNetWorkThread.AddConnectStat(1, 1);
 }
 
 CTcpConnect::~CTcpConnect()
 {
+    tNetWorkThread.AddConnectStat(-1, (fIfOpenSocket ? -1 : 0));
     if (fIfOpenSocket)
     {
         try
@@ -123,6 +130,7 @@ void CTcpConnect::TcpRemove(E_DISCONNECT_CAUSE eCloseCause)
         }
         fIfOpenSocket = false;
         tmCloseTime = time(NULL);
+        tNetWorkThread.AddConnectStat(0, -1);
     }
 
     if (nRefCount == 0)
@@ -132,11 +140,28 @@ void CTcpConnect::TcpRemove(E_DISCONNECT_CAUSE eCloseCause)
     }
 }
 
+// A local close waits until the queued data is written, so the last reply
+// reaches the peer. Returns true while the close is pending.
+bool CTcpConnect::CloseAfterSend()
+{
+    if (pCurSendNvBuf == NULL || !fIfOpenSocket)
+    {
+        TcpRemove(NET_DIS_CAUSE_LOCAL_CLOSE);
+        return false;
+    }
+    if (!fClosePending)
+    {
+        fClosePending = true;
+        tmCloseTime = time(NULL);
+    }
+    return true;
+}
+
 void CTcpConnect::SetSendData(CMthNetPackData* pNvBuf)
 {
     if (pNvBuf)
     {
-        if (pNvBuf->GetDataBuf() && pNvBuf->GetDataLen() > 0)
+        if (pNvBuf->GetDataBuf() && pNvBuf->GetDataLen() > 0 && !fClosePending)
         {
             if (pCurSendNvBuf == NULL)
             {
@@ -197,6 +222,7 @@ bool CTcpConnect::ConnectCompleted()
         return false;
     }
     CMthNetPackData* pMthBuf = new CMthNetPackData(ui64TcpConnNetId, NET_MSG_TYPE_COMPLETE_NOTIFY, NET_DIS_CAUSE_CONNECT_SUCCESS, epPeer, epLocal);
+    pMthBuf->ui64ConnTag = ui64ConnTag;
     if (!tNetWorkThread.qRecvQueue.SetData(pMthBuf, 4000))
     {
         StdError("TcpConnect", "ConnectCompleted: SetData fail");
@@ -207,9 +233,10 @@ bool CTcpConnect::ConnectCompleted()
     return true;
 }
 
-void CTcpConnect::ConnectFail()
+void CTcpConnect::ConnectFail(E_DISCONNECT_CAUSE eCause)
 {
-    CMthNetPackData* pMthBuf = new CMthNetPackData(ui64TcpConnNetId, NET_MSG_TYPE_COMPLETE_NOTIFY, NET_DIS_CAUSE_CONNECT_FAIL, epPeer, epLocal);
+    CMthNetPackData* pMthBuf = new CMthNetPackData(ui64TcpConnNetId, NET_MSG_TYPE_COMPLETE_NOTIFY, eCause, epPeer, epLocal);
+    pMthBuf->ui64ConnTag = ui64ConnTag;
     if (!tNetWorkThread.qRecvQueue.SetData(pMthBuf, 4000))
     {
         StdError("TcpConnect", "ConnectFail: SetData fail");
@@ -219,13 +246,21 @@ void CTcpConnect::ConnectFail()
 
 void CTcpConnect::DoRemoveTimer()
 {
-    if (!fIfOpenSocket && time(NULL) - tmCloseTime > 5)
+    if (!fIfOpenSocket && nRefCount == 0)
     {
         tNetWorkThread.RemoveTcpConnect(this);
         delete this;
     }
 }
 
+void CTcpConnect::DoCloseTimer()
+{
+    if (fClosePending && time(NULL) - tmCloseTime >= 5)
+    {
+        TcpRemove(NET_DIS_CAUSE_LOCAL_CLOSE);
+    }
+}
+
 //---------------------------------------------------------------------------------------------------
 void CTcpConnect::HandleRead(const boost::system::error_code& ec, std::size_t bytes_transferred)
 {
@@ -234,6 +269,12 @@ void CTcpConnect::HandleRead(const boost::system::error_code& ec, std::size_t by
     {
         nPostRecvOpCount--;
     }
+    if (!fIfOpenSocket)
+    {
+        /*closed while the read was pending, the last handler deletes the connection*/
+        TcpRemove(NET_DIS_CAUSE_LOCAL_CLOSE);
+        return;
+    }
 
     if (!ec)
     {
@@ -261,6 +302,11 @@ void CTcpConnect::HandleRead(const boost::system::error_code& ec, std::size_t by
 void CTcpConnect::HandleWrite(const boost::system::error_code& ec, std::size_t bytes_transferred)
 {
     nRefCount--;
+    if (!fIfOpenSocket)
+    {
+        TcpRemove(NET_DIS_CAUSE_LOCAL_CLOSE);
+        return;
+    }
     if (!ec)
     {
         if (pCurSendNvBuf)
@@ -286,6 +332,10 @@ void CTcpConnect::HandleWrite(const boost::system::error_code& ec, std::size_t b
                 }
             }
         }
+        if (pCurSendNvBuf == NULL && fClosePending)
+        {
+            TcpRemove(NET_DIS_CAUSE_LOCAL_CLOSE);
+        }
     }
     else
     {
@@ -33,7 +33,7 @@ class CTcpConnect
 
 public:
     CTcpConnect(CNetWorkThread& inNetWorkThread, uint64 nListenNetId, CMthNetEndpoint& epListen);
-    CTcpConnect(CNetWorkThread& inNetWorkThread, CMthNetEndpoint& epPeer);
+    CTcpConnect(CNetWorkThread& inNetWorkThread, CMthNetEndpoint& epPeer, uint64 nConnTag);
     ~CTcpConnect();
 
     uint64 GetTcpConnNetId() const
@@ -47,13 +47,15 @@ public:
 
     bool Accept();
     void TcpRemove(E_DISCONNECT_CAUSE eCloseCause);
+    bool CloseAfterSend();
     void SetSendData(CMthNetPackData* pNvBuf);
     void PostRecvRequest();
     void PostSendRequest();
     bool ConnectCompleted();
-    void ConnectFail();
+    void ConnectFail(E_DISCONNECT_CAUSE eCause);
 
     void DoRemoveTimer();
+    void DoCloseTimer();
 
 private:
     void HandleRead(const boost::system::error_code& ec, std::size_t bytes_transferred);
@@ -62,11 +64,13 @@ private:
 private:
     bool fInBound;
     bool fIfOpenSocket;
+    bool fClosePending;
     uint32 nRefCount;
     time_t tmCloseTime;
 
     uint64 ui64TcpConnNetId;
     uint64 ui64LinkListenNetId;
+    uint64 ui64ConnTag;
     CMthNetEndpoint epLinkListen;
     tcp::socket socketClient;
     CMthNetEndpoint epPeer;
@@ -0,0 +1,243 @@
+// bench_dblog.cpp
+//
+// Runs CDbStorage against the embedded log backend, no database service is
+// needed. Writes an insert/update/delete workload with and without the
+// journal, replays a journal left by a storage that was never started, reads
+// the table back and checks it after each run, measures single-row upserts,
+// then compacts the file and checks the table again after reopening it.
+
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbc/dbclog.h"
+#include "dnseed/addrpool.h"
+#include "dnseed/dbstorage.h"
+
+using namespace std;
+using namespace dnseed;
+
+static string GetBenchIp(uint32 n)
+{
+    uint32 nIp = 0x01000000 + n;
+    return to_string(nIp >> 24) + "." + to_string((nIp >> 16) & 0xFF) + "."
+           + to_string((nIp >> 8) & 0xFF) + "." + to_string(nIp & 0xFF);
+}
+
+static void PostWait(CDbStorage& tDbStorage, CDNSeedNode* pNode)
+{
+    while (!tDbStorage.PostDbMessage(pNode))
+    {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+}
+
+// Addresses 0..n-1 are inserted with score 0, updated to score 1, and every
+// fourth one is deleted
+static uint32 PostWorkload(CDbStorage& tDbStorage, uint32 nRowCount)
+{
+    uint32 nMsgCount = 0;
+    for (uint32 i = 0; i < nRowCount; i++, nMsgCount++)
+    {
+        PostWait(tDbStorage, new CDNSeedNode(DDN_E_MSG_TYPE_INSERT, GetBenchIp(i), 9901, NODE_NETWORK, 0));
+    }
+    for (uint32 i = 0; i < nRowCount; i++, nMsgCount++)
+    {
+        PostWait(tDbStorage, new CDNSeedNode(DDN_E_MSG_TYPE_UPDATE, GetBenchIp(i), 9901, NODE_NETWORK, 1));
+    }
+    for (uint32 i = 0; i < nRowCount; i += 4, nMsgCount++)
+    {
+        PostWait(tDbStorage, new CDNSeedNode(DDN_E_MSG_TYPE_DELETE, GetBenchIp(i), 9901, NODE_NETWORK, 0));
+    }
+    return nMsgCount;
+}
+
+static void WaitWritten(CDbStorage& tDbStorage)
+{
+    while (tDbStorage.GetMsgQueueSize() > 0)
+    {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+}
+
+static bool BenchStorage(CDbcConfig& tDbCfg, CBbAddrPool& tAddrPool, uint32 nRowCount, uint32 nWriterCount, const string& strJournal)
+{
+    CDbStorage tDbStorage(&tDbCfg, &tAddrPool);
+    tDbStorage.SetStatParam(false, DDN_D_STAT_TIME);
+    tDbStorage.SetBatchParam(NMS_CFG_DB_BATCH_COUNT, 0);
+    tDbStorage.SetWriterParam(nWriterCount);
+    if (!tDbStorage.SetJournalParam(strJournal))
+    {
+        printf("storage: open journal fail.\n");
+        return false;
+    }
+
+    chrono::steady_clock::time_point tmBegin = chrono::steady_clock::now();
+    if (!tDbStorage.Start())
+    {
+        printf("storage: start fail.\n");
+        return false;
+    }
+    uint32 nMsgCount = PostWorkload(tDbStorage, nRowCount);
+    WaitWritten(tDbStorage);
+    tDbStorage.Stop();
+    double dMs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - tmBegin).count() / 1000.0;
+
+    CDbStatData tDbStat;
+    tDbStorage.StatDbData(tDbStat);
+    printf("storage, writer %2u, journal %s: messages: %8u, %10.1f ms, %12.0f rows/s\n",
+           nWriterCount, (strJournal.empty() ? "off" : "on "), nMsgCount, dMs, nMsgCount * 1000.0 / dMs);
+    printf("    insert p50/p99/max: %lu/%lu/%lu us, commit p99: %lu us, txn: %lu, queue peak: %u, journal peak: %lu\n",
+           tDbStat.tExecTime[DDN_E_STMT_TYPE_INSERT].GetPercentile(50), tDbStat.tExecTime[DDN_E_STMT_TYPE_INSERT].GetPercentile(99),
+           tDbStat.tExecTime[DDN_E_STMT_TYPE_INSERT].nMaxTime, tDbStat.tCommitTime.GetPercentile(99),
+           tDbStat.nTxnCount, tDbStat.nQueuePeak, tDbStat.nJournalPeak);
+    return true;
+}
+
+// The first storage only journals the workload, as if it stopped before the
+// writers got to it, the second one replays the journal into the table
+static bool ReplayJournal(CDbcConfig& tDbCfg, CBbAddrPool& tAddrPool, uint32 nRowCount, const string& strJournal)
+{
+    {
+        CDbStorage tDbStorage(&tDbCfg, &tAddrPool);
+        if (!tDbStorage.SetJournalParam(strJournal))
+        {
+            printf("replay: open journal fail.\n");
+            return false;
+        }
+        PostWorkload(tDbStorage, nRowCount);
+    }
+
+    CDbStorage tDbStorage(&tDbCfg, &tAddrPool);
+    tDbStorage.SetStatParam(false, DDN_D_STAT_TIME);
+    if (!tDbStorage.SetJournalParam(strJournal) || !tDbStorage.Start())
+    {
+        printf("replay: start fail.\n");
+        return false;
+    }
+    WaitWritten(tDbStorage);
+    tDbStorage.Stop();
+    return true;
+}
+
+static bool CheckTable(CDbcLogDbConnect* pDbConn, uint32 nRowCount)
+{
+    uint32 nExpectCount = nRowCount - (nRowCount + 3) / 4;
+    uint32 nCount = 0;
+    CDbcSelect* pSelect = pDbConn->SelectRows(0, 0);
+    if (pSelect == NULL)
+    {
+        printf("check: query fail.\n");
+        return false;
+    }
+    while (pSelect->MoveNext())
+    {
+        int iPort = 0;
+        int iScore = 0;
+        if (!pSelect->GetField(2, iPort) || !pSelect->GetField(4, iScore) || iPort != 9901 || iScore != 1)
+        {
+            break;
+        }
+        nCount++;
+    }
+    pSelect->Release();
+
+    if (nCount != nExpectCount)
+    {
+        printf("check: rows: %u, expect: %u.\n", nCount, nExpectCount);
+        return false;
+    }
+    return true;
+}
+
+static bool BenchRow(CDbcLogDbConnect* pDbConn, uint32 nRowCount)
+{
+    chrono::steady_clock::time_point tmBegin = chrono::steady_clock::now();
+    for (uint32 i = 0; i < nRowCount; i++)
+    {
+        if (!pDbConn->PutRow(GetBenchIp(i), 9902, NODE_NETWORK, (int)i, true))
+        {
+            printf("row: put fail.\n");
+            return false;
+        }
+    }
+    double dRowUs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - tmBegin).count() / 1000.0;
+
+    for (uint32 i = 0; i < nRowCount; i++)
+    {
+        if (!pDbConn->DeleteRow(GetBenchIp(i), 9902))
+        {
+            printf("row: delete fail.\n");
+            return false;
+        }
+    }
+
+    printf("row upsert: %8u rows, %10.2f us/row\n", nRowCount, dRowUs / nRowCount);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    uint32 nRowCount = (argc > 1 ? strtoul(argv[1], NULL, 10) : 200000);
+    uint32 nWriterCount = (argc > 2 ? strtoul(argv[2], NULL, 10) : 4);
+    string strFile = (argc > 3 ? argv[3] : (boost::filesystem::temp_directory_path() / "bench_dblog.dblog").string());
+    if (nRowCount == 0 || nWriterCount == 0)
+    {
+        printf("Usage: %s [row count] [writer count] [file]\n", argv[0]);
+        return 1;
+    }
+    string strJournal = strFile + ".journal";
+    boost::filesystem::remove(strFile);
+    boost::filesystem::remove_all(strJournal);
+
+    CDbcConfig tDbCfg;
+    tDbCfg.iDbType = DBC_DBTYPE_LOG;
+    tDbCfg.sDbFile = strFile;
+
+    CDnseedConfig tCfg;
+    CBbAddrPool tAddrPool(&tCfg);
+    CDbcLogDbConnect* pDbConn = new CDbcLogDbConnect(tDbCfg);
+
+    bool fOk = true;
+    for (int i = 0; fOk && i < 3; i++)
+    {
+        pDbConn->DisconnectDb();
+        boost::filesystem::remove(strFile);
+        if (i == 0)
+        {
+            fOk = BenchStorage(tDbCfg, tAddrPool, nRowCount, nWriterCount, "");
+        }
+        else if (i == 1)
+        {
+            fOk = BenchStorage(tDbCfg, tAddrPool, nRowCount, nWriterCount, strJournal);
+        }
+        else
+        {
+            fOk = ReplayJournal(tDbCfg, tAddrPool, nRowCount, strJournal);
+        }
+        fOk = (fOk && pDbConn->ConnectDb() && CheckTable(pDbConn, nRowCount));
+    }
+    fOk = (fOk && BenchRow(pDbConn, nRowCount));
+
+    if (fOk)
+    {
+        uint64 nSize = boost::filesystem::file_size(strFile);
+        chrono::steady_clock::time_point tmBegin = chrono::steady_clock::now();
+        fOk = pDbConn->Compact();
+        double dMs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - tmBegin).count() / 1000.0;
+        printf("compact: %10lu -> %10lu bytes, %10.1f ms\n",
+               (unsigned long)nSize, (unsigned long)boost::filesystem::file_size(strFile), dMs);
+    }
+    pDbConn->DisconnectDb();
+
+    // The file is replayed when it is opened again
+    fOk = (fOk && pDbConn->ConnectDb() && CheckTable(pDbConn, nRowCount));
+    pDbConn->Release();
+
+    boost::filesystem::remove(strFile);
+    boost::filesystem::remove_all(strJournal);
+    printf("%s\n", (fOk ? "ok" : "fail"));
+    return (fOk ? 0 : 1);
+}
@@ -0,0 +1,152 @@
+// bench_dbstorage.cpp
+//
+// Writes the same insert/update/delete workload through CDbStorage once per
+// batch count and writer count and reports rows/s, then compares the latency of single-row
+// text and prepared upserts. Use a scratch database, the rows are written to
+// its dnseednode table and deleted again at the end of each run.
+
+#include <chrono>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dnseed/addrpool.h"
+#include "dnseed/dbstorage.h"
+
+using namespace std;
+using namespace dnseed;
+
+static string GetBenchIp(uint32 n)
+{
+    uint32 nIp = 0x01000000 + n;
+    return to_string(nIp >> 24) + "." + to_string((nIp >> 16) & 0xFF) + "."
+           + to_string((nIp >> 8) & 0xFF) + "." + to_string(nIp & 0xFF);
+}
+
+static void PostWait(CDbStorage& tDbStorage, CDNSeedNode* pNode)
+{
+    while (!tDbStorage.PostDbMessage(pNode))
+    {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+}
+
+static bool BenchStorage(CDbcConfig& tDbCfg, CBbAddrPool& tAddrPool, uint32 nRowCount, uint32 nBatchCount, uint32 nWriterCount)
+{
+    CDbStorage tDbStorage(&tDbCfg, &tAddrPool);
+    tDbStorage.SetStatParam(false, DDN_D_STAT_TIME);
+    tDbStorage.SetBatchParam(nBatchCount, 0);
+    tDbStorage.SetWriterParam(nWriterCount);
+
+    chrono::steady_clock::time_point tmBegin = chrono::steady_clock::now();
+    if (!tDbStorage.Start())
+    {
+        printf("batch %u: start fail.\n", nBatchCount);
+        return false;
+    }
+
+    const DDN_E_MSG_TYPE eMsgType[] = { DDN_E_MSG_TYPE_INSERT, DDN_E_MSG_TYPE_UPDATE, DDN_E_MSG_TYPE_DELETE };
+    for (int nPhase = 0; nPhase < 3; nPhase++)
+    {
+        for (uint32 i = 0; i < nRowCount; i++)
+        {
+            PostWait(tDbStorage, new CDNSeedNode(eMsgType[nPhase], GetBenchIp(i), 9901, NODE_NETWORK, nPhase));
+        }
+    }
+    while (tDbStorage.GetMsgQueueSize() > 0)
+    {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    // Stop waits for the batch in progress
+    tDbStorage.Stop();
+    double dMs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - tmBegin).count() / 1000.0;
+
+    printf("batch %5u, writer %2u: rows: %8u, %10.1f ms, %12.0f rows/s\n",
+           nBatchCount, nWriterCount, nRowCount * 3, dMs, nRowCount * 3 * 1000.0 / dMs);
+    return true;
+}
+
+// Single-row upserts with autocommit, rows use port 9902 and are deleted at the end
+static bool BenchStatement(CDbcConfig& tDbCfg, uint32 nRowCount)
+{
+    CDbcDbConnect* pDbConn = CDbcDbConnect::DbcCreateDbConnObj(tDbCfg);
+    if (pDbConn == NULL || !pDbConn->ConnectDb())
+    {
+        printf("statement: connect fail.\n");
+        return false;
+    }
+
+    chrono::steady_clock::time_point tmBegin = chrono::steady_clock::now();
+    for (uint32 i = 0; i < nRowCount; i++)
+    {
+        std::ostringstream oss;
+        oss << "INSERT INTO dnseednode(address,port,service,score) VALUES("
+            << "\'" << pDbConn->ToEscString(GetBenchIp(i)) << "\',9902," << NODE_NETWORK << "," << i << ")"
+            << " ON DUPLICATE KEY UPDATE service=VALUES(service),score=VALUES(score)";
+        pDbConn->ExecuteStaticSql(oss.str());
+    }
+    double dTextUs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - tmBegin).count() / 1000.0;
+
+    CDbcStatement* pStmt = pDbConn->Prepare("INSERT INTO dnseednode(address,port,service,score) VALUES(?,?,?,?)"
+                                            " ON DUPLICATE KEY UPDATE service=VALUES(service),score=VALUES(score)");
+    if (pStmt == NULL)
+    {
+        printf("statement: prepare fail.\n");
+        pDbConn->Release();
+        return false;
+    }
+    tmBegin = chrono::steady_clock::now();
+    for (uint32 i = 0; i < nRowCount; i++)
+    {
+        pStmt->Bind(0, GetBenchIp(i));
+        pStmt->Bind(1, 9902);
+        pStmt->Bind(2, (unsigned long long)NODE_NETWORK);
+        pStmt->Bind(3, (int)i + 1);
+        pStmt->Execute();
+    }
+    double dStmtUs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - tmBegin).count() / 1000.0;
+    pStmt->Release();
+
+    pDbConn->ExecuteStaticSql("DELETE FROM dnseednode WHERE port=9902");
+    pDbConn->DisconnectDb();
+    pDbConn->Release();
+
+    printf("text upsert:     %8u rows, %10.1f us/statement\n", nRowCount, dTextUs / nRowCount);
+    printf("prepared upsert: %8u rows, %10.1f us/statement\n", nRowCount, dStmtUs / nRowCount);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 6)
+    {
+        printf("Usage: %s <dbhost> <dbport> <dbname> <dbuser> <dbpass> [row count] [batch count] [writer count]\n", argv[0]);
+        return 1;
+    }
+
+    CDbcConfig tDbCfg;
+    tDbCfg.iDbType = DBC_DBTYPE_MYSQL;
+    tDbCfg.sDbIp = argv[1];
+    tDbCfg.usDbPort = (unsigned short)strtoul(argv[2], NULL, 10);
+    tDbCfg.sDbName = argv[3];
+    tDbCfg.sDbUser = argv[4];
+    tDbCfg.sDbPwd = argv[5];
+
+    uint32 nRowCount = (argc > 6 ? strtoul(argv[6], NULL, 10) : 20000);
+    uint32 nBatchCount = (argc > 7 ? strtoul(argv[7], NULL, 10) : NMS_CFG_DB_BATCH_COUNT);
+    uint32 nWriterCount = (argc > 8 ? strtoul(argv[8], NULL, 10) : 4);
+    if (nRowCount == 0 || nBatchCount == 0 || nWriterCount == 0)
+    {
+        printf("Row count, batch count and writer count must be greater than 0.\n");
+        return 1;
+    }
+
+    CDnseedConfig tCfg;
+    CBbAddrPool tAddrPool(&tCfg);
+
+    bool fOk = BenchStorage(tDbCfg, tAddrPool, nRowCount, 1, 1)
+               && BenchStorage(tDbCfg, tAddrPool, nRowCount, nBatchCount, 1)
+               && BenchStorage(tDbCfg, tAddrPool, nRowCount, nBatchCount, nWriterCount)
+               && BenchStatement(tDbCfg, nRowCount);
+    return (fOk ? 0 : 1);
+}
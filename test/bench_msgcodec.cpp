@@ -0,0 +1,90 @@
+// bench_msgcodec.cpp
+
+#include <chrono>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dnseed/netmsgcodec.h"
+
+using namespace std;
+using namespace dnseed;
+using boost::asio::ip::tcp;
+
+template <typename M, typename D>
+static bool BenchDecode(M& tMsg, uint32 nLoopCount, const char* pName)
+{
+    CBlockheadBufStream ssPayload;
+    ProtoMsgEncode(tMsg, ssPayload);
+    vector<unsigned char> vPayload((unsigned char*)ssPayload.GetData(), (unsigned char*)ssPayload.GetData() + ssPayload.GetSize());
+
+    chrono::steady_clock::time_point tmBegin = chrono::steady_clock::now();
+    for (uint32 i = 0; i < nLoopCount; i++)
+    {
+        D tOut;
+        if (!ProtoMsgDecode(vPayload.data(), vPayload.size(), tOut))
+        {
+            printf("%s: decode fail.\n", pName);
+            return false;
+        }
+    }
+    double dNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - tmBegin).count();
+
+    printf("%-26s payload: %6u bytes, %10.1f ns/msg, %12.0f msg/s, %10.1f MB/s\n",
+           pName, (uint32)vPayload.size(), dNs / nLoopCount, nLoopCount * 1e9 / dNs,
+           (double)vPayload.size() * nLoopCount * 1e3 / dNs);
+    return true;
+}
+
+template <typename M>
+static bool BenchDecode(M& tMsg, uint32 nLoopCount)
+{
+    return BenchDecode<M, M>(tMsg, nLoopCount, M::Name());
+}
+
+int main(int argc, char** argv)
+{
+    uint32 nLoopCount = 1000000;
+    if (argc > 1)
+    {
+        nLoopCount = strtoul(argv[1], NULL, 10);
+        if (nLoopCount == 0)
+        {
+            printf("Usage: %s [loop count]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    CMsgHello tHello;
+    tHello.nVersion = 10000;
+    tHello.nService = NODE_NETWORK;
+    tHello.nTime = 1560000000;
+    tHello.nNonce = 0x123456789abcdefULL;
+    tHello.strSubVer = "/BigDNSeed:1.0.2/Protocol:1.0.0/";
+    tHello.nStartingHeight = 100000;
+    tHello.fHasGenesisBlock = true;
+
+    CMsgHelloAck tHelloAck;
+    CMsgGetAddress tGetAddress;
+
+    CMsgAddress tAddress;
+    for (int i = 0; i < 1000; i++)
+    {
+        tcp::endpoint ep(boost::asio::ip::address_v4(0x0a000000 + i), 9901);
+        tAddress.vAddrList.push_back(CAddress(NODE_NETWORK, ep));
+    }
+
+    CMsgPing tPing;
+    tPing.nNonce = 0x123456789abcdefULL;
+    CMsgPong tPong;
+    tPong.nNonce = tPing.nNonce;
+
+    bool fOk = BenchDecode(tHello, nLoopCount)
+               && BenchDecode(tHelloAck, nLoopCount)
+               && BenchDecode(tGetAddress, nLoopCount)
+               && BenchDecode(tAddress, nLoopCount / 1000 + 1)
+               && BenchDecode<CMsgAddress, CMsgAddressView>(tAddress, nLoopCount, "BBPROTO_CMD_ADDRESS(view)")
+               && BenchDecode(tPing, nLoopCount)
+               && BenchDecode(tPong, nLoopCount);
+    return (fOk ? 0 : 1);
+}
@@ -0,0 +1,227 @@
+// bench_netpeer.cpp
+//
+// Drives CNetPeer through scripted inbound and outbound handshakes with
+// in-memory packets. CMsgWorkThread is replaced by the stub below (this target
+// does not link netmsgwork.cpp), the address pool is the real CBbAddrPool
+// without a database behind it.
+
+#include <chrono>
+#include <iostream>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dnseed/netmsgwork.h"
+#include "dnseed/version.h"
+
+using namespace std;
+using namespace dnseed;
+using boost::asio::ip::tcp;
+
+// The benchmark is single threaded, a plain counter is enough.
+static uint64 nAllocCount = 0;
+
+void* operator new(size_t nSize)
+{
+    nAllocCount++;
+    void* p = malloc(nSize ? nSize : 1);
+    if (p == NULL)
+    {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+static uint64 nSendPacketCount = 0;
+static uint64 nSendByteCount = 0;
+static vector<int> vSendCommand;
+
+namespace dnseed
+{
+
+//-----------------------------------------------------------------------------------------------
+CMsgWorkThread::CMsgWorkThread(uint32 nThreadCount, uint32 nThreadIndex, CDnseedConfig* pCfg, CNetWorkService* nws, CBbAddrPool* pBbAddrPoolIn,
+                               CConnectPacer* pConnectPacerIn, CProbeEndpointSet* pProbeSetIn)
+  : nWorkThreadCount(nThreadCount), nWorkThreadIndex(nThreadIndex), pDNSeedCfg(pCfg), pNetWorkService(nws), pBbAddrPool(pBbAddrPoolIn)
+{
+    fRunFlag = false;
+    pThreadMsgWork = NULL;
+    pNetDataQueue = NULL;
+    pConnectPacer = pConnectPacerIn;
+    pProbeSet = pProbeSetIn;
+    nPersCalloutAddrCount = 0;
+    nMaxSessionCount = 0;
+    tMsgTemplate.Init(pCfg->nMagicNum, &pBbAddrPoolIn->GetGenesisBlockHash());
+}
+
+CMsgWorkThread::~CMsgWorkThread()
+{
+}
+
+bool CMsgWorkThread::SendDataPacket(uint64, CMthNetEndpoint&, CMthNetEndpoint&, char* pBuf, uint32 nLen)
+{
+    if (pBuf == NULL || nLen < NMS_MESSAGE_HEADER_SIZE)
+    {
+        return false;
+    }
+    nSendPacketCount++;
+    nSendByteCount += nLen;
+    vSendCommand.push_back(((PNMS_MSG_HEAD)pBuf)->nType & 0x3F);
+    return true;
+}
+
+bool CMsgWorkThread::HandlePeerHandshaked(CNetPeer* pPeer)
+{
+    tcp::endpoint ep;
+    pPeer->tPeerEp.GetEndpoint(ep);
+    pBbAddrPool->UpdateNetTime(ep.address(), pPeer->nTimeDelta);
+    pBbAddrPool->UpdateHeight(pPeer->tPeerEp, pPeer->nStartingHeight);
+    return true;
+}
+
+bool CMsgWorkThread::KeepSession(CNetPeer*)
+{
+    return false;
+}
+
+void CMsgWorkThread::HandleSessionPong(CNetPeer*, uint32)
+{
+}
+
+} // namespace dnseed
+
+//-----------------------------------------------------------------------------------------------
+template <typename M>
+static CMthNetPackData* BuildRecvPacket(M& tMsg, uint32 nMagic, CMthNetEndpoint& tPeerEp, CMthNetEndpoint& tLocalEp)
+{
+    CProtoPacketStream ssPacket;
+    ProtoMsgEncode(tMsg, ssPacket);
+    ssPacket.SetHeader(nMagic, BBPROTO_CHN_NETWORK, M::COMMAND);
+    return new CMthNetPackData(0, NET_MSG_TYPE_DATA, NET_DIS_CAUSE_UNKNOWN, tPeerEp, tLocalEp, ssPacket.GetData(), ssPacket.GetSize());
+}
+
+static bool BenchHandshake(const char* pName, CMsgWorkThread* pWorkThread, CBbAddrPool* pAddrPool, uint32 nMagic, bool fInBound,
+                           vector<CMthNetPackData*>& vRecvPacket, vector<int>& vExpectSend, uint32 nLoopCount)
+{
+    CMthNetEndpoint tPeerEp;
+    CMthNetEndpoint tLocalEp;
+    tPeerEp.SetAddrPort("8.8.8.8", 9901);
+    tLocalEp.SetAddrPort("10.0.0.1", 9901);
+
+    vSendCommand.reserve(vExpectSend.size() * 2);
+    uint64 nPrevSendPacketCount = nSendPacketCount;
+    uint64 nPrevSendByteCount = nSendByteCount;
+    uint64 nPrevAllocCount = nAllocCount;
+
+    chrono::steady_clock::time_point tmBegin = chrono::steady_clock::now();
+    for (uint32 i = 0; i < nLoopCount; i++)
+    {
+        vSendCommand.clear();
+
+        CNetPeer* pPeer = new CNetPeer(pWorkThread, pAddrPool, nMagic, fInBound, i + 1, tPeerEp, tLocalEp, false);
+        bool fOk = (fInBound || pPeer->DoOutBoundConnectSuccess(tLocalEp));
+        for (size_t j = 0; fOk && j < vRecvPacket.size(); j++)
+        {
+            fOk = pPeer->DoRecvPacket(vRecvPacket[j]);
+        }
+        delete pPeer;
+
+        if (!fOk || vSendCommand != vExpectSend)
+        {
+            printf("%s: handshake %u fail.\n", pName, i);
+            return false;
+        }
+    }
+    double dNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - tmBegin).count();
+
+    uint64 nPacketCount = (nSendPacketCount - nPrevSendPacketCount) + (uint64)vRecvPacket.size() * nLoopCount;
+    uint64 nAllocs = nAllocCount - nPrevAllocCount;
+    printf("%-9s handshakes: %8u, packets: %9llu, send bytes: %10llu, %10.1f ns/handshake, %12.0f packets/s, %6.1f allocs/handshake\n",
+           pName, nLoopCount, (unsigned long long)nPacketCount,
+           (unsigned long long)(nSendByteCount - nPrevSendByteCount), dNs / nLoopCount,
+           nPacketCount * 1e9 / dNs, (double)nAllocs / nLoopCount);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    uint32 nLoopCount = 100000;
+    uint32 nAddrCount = 100;
+    if (argc > 1)
+    {
+        nLoopCount = strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2)
+    {
+        nAddrCount = strtoul(argv[2], NULL, 10);
+    }
+    if (nLoopCount == 0)
+    {
+        printf("Usage: %s [handshake count] [address count]\n", argv[0]);
+        return 1;
+    }
+
+    CDnseedConfig tCfg;
+    CBbAddrPool tAddrPool(&tCfg);
+    CMsgWorkThread tWorkThread(1, 0, &tCfg, NULL, &tAddrPool, NULL, NULL);
+    uint32 nMagic = tCfg.nMagicNum;
+
+    CMthNetEndpoint tPeerEp;
+    CMthNetEndpoint tLocalEp;
+
+    CMsgHello tHello;
+    tHello.nVersion = PROTO_VERSION;
+    tHello.nService = NODE_NETWORK;
+    tHello.nTime = GetTime();
+    tHello.nNonce = 0x123456789abcdefULL;
+    tHello.strSubVer = FormatSubVersion();
+    tHello.nStartingHeight = 100000;
+    tHello.hashGenesisBlock = tCfg.hashGenesisBlock;
+    tHello.fHasGenesisBlock = true;
+
+    CMsgHelloAck tHelloAck;
+    CMsgGetAddress tGetAddress;
+
+    CMsgAddress tAddress;
+    for (uint32 i = 0; i < nAddrCount; i++)
+    {
+        tcp::endpoint ep(boost::asio::ip::address_v4(0x01000000 + i), 9901);
+        tAddress.vAddrList.push_back(CAddress(NODE_NETWORK, ep));
+    }
+
+    vector<CMthNetPackData*> vInRecv;
+    vInRecv.push_back(BuildRecvPacket(tHello, nMagic, tPeerEp, tLocalEp));
+    vInRecv.push_back(BuildRecvPacket(tHelloAck, nMagic, tPeerEp, tLocalEp));
+    vInRecv.push_back(BuildRecvPacket(tGetAddress, nMagic, tPeerEp, tLocalEp));
+    vInRecv.push_back(BuildRecvPacket(tAddress, nMagic, tPeerEp, tLocalEp));
+    vector<int> vInExpect = { BBPROTO_CMD_HELLO, BBPROTO_CMD_GETADDRESS, BBPROTO_CMD_ADDRESS };
+
+    vector<CMthNetPackData*> vOutRecv;
+    vOutRecv.push_back(BuildRecvPacket(tHello, nMagic, tPeerEp, tLocalEp));
+    vOutRecv.push_back(BuildRecvPacket(tGetAddress, nMagic, tPeerEp, tLocalEp));
+    vOutRecv.push_back(BuildRecvPacket(tAddress, nMagic, tPeerEp, tLocalEp));
+    vector<int> vOutExpect = { BBPROTO_CMD_HELLO, BBPROTO_CMD_HELLO_ACK, BBPROTO_CMD_GETADDRESS, BBPROTO_CMD_ADDRESS };
+    /*GETADDRESS leaves in the HELLO write*/
+    vector<int> vPipelineExpect = { BBPROTO_CMD_HELLO, BBPROTO_CMD_HELLO_ACK, BBPROTO_CMD_ADDRESS };
+
+    printf("address per message: %u\n", nAddrCount);
+    bool fOk = BenchHandshake("inbound", &tWorkThread, &tAddrPool, nMagic, true, vInRecv, vInExpect, nLoopCount)
+               && BenchHandshake("outbound", &tWorkThread, &tAddrPool, nMagic, false, vOutRecv, vOutExpect, nLoopCount);
+    tCfg.fPipelineHandshake = true;
+    fOk = fOk && BenchHandshake("pipelined", &tWorkThread, &tAddrPool, nMagic, false, vOutRecv, vPipelineExpect, nLoopCount);
+
+    for (size_t i = 0; i < vInRecv.size(); i++)
+    {
+        delete vInRecv[i];
+    }
+    for (size_t i = 0; i < vOutRecv.size(); i++)
+    {
+        delete vOutRecv[i];
+    }
+    return (fOk ? 0 : 1);
+}
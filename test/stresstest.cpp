@@ -361,6 +361,8 @@ CStressTestMsgWorkThread::CStressTestMsgWorkThread(uint32 nThreadCount, uint32 n
 
     nStartTestTime = 0;
     nCompTestCount = 0;
+
+    tMsgTemplate.Init(pCfg->nMagicNum, NULL);
 }
 
 CStressTestMsgWorkThread::~CStressTestMsgWorkThread()
@@ -777,186 +779,166 @@ bool CStressTestNetPeer::StressTestDoOutBoundConnectSuccess(CMthNetEndpoint& tLo
 }
 
 //------------------------------------------------------------------------------------
+const CProtoMsgEntry<CStressTestNetPeer> CStressTestNetPeer::tMsgTable[] = {
+    BBPROTO_MSG_ENTRY(CStressTestNetPeer, CMsgHello, StressTestHandleHello),
+    BBPROTO_MSG_ENTRY(CStressTestNetPeer, CMsgHelloAck, StressTestHandleHelloAck),
+    BBPROTO_MSG_ENTRY(CStressTestNetPeer, CMsgGetAddress, StressTestHandleGetAddress),
+    BBPROTO_MSG_ENTRY(CStressTestNetPeer, CMsgAddressView, StressTestHandleAddress),
+};
+
 bool CStressTestNetPeer::StressTestDoPeerPacket()
+{
+    return ProtoMsgDoPacket(tMsgTable, this, tRecvDataBuf);
+}
+
+bool CStressTestNetPeer::StressTestHandleHello(CMsgHello& tMsg)
 {
     int64 nTimeRecv = GetTime();
-    switch (tRecvDataBuf.GetCommand())
+    if (nVersion != 0)
     {
-    case BBPROTO_CMD_HELLO:
+        blockhead::StdError(__PRETTY_FUNCTION__, "nVersion error.");
+        return false;
+    }
+
+    nVersion = tMsg.nVersion;
+    nService = tMsg.nService;
+    nNonceFrom = tMsg.nNonce;
+    strSubVer = tMsg.strSubVer;
+    nStartingHeight = tMsg.nStartingHeight;
+    nTimeDelta = tMsg.nTime - nTimeRecv;
+
+    if (STD_DEBUG)
     {
-        try
+        string sInfo = string("hello peer: ") + tPeerEp.ToString() + string(", height: ") + to_string(nStartingHeight);
+        blockhead::StdDebug("CFLOW", sInfo.c_str());
+    }
+
+    if (fInBound)
+    {
+        if (ePeerState == DNP_E_ST_PEER_STATE_IN_CONNECTED)
         {
-            blockhead::StdDebug("CFLOW", "Recv msg: BBPROTO_CMD_HELLO");
-            if (nVersion != 0)
+            if (!StressTestSendMsgHello())
             {
-                blockhead::StdError(__PRETTY_FUNCTION__, "nVersion error.");
+                blockhead::StdError(__PRETTY_FUNCTION__, "StressTestSendMsgHello fail.");
                 return false;
             }
+            StressTestModifyPeerState(DNP_E_ST_PEER_STATE_IN_WAIT_HELLO_ACK);
+        }
+        else
+        {
+            blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_HELLO in state error.");
+            return false;
+        }
+    }
+    else
+    {
+        if (ePeerState == DNP_E_ST_PEER_STATE_OUT_WAIT_HELLO)
+        {
+            StressTestModifyPeerState(DNP_E_ST_PEER_STATE_OUT_HANDSHAKED_COMPLETE);
+            nTimeDelta += (nTimeRecv - nSendHelloTime) / 2;
+            pMsgWorkThread->StressTestHandlePeerHandshaked(this);
 
-            CBlockheadBufStream ssPayload;
-            if (!tRecvDataBuf.GetPayload(ssPayload))
+            if (!StressTestSendMsgHelloAck())
             {
-                blockhead::StdError(__PRETTY_FUNCTION__, "GetPayload fail.");
+                blockhead::StdError(__PRETTY_FUNCTION__, "StressTestSendMsgHelloAck fail.");
                 return false;
             }
-
-            int64 nTime;
-            ssPayload >> nVersion >> nService >> nTime >> nNonceFrom >> strSubVer >> nStartingHeight;
-            nTimeDelta = nTime - nTimeRecv;
-
-            if (STD_DEBUG)
+            if (!StressTestSendMsgGetAddress())
             {
-                string sInfo = string("hello peer: ") + tPeerEp.ToString() + string(", height: ") + to_string(nStartingHeight);
-                blockhead::StdDebug("CFLOW", sInfo.c_str());
-            }
-
-            if (fInBound)
-            {
-                if (ePeerState == DNP_E_ST_PEER_STATE_IN_CONNECTED)
-                {
-                    if (!StressTestSendMsgHello())
-                    {
-                        blockhead::StdError(__PRETTY_FUNCTION__, "StressTestSendMsgHello fail.");
-                        return false;
-                    }
-                    StressTestModifyPeerState(DNP_E_ST_PEER_STATE_IN_WAIT_HELLO_ACK);
-                }
-                else
-                {
-                    blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_HELLO in state error.");
-                    return false;
-                }
-            }
-            else
-            {
-                if (ePeerState == DNP_E_ST_PEER_STATE_OUT_WAIT_HELLO)
-                {
-                    StressTestModifyPeerState(DNP_E_ST_PEER_STATE_OUT_HANDSHAKED_COMPLETE);
-                    nTimeDelta += (nTimeRecv - nSendHelloTime) / 2;
-                    pMsgWorkThread->StressTestHandlePeerHandshaked(this);
-
-                    if (!StressTestSendMsgHelloAck())
-                    {
-                        blockhead::StdError(__PRETTY_FUNCTION__, "StressTestSendMsgHelloAck fail.");
-                        return false;
-                    }
-                    if (!StressTestSendMsgGetAddress())
-                    {
-                        blockhead::StdError(__PRETTY_FUNCTION__, "StressTestSendMsgGetAddress fail.");
-                        return false;
-                    }
-                    StressTestModifyPeerState(DNP_E_ST_PEER_STATE_OUT_WAIT_ADDRESS_RSP);
-                }
-                else
-                {
-                    blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_HELLO out state error.");
-                    return false;
-                }
+                blockhead::StdError(__PRETTY_FUNCTION__, "StressTestSendMsgGetAddress fail.");
+                return false;
             }
+            StressTestModifyPeerState(DNP_E_ST_PEER_STATE_OUT_WAIT_ADDRESS_RSP);
         }
-        catch (exception& e)
+        else
         {
-            blockhead::StdError(__PRETTY_FUNCTION__, e.what());
+            blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_HELLO out state error.");
             return false;
         }
-        break;
     }
-    case BBPROTO_CMD_HELLO_ACK:
+    return true;
+}
+
+bool CStressTestNetPeer::StressTestHandleHelloAck(CMsgHelloAck&)
+{
+    if (fInBound)
     {
-        blockhead::StdDebug("CFLOW", "Recv msg: BBPROTO_CMD_HELLO_ACK");
-        if (fInBound)
+        if (ePeerState == DNP_E_ST_PEER_STATE_IN_WAIT_HELLO_ACK)
         {
-            if (ePeerState == DNP_E_ST_PEER_STATE_IN_WAIT_HELLO_ACK)
+            if (nVersion == 0)
             {
-                if (nVersion == 0)
-                {
-                    blockhead::StdError(__PRETTY_FUNCTION__, "nVersion error.");
-                    return false;
-                }
-                StressTestModifyPeerState(DNP_E_ST_PEER_STATE_IN_HANDSHAKED_COMPLETE);
-                nTimeDelta += (nTimeRecv - nSendHelloTime) / 2;
-                pMsgWorkThread->StressTestHandlePeerHandshaked(this);
-                if (!StressTestSendMsgGetAddress())
-                {
-                    blockhead::StdError(__PRETTY_FUNCTION__, "StressTestSendMsgGetAddress fail.");
-                    return false;
-                }
-                StressTestModifyPeerState(DNP_E_ST_PEER_STATE_IN_WAIT_ADDRESS_RSP);
+                blockhead::StdError(__PRETTY_FUNCTION__, "nVersion error.");
+                return false;
             }
-            else
+            StressTestModifyPeerState(DNP_E_ST_PEER_STATE_IN_HANDSHAKED_COMPLETE);
+            nTimeDelta += (GetTime() - nSendHelloTime) / 2;
+            pMsgWorkThread->StressTestHandlePeerHandshaked(this);
+            if (!StressTestSendMsgGetAddress())
             {
-                blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_HELLO_ACK in state error.");
+                blockhead::StdError(__PRETTY_FUNCTION__, "StressTestSendMsgGetAddress fail.");
                 return false;
             }
+            StressTestModifyPeerState(DNP_E_ST_PEER_STATE_IN_WAIT_ADDRESS_RSP);
         }
-        break;
-    }
-    case BBPROTO_CMD_GETADDRESS:
-    {
-        blockhead::StdDebug("CFLOW", "Recv msg: BBPROTO_CMD_GETADDRESS");
-        if (!StressTestSendMsgAddress())
+        else
         {
-            blockhead::StdError(__PRETTY_FUNCTION__, "StressTestSendMsgAddress fail.");
+            blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_HELLO_ACK in state error.");
             return false;
         }
-        break;
     }
-    case BBPROTO_CMD_ADDRESS:
+    return true;
+}
+
+bool CStressTestNetPeer::StressTestHandleGetAddress(CMsgGetAddress&)
+{
+    if (!StressTestSendMsgAddress())
     {
-        blockhead::StdDebug("CFLOW", "Recv msg: BBPROTO_CMD_ADDRESS");
+        blockhead::StdError(__PRETTY_FUNCTION__, "StressTestSendMsgAddress fail.");
+        return false;
+    }
+    return true;
+}
 
-        vector<CAddress> vAddrList;
-        CBlockheadBufStream ssPayload;
-        if (!tRecvDataBuf.GetPayload(ssPayload))
-        {
-            blockhead::StdError(__PRETTY_FUNCTION__, "GetPayload fail.");
-            return false;
-        }
-        ssPayload >> vAddrList;
+bool CStressTestNetPeer::StressTestHandleAddress(CMsgAddressView& tMsg)
+{
+    if (STD_DEBUG)
+    {
+        string sInfo = string("Recv address count: ") + to_string(tMsg.GetCount());
+        blockhead::StdDebug("CFLOW", sInfo.c_str());
+    }
 
-        if (STD_DEBUG)
+    CAddress tAddr;
+    for (uint32 i = 0; i < tMsg.GetCount(); i++)
+    {
+        tMsg.GetAddress(i, tAddr);
+        if ((tAddr.nService & NODE_NETWORK) == NODE_NETWORK)
         {
-            string sInfo = string("Recv address count: ") + to_string(vAddrList.size());
-            blockhead::StdDebug("CFLOW", sInfo.c_str());
-        }
+            tcp::endpoint ep;
+            tAddr.ssEndpoint.GetEndpoint(ep);
+            pBbAddrPool->StressTestAddRecvAddr(ep, tAddr.nService);
 
-        for (vector<CAddress>::iterator it = vAddrList.begin(); it != vAddrList.end(); ++it)
-        {
-            if (((*it).nService & NODE_NETWORK) == NODE_NETWORK)
+            if (STD_DEBUG)
             {
-                tcp::endpoint ep;
-                (*it).ssEndpoint.GetEndpoint(ep);
-                pBbAddrPool->StressTestAddRecvAddr(ep, (*it).nService);
-
-                if (STD_DEBUG)
-                {
-                    string strAddAddr = string("Address: ") + ep.address().to_string() + ":" + to_string(ep.port());
-                    blockhead::StdDebug("CFLOW", strAddAddr.c_str());
-                }
+                string strAddAddr = string("Address: ") + ep.address().to_string() + ":" + to_string(ep.port());
+                blockhead::StdDebug("CFLOW", strAddAddr.c_str());
             }
         }
-        fGetPeerAddress = true;
+    }
+    fGetPeerAddress = true;
 
-        if (ePeerState == DNP_E_ST_PEER_STATE_IN_WAIT_ADDRESS_RSP)
-        {
-            StressTestModifyPeerState(DNP_E_ST_PEER_STATE_IN_COMPLETE);
-        }
-        else if (ePeerState == DNP_E_ST_PEER_STATE_OUT_WAIT_ADDRESS_RSP)
-        {
-            StressTestModifyPeerState(DNP_E_ST_PEER_STATE_OUT_COMPLETE);
-        }
-        else
-        {
-            blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_ADDRESS state error.");
-            return false;
-        }
-        break;
+    if (ePeerState == DNP_E_ST_PEER_STATE_IN_WAIT_ADDRESS_RSP)
+    {
+        StressTestModifyPeerState(DNP_E_ST_PEER_STATE_IN_COMPLETE);
     }
-    default:
-        blockhead::StdError(__PRETTY_FUNCTION__, "Error message.");
-        break;
+    else if (ePeerState == DNP_E_ST_PEER_STATE_OUT_WAIT_ADDRESS_RSP)
+    {
+        StressTestModifyPeerState(DNP_E_ST_PEER_STATE_OUT_COMPLETE);
+    }
+    else
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "BBPROTO_CMD_ADDRESS state error.");
+        return false;
     }
-
     return true;
 }
 
@@ -966,10 +948,22 @@ void CStressTestNetPeer::StressTestModifyPeerState(DNP_E_PEER_STATE eState)
     tmStateBeginTime = time(NULL);
 }
 
-bool CStressTestNetPeer::StressTestSendMessage(int nChannel, int nCommand, CBlockheadBufStream& ssPayload)
+bool CStressTestNetPeer::StressTestSendMessage(int nChannel, int nCommand, CProtoPacketStream& ssPacket)
+{
+    ssPacket.SetHeader(nMsgMagic, nChannel, nCommand);
+    return pMsgWorkThread->StressTestSendDataPacket(nPeerNetId, tPeerEp, tLocalEp, ssPacket.GetData(), ssPacket.GetSize());
+}
+
+bool CStressTestNetPeer::StressTestSendEmptyMessage(int nCommand)
 {
-    CProtoDataBuf tPacketBuf(nMsgMagic, nChannel, nCommand, ssPayload);
-    return pMsgWorkThread->StressTestSendDataPacket(nPeerNetId, tPeerEp, tLocalEp, tPacketBuf.GetDataBuf(), tPacketBuf.GetDataLen());
+    char* pPacket = NULL;
+    uint32 nPacketLen = 0;
+    if (!pMsgWorkThread->tMsgTemplate.GetEmptyPacket(nCommand, pPacket, nPacketLen))
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "GetEmptyPacket fail.");
+        return false;
+    }
+    return pMsgWorkThread->StressTestSendDataPacket(nPeerNetId, tPeerEp, tLocalEp, pPacket, nPacketLen);
 }
 
 bool CStressTestNetPeer::StressTestDoStateTimer(time_t tmCurTime)
@@ -1050,45 +1044,42 @@ bool CStressTestNetPeer::StressTestDoStateTimer(time_t tmCurTime)
 bool CStressTestNetPeer::StressTestSendMsgHello()
 {
     blockhead::StdDebug("CFLOW", "Send msg: BBPROTO_CMD_HELLO");
-    CBlockheadBufStream ssPayload;
-    int iLocalVersion = PROTO_VERSION;
-    uint64 nLocalService = NODE_NETWORK;
-    string strLocalSubVer = FormatSubVersion();
-
-    uint64 nNonce = nPeerNetId;
-    int64 nTime = pBbAddrPool->StressTestGetNetTime();
-    int nHeight = pBbAddrPool->StressTestGetConfidentHeight();
-    ssPayload << iLocalVersion << nLocalService << nTime << nNonce << strLocalSubVer << nHeight;
+    char* pPacket = NULL;
+    uint32 nPacketLen = 0;
+    if (!pMsgWorkThread->tMsgTemplate.GetHelloPacket(pBbAddrPool->StressTestGetNetTime(), nPeerNetId,
+                                                      pBbAddrPool->StressTestGetConfidentHeight(), pPacket, nPacketLen))
+    {
+        blockhead::StdError(__PRETTY_FUNCTION__, "GetHelloPacket fail.");
+        return false;
+    }
 
     nSendHelloTime = GetTime();
-    return StressTestSendMessage(BBPROTO_CHN_NETWORK, BBPROTO_CMD_HELLO, ssPayload);
+    return pMsgWorkThread->StressTestSendDataPacket(nPeerNetId, tPeerEp, tLocalEp, pPacket, nPacketLen);
 }
 
 bool CStressTestNetPeer::StressTestSendMsgHelloAck()
 {
     blockhead::StdDebug("CFLOW", "Send msg: BBPROTO_CMD_HELLO_ACK");
-    CBlockheadBufStream ssPayload;
-    return StressTestSendMessage(BBPROTO_CHN_NETWORK, BBPROTO_CMD_HELLO_ACK, ssPayload);
+    return StressTestSendEmptyMessage(BBPROTO_CMD_HELLO_ACK);
 }
 
 bool CStressTestNetPeer::StressTestSendMsgGetAddress()
 {
     blockhead::StdDebug("CFLOW", "Send msg: BBPROTO_CMD_GETADDRESS");
-    CBlockheadBufStream ssPayload;
-    return StressTestSendMessage(BBPROTO_CHN_NETWORK, BBPROTO_CMD_GETADDRESS, ssPayload);
+    return StressTestSendEmptyMessage(BBPROTO_CMD_GETADDRESS);
 }
 
 bool CStressTestNetPeer::StressTestSendMsgAddress()
 {
-    CBlockheadBufStream ssPayload;
-    vector<CAddress> vAddrList;
-    pBbAddrPool->StressTestGetGoodAddressList(vAddrList);
+    CProtoPacketStream ssPacket;
+    CMsgAddress tMsg;
+    pBbAddrPool->StressTestGetGoodAddressList(tMsg.vAddrList);
 
-    string sInfo = string("Send msg: BBPROTO_CMD_ADDRESS, addr count: ") + to_string(vAddrList.size());
+    string sInfo = string("Send msg: BBPROTO_CMD_ADDRESS, addr count: ") + to_string(tMsg.vAddrList.size());
     blockhead::StdDebug("CFLOW", sInfo.c_str());
 
-    ssPayload << vAddrList;
-    return StressTestSendMessage(BBPROTO_CHN_NETWORK, BBPROTO_CMD_ADDRESS, ssPayload);
+    ProtoMsgEncode(tMsg, ssPacket);
+    return StressTestSendMessage(BBPROTO_CHN_NETWORK, BBPROTO_CMD_ADDRESS, ssPacket);
 }
 
 //-------------------------------------------------------------------------------------
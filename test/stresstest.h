@@ -11,6 +11,7 @@
 #include "blockhead/type.h"
 #include "network/networkservice.h"
 #include "dnseed/netproto.h"
+#include "dnseed/netmsgcodec.h"
 #include "dnseed/netpeer.h"
 #include "dnseed/addrpool.h"
 #include <boost/filesystem.hpp>
@@ -200,6 +201,7 @@ private:
     uint32 nCompTestCount;
 
     map<uint64,CStressTestNetPeer*> mapPeer;
+    CProtoMsgTemplate tMsgTemplate;
 
     time_t tmPrevTimerDoTime;
 
@@ -243,9 +245,14 @@ public:
 
 private:
     bool StressTestDoPeerPacket();
+    bool StressTestHandleHello(CMsgHello& tMsg);
+    bool StressTestHandleHelloAck(CMsgHelloAck& tMsg);
+    bool StressTestHandleGetAddress(CMsgGetAddress& tMsg);
+    bool StressTestHandleAddress(CMsgAddressView& tMsg);
 
     void StressTestModifyPeerState(DNP_E_PEER_STATE eState);
-    bool StressTestSendMessage(int nChannel, int nCommand, CBlockheadBufStream& ssPayload);
+    bool StressTestSendMessage(int nChannel, int nCommand, CProtoPacketStream& ssPacket);
+    bool StressTestSendEmptyMessage(int nCommand);
     bool StressTestDoStateTimer(time_t tmCurTime);
 
     bool StressTestSendMsgHello();
@@ -255,6 +262,8 @@ private:
     bool StressTestSendMsgAddress();
 
 private:
+    static const CProtoMsgEntry<CStressTestNetPeer> tMsgTable[];
+
     bool fInBound;
     DNP_E_PEER_STATE ePeerState;
     time_t tmStateBeginTime;